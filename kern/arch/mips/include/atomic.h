@@ -0,0 +1,197 @@
+#ifndef _MIPS_ATOMIC_H_
+#define _MIPS_ATOMIC_H_
+
+/*
+ * Atomic operations, using LL/SC. See include/atomic.h.
+ *
+ * LL/SC by itself doesn't order anything, so the ordered operations
+ * put a sync on each side.
+ */
+
+#include <membar.h>
+
+/*
+ * The primitives: LL/SC loops with no ordering. Each retries until
+ * its SC succeeds, and returns what *P was.
+ */
+ATOMIC_INLINE int atomic_md_fetch_add(volatile int *p, int delta);
+ATOMIC_INLINE int atomic_md_fetch_or(volatile int *p, int bits);
+ATOMIC_INLINE int atomic_md_cmpxchg(volatile int *p, int old, int new);
+
+ATOMIC_INLINE
+int
+atomic_md_fetch_add(volatile int *p, int delta)
+{
+	int prev, tmp;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set noreorder;"	/* we fill the delay slots */
+		"1: ll %0, 0(%2);"	/* prev = *p */
+		"addu %1, %0, %3;"	/* tmp = prev + delta */
+		"sc %1, 0(%2);"		/* *p = tmp; tmp = success? */
+		"beqz %1, 1b;"		/* retry if the store failed */
+		" nop;"			/* (delay slot) */
+		".set pop"		/* restore assembler mode */
+		: "=&r" (prev), "=&r" (tmp)
+		: "r" (p), "r" (delta)
+		: "memory");
+	return prev;
+}
+
+ATOMIC_INLINE
+int
+atomic_md_fetch_or(volatile int *p, int bits)
+{
+	int prev, tmp;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set noreorder;"	/* we fill the delay slots */
+		"1: ll %0, 0(%2);"	/* prev = *p */
+		"or %1, %0, %3;"	/* tmp = prev | bits */
+		"sc %1, 0(%2);"		/* *p = tmp; tmp = success? */
+		"beqz %1, 1b;"		/* retry if the store failed */
+		" nop;"			/* (delay slot) */
+		".set pop"		/* restore assembler mode */
+		: "=&r" (prev), "=&r" (tmp)
+		: "r" (p), "r" (bits)
+		: "memory");
+	return prev;
+}
+
+ATOMIC_INLINE
+int
+atomic_md_cmpxchg(volatile int *p, int old, int new)
+{
+	int prev, tmp;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set noreorder;"	/* we fill the delay slots */
+		"1: ll %0, 0(%2);"	/* prev = *p */
+		"bne %0, %3, 2f;"	/* stop if it isn't OLD */
+		" move %1, %4;"		/* (delay slot) tmp = new */
+		"sc %1, 0(%2);"		/* *p = tmp; tmp = success? */
+		"beqz %1, 1b;"		/* retry if the store failed */
+		" nop;"			/* (delay slot) */
+		"2:;"
+		".set pop"		/* restore assembler mode */
+		: "=&r" (prev), "=&r" (tmp)
+		: "r" (p), "r" (old), "r" (new)
+		: "memory");
+	return prev;
+}
+
+////////////////////////////////////////////////////////////
+
+ATOMIC_INLINE
+int
+atomic_get(volatile int *p)
+{
+	return *p;
+}
+
+ATOMIC_INLINE
+void
+atomic_set(volatile int *p, int val)
+{
+	*p = val;
+}
+
+ATOMIC_INLINE
+void
+atomic_add(volatile int *p, int delta)
+{
+	atomic_md_fetch_add(p, delta);
+}
+
+ATOMIC_INLINE
+void
+atomic_inc(volatile int *p)
+{
+	atomic_md_fetch_add(p, 1);
+}
+
+ATOMIC_INLINE
+void
+atomic_dec(volatile int *p)
+{
+	atomic_md_fetch_add(p, -1);
+}
+
+ATOMIC_INLINE
+int
+atomic_fetch_add(volatile int *p, int delta)
+{
+	int prev;
+
+	membar_any_any();
+	prev = atomic_md_fetch_add(p, delta);
+	membar_any_any();
+	return prev;
+}
+
+ATOMIC_INLINE
+int
+atomic_fetch_or(volatile int *p, int bits)
+{
+	int prev;
+
+	membar_any_any();
+	prev = atomic_md_fetch_or(p, bits);
+	membar_any_any();
+	return prev;
+}
+
+ATOMIC_INLINE
+int
+atomic_cmpxchg(volatile int *p, int old, int new)
+{
+	int prev;
+
+	membar_any_any();
+	prev = atomic_md_cmpxchg(p, old, new);
+	membar_any_any();
+	return prev;
+}
+
+ATOMIC_INLINE
+bool
+atomic_add_unless(volatile int *p, int delta, int unless)
+{
+	int val, prev;
+
+	membar_any_any();
+	val = *p;
+	while (val != unless) {
+		prev = atomic_md_cmpxchg(p, val, val + delta);
+		if (prev == val) {
+			membar_any_any();
+			return true;
+		}
+		val = prev;
+	}
+	membar_any_any();
+	return false;
+}
+
+ATOMIC_INLINE
+bool
+atomic_inc_and_test(volatile int *p)
+{
+	return atomic_fetch_add(p, 1) == -1;
+}
+
+ATOMIC_INLINE
+bool
+atomic_dec_and_test(volatile int *p)
+{
+	return atomic_fetch_add(p, -1) == 1;
+}
+
+
+#endif /* _MIPS_ATOMIC_H_ */
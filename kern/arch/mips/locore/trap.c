@@ -157,6 +157,8 @@ mips_trap(struct trapframe *tf)
 						+ STACK_SIZE));
 	}
 
+	cpustat_inc(CPUSTAT_TRAPS);
+
 	/* Interrupt? Call the interrupt handler and return. */
 	if (code == EX_IRQ) {
 		int old_in;
@@ -193,6 +195,9 @@ mips_trap(struct trapframe *tf)
 			doadjust = false;
 		}
 
+		/* For charging the tick, if it's a timer interrupt. */
+		curcpu->c_irq_fromuser = !iskern;
+
 		mainbus_interrupt(tf);
 
 		if (doadjust) {
@@ -203,6 +208,17 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+
+		/*
+		 * If we're going back to user mode but another
+		 * thread is exiting the process, exit instead. That
+		 * needs the interrupt state in sync as below.
+		 */
+		if (!iskern && curproc->p_exiting) {
+			spl = splhigh();
+			splx(spl);
+			proc_checkexit();
+		}
 		goto done2;
 	}
 
@@ -323,6 +339,11 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+	if (!iskern) {
+		/* Another thread may be exiting the process. */
+		proc_checkexit();
+	}
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
@@ -444,3 +465,24 @@ enter_new_process(int argc, userptr_t argv, userptr_t env,
 
 	mips_usermode(&tf);
 }
+
+/*
+ * enter_new_thread: go to user mode in a new thread of an existing
+ * process. Like enter_new_process, but the arguments go to the
+ * thread's start routine.
+ */
+void
+enter_new_thread(userptr_t func, userptr_t arg, vaddr_t stack, vaddr_t entry)
+{
+	struct trapframe tf;
+
+	bzero(&tf, sizeof(tf));
+
+	tf.tf_status = CST_IRQMASK | CST_IEp | CST_KUp;
+	tf.tf_epc = entry;
+	tf.tf_a0 = (vaddr_t)func;
+	tf.tf_a1 = (vaddr_t)arg;
+	tf.tf_sp = stack;
+
+	mips_usermode(&tf);
+}
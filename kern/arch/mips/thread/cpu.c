@@ -92,6 +92,20 @@ cpu_machdep_init(struct cpu *c)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Read the cycle counter (coprocessor 0 register 9).
+ */
+uint32_t
+cpu_getcycles(void)
+{
+	uint32_t count;
+
+	__asm volatile("mfc0 %0,$9" : "=r" (count));
+	return count;
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Return the type name of the currently running CPU.
  *
@@ -1,19 +1,21 @@
 #include <types.h>
 #include <thread.h>
+#include <cpu.h>
 #include <kern/errno.h>
 #include <addrspace.h>
 #include <vm.h>
 #include <synch.h>
 #include <swap.h>
 #include <proc.h>
+#include <current.h>
 #include <spl.h>
 #include <mips/tlb.h>
 #include <lib.h>
 
 struct coremap *cm;
-struct spinlock cm_spinlock = SPINLOCK_INITIALIZER;
-struct spinlock tlb_spinlock = SPINLOCK_INITIALIZER;
-volatile size_t cm_page_count;
+struct spinlock cm_spinlock =
+    SPINLOCK_TICKET_INITIALIZER_NAMED("cm_spinlock");
+struct spinlock tlb_spinlock = SPINLOCK_INITIALIZER_NAMED("tlb_spinlock");
 static pp_num_t cm_evict_index = 0;
 
 pp_num_t first_page;
@@ -34,7 +36,7 @@ static inline void free_ppage(pp_num_t p) {
     cm->entries[p].busy = false;
     cm->entries[p].owner = NULL;
     cm->entries[p].vaddr = 0;
-    cm_page_count--;
+    cpustat_add(CPUSTAT_COREPAGES, -1);
 }
 
 static bool is_valid_address(struct addrspace* as, vaddr_t vaddr) {
@@ -53,7 +55,7 @@ static bool is_valid_address(struct addrspace* as, vaddr_t vaddr) {
     }
 
     if (vaddr < USERSTACK && vaddr >= as->stack_base) {
-        return true;
+        return !as_stack_guard(as, vaddr);
     }
 
     return false;
@@ -93,7 +95,7 @@ static void kalloc_ppage(pp_num_t pp_num) {
     cm->entries[pp_num].busy = false;
     cm->entries[pp_num].owner = NULL;
     cm->entries[pp_num].vaddr = 0;
-    cm_page_count++;
+    cpustat_inc(CPUSTAT_COREPAGES);
 }
 
 void vm_bootstrap() {
@@ -127,8 +129,6 @@ void vm_bootstrap() {
         cm->entries[i].pp_num = 0;
     }
 
-    cm_page_count = 0;
-
     /* Recompute the total pages */
     KASSERT(ram_stealmem(0) % PAGE_SIZE == 0);
     first_page = PADDR_TO_PPAGE(ram_stealmem(0));
@@ -167,8 +167,9 @@ static int get_region_permissions(struct addrspace *as, vaddr_t vaddr,
         return 0;
     }
 
-    /* Same with stack */
-    if (vaddr < USERSTACK && vaddr >= as->stack_base) {
+    /* Same with stack, except for the guard pages */
+    if (vaddr < USERSTACK && vaddr >= as->stack_base &&
+        !as_stack_guard(as, vaddr)) {
         *readable = true;
         *writeable = true;
         *executable = false;
@@ -180,7 +181,7 @@ static int get_region_permissions(struct addrspace *as, vaddr_t vaddr,
 
 static unsigned int tlb_next_victim = 0;
 
-static void cm_set_user_page(pp_num_t ppn, struct addrspace *as, vaddr_t vaddr) {
+void cm_set_user_page(pp_num_t ppn, struct addrspace *as, vaddr_t vaddr) {
     spinlock_acquire(&cm_spinlock);
     cm->entries[ppn].kernel_page = false;
     cm->entries[ppn].owner = as;
@@ -208,20 +209,43 @@ static int evict_one(pp_num_t *freed_ppn) {
         vaddr_t vaddr = cme->vaddr;
 
         KASSERT(as != NULL);
-        lock_acquire(as->as_lock);
+
+        /*
+         * If we got here from our own fault handler we already hold
+         * this address space for writing, or from as_copy we hold
+         * it for reading; taking it again would deadlock, so pick a
+         * page from somebody else.
+         */
+        if (rwlock_do_i_hold_write(as->as_lock) || as == curthread->t_ascopy) {
+            spinlock_acquire(&cm_spinlock);
+            cme->busy = false;
+            continue;
+        }
+
+        rwlock_acquire_write(as->as_lock);
         struct pte *pte = pagetable_lookup(as->pt, vaddr);
         if (pte == NULL || !pte->valid || !pte->in_mem || pte->ppn != cme->pp_num) {
-            lock_release(as->as_lock);
+            rwlock_release_write(as->as_lock);
             spinlock_acquire(&cm_spinlock);
             cme->busy = false;
-            spinlock_release(&cm_spinlock);
             continue;
         }
 
+        /*
+         * Take it out of every TLB before copying it out, so that
+         * no thread of the owner (which may be running on another
+         * cpu) can still write to it through a stale entry. With the
+         * address space locked they can't fault it back in.
+         */
+        struct tlbshootdown tlb;
+        tlb.vaddr = vaddr;
+        vm_tlbshootdown(&tlb);
+        ipi_tlbshootdown_broadcast(&tlb);
+
         off_t swap_offset;
         int result = swap_alloc_slot(&swap_offset);
         if (result) {
-            lock_release(as->as_lock);
+            rwlock_release_write(as->as_lock);
             spinlock_acquire(&cm_spinlock);
             cme->busy = false;
             spinlock_release(&cm_spinlock);
@@ -230,7 +254,7 @@ static int evict_one(pp_num_t *freed_ppn) {
 
         result = swap_write_page(PPAGE_TO_PADDR(cme->pp_num), swap_offset);
         if (result) {
-            lock_release(as->as_lock);
+            rwlock_release_write(as->as_lock);
             spinlock_acquire(&cm_spinlock);
             cme->busy = false;
             spinlock_release(&cm_spinlock);
@@ -243,16 +267,13 @@ static int evict_one(pp_num_t *freed_ppn) {
         pte->dirty = false;
         pte->ppn = 0;
 
-        struct tlbshootdown tlb;
-        tlb.vaddr = vaddr;
-        vm_tlbshootdown(&tlb);
-
-        lock_release(as->as_lock);
+        rwlock_release_write(as->as_lock);
 
         spinlock_acquire(&cm_spinlock);
         free_ppage(cme->pp_num);
         *freed_ppn = candidate;
         spinlock_release(&cm_spinlock);
+        cpustat_inc(CPUSTAT_EVICTIONS);
         return 0;
     }
 
@@ -293,33 +314,101 @@ void tlb_insert_entry(uint32_t entryhi, uint32_t entrylo) {
     tlb_next_victim = (tlb_next_victim + 1) % NUM_TLB;
 }
 
+/*
+ * Check the access against the page and load it into the TLB. The
+ * caller holds the address space lock in either mode.
+ */
+static int vm_fault_map(struct pte *entry, int faulttype, vaddr_t faultaddress) {
+    /* Check permissions based on fault type */
+    if (faulttype == VM_FAULT_READONLY && entry->readonly) {
+        return EFAULT;
+    }
+
+    if (faulttype == VM_FAULT_WRITE) {
+        entry->dirty = true;
+    }
+
+    /*
+     * TLB SHENANIGANS HERE
+     */
+    uint32_t entryhi = faultaddress & TLBHI_VPAGE;
+    uint32_t entrylo = (PPAGE_TO_PADDR(entry->ppn) & TLBLO_PPAGE) | TLBLO_VALID;
+
+    if (!entry->readonly) {
+        entrylo |= TLBLO_DIRTY;
+    }
+
+    bool holding_tlblock = spinlock_do_i_hold(&tlb_spinlock);
+
+    if (!holding_tlblock) {
+        spinlock_acquire(&tlb_spinlock);
+    }
+
+    int spl = splhigh();
+    tlb_insert_entry(entryhi, entrylo);
+    splx(spl);
+
+    if (!holding_tlblock) {
+        spinlock_release(&tlb_spinlock);
+    }
+
+    return 0;
+}
+
 int vm_fault(int faulttype, vaddr_t faultaddress) {
     struct addrspace *as;
+    struct pte *entry;
     int result;
 
+    cpustat_inc(CPUSTAT_VMFAULTS);
+
     as = proc_getas();
     if (as == NULL) {
         return EFAULT;
     }
 
-    /* Acquire lock for addresspace */
-    lock_acquire(as->as_lock);
+    vaddr_t page_vaddr = faultaddress & PAGE_FRAME;
+
+    /*
+     * Most faults are TLB misses on pages that are already resident.
+     * Those only read the page table, so threads sharing the address
+     * space can handle them at the same time.
+     */
+    rwlock_acquire_read(as->as_lock);
 
-    /* Check if the fault address is within range */
     if (!is_valid_address(as, faultaddress)) {
-        lock_release(as->as_lock);
+        rwlock_release_read(as->as_lock);
         return EFAULT;
     }
 
-    vaddr_t page_vaddr = faultaddress & PAGE_FRAME;
-    struct pte* entry = pagetable_lookup(as->pt, page_vaddr);
+    entry = pagetable_lookup(as->pt, page_vaddr);
+    if (entry != NULL && entry->valid && entry->in_mem) {
+        result = vm_fault_map(entry, faulttype, faultaddress);
+        rwlock_release_read(as->as_lock);
+        return result;
+    }
+    rwlock_release_read(as->as_lock);
+
+    /*
+     * The page has to be allocated or brought in from swap. Take the
+     * lock for writing and look again, since the address space may
+     * have changed while we held no lock.
+     */
+    rwlock_acquire_write(as->as_lock);
+
+    if (!is_valid_address(as, faultaddress)) {
+        rwlock_release_write(as->as_lock);
+        return EFAULT;
+    }
+
+    entry = pagetable_lookup(as->pt, page_vaddr);
 
     /* If no mapping exists, create a new page */
     if (entry == NULL || !entry->valid) {
         vaddr_t vaddr = alloc_user_page();
 
         if (vaddr == 0) {
-            lock_release(as->as_lock);
+            rwlock_release_write(as->as_lock);
             return ENOMEM;
         }
 
@@ -333,7 +422,7 @@ int vm_fault(int faulttype, vaddr_t faultaddress) {
 
         if (result) {
             free_kpages(vaddr);
-            lock_release(as->as_lock);
+            rwlock_release_write(as->as_lock);
             return EFAULT;
         }
 
@@ -344,7 +433,7 @@ int vm_fault(int faulttype, vaddr_t faultaddress) {
         result = pagetable_insert(as->pt, page_vaddr, paddr, readonly);
         
         if (result) {
-            lock_release(as->as_lock);
+            rwlock_release_write(as->as_lock);
             return result;
         }
 
@@ -354,13 +443,13 @@ int vm_fault(int faulttype, vaddr_t faultaddress) {
     } else if (!entry->in_mem) {
         vaddr_t vaddr = alloc_user_page();
         if (vaddr == 0) {
-            lock_release(as->as_lock);
+            rwlock_release_write(as->as_lock);
             return ENOMEM;
         }
 
         if (entry->swap_offset == SWAP_OFFSET_NONE) {
             free_kpages(vaddr);
-            lock_release(as->as_lock);
+            rwlock_release_write(as->as_lock);
             return EFAULT;
         }
 
@@ -369,7 +458,7 @@ int vm_fault(int faulttype, vaddr_t faultaddress) {
         result = swap_read_page(paddr, entry->swap_offset);
         if (result) {
             free_kpages(vaddr);
-            lock_release(as->as_lock);
+            rwlock_release_write(as->as_lock);
             return result;
         }
 
@@ -382,42 +471,9 @@ int vm_fault(int faulttype, vaddr_t faultaddress) {
         cm_set_user_page(entry->ppn, as, page_vaddr);
     }
 
-    /* Check permissions based on fault type */
-    if (faulttype == VM_FAULT_READONLY && entry->readonly) {
-        lock_release(as->as_lock);
-        return EFAULT;
-    }
-
-    if (faulttype == VM_FAULT_WRITE) {
-        entry->dirty = true;
-    }
-
-    /*
-     * TLB SHENANIGANS HERE
-     */
-    uint32_t entryhi = faultaddress & TLBHI_VPAGE;
-    uint32_t entrylo = (PPAGE_TO_PADDR(entry->ppn) & TLBLO_PPAGE) | TLBLO_VALID;
-
-    if (!entry->readonly) {
-        entrylo |= TLBLO_DIRTY;
-    }
-
-    bool holding_tlblock = spinlock_do_i_hold(&tlb_spinlock);
-
-    if (!holding_tlblock) {
-        spinlock_acquire(&tlb_spinlock);
-    }
-
-    int spl = splhigh();
-    tlb_insert_entry(entryhi, entrylo);
-    splx(spl);
-
-    if (!holding_tlblock) {
-        spinlock_release(&tlb_spinlock);
-    }
-
-    lock_release(as->as_lock);
-    return 0;
+    result = vm_fault_map(entry, faulttype, faultaddress);
+    rwlock_release_write(as->as_lock);
+    return result;
 }
 
 vaddr_t alloc_kpages(unsigned npages) {
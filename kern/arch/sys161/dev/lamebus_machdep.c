@@ -332,3 +332,76 @@ mainbus_interrupt(struct trapframe *tf)
 		}
 	}
 }
+
+/*
+ * Tickless idle support.
+ *
+ * Normally the timer goes off once per hardclock period. A cpu with
+ * nothing to do can stretch the current period to cover TICKS of them
+ * so it isn't woken up just to find there's still nothing to do. The
+ * count register starts over from zero at each timer interrupt (which
+ * is why mainbus_interrupt can just write the period into c0_compare),
+ * so the interrupt then comes TICKS periods after the last one.
+ *
+ * Neither function touches the timer if its interrupt is already
+ * pending, since rewriting c0_compare would clear it and lose the
+ * tick; they return false and leave it for hardclock. Interrupts must
+ * be off.
+ */
+
+static
+bool
+mips_timer_pending(void)
+{
+	uint32_t cause;
+
+	/* $13 == c0_cause */
+	__asm volatile("mfc0 %0,$13" : "=r" (cause));
+	return (cause & MIPS_TIMER_BIT) != 0;
+}
+
+bool
+mainbus_timer_stretch(unsigned ticks)
+{
+	KASSERT(curthread->t_curspl > 0);
+	KASSERT(ticks > 0);
+
+	if (mips_timer_pending()) {
+		return false;
+	}
+	mips_timer_set(ticks * (CPU_FREQUENCY / HZ));
+	return true;
+}
+
+/*
+ * Undo mainbus_timer_stretch before the stretched interrupt has come:
+ * make the timer go off at the next period boundary again, and return
+ * in *ELAPSED the number of whole periods that went by without an
+ * interrupt, which the caller must account for.
+ *
+ * If we're very close to a boundary, the count could get past it
+ * between reading it and setting c0_compare, and then the interrupt
+ * wouldn't come until the counter wrapped. So in that case count the
+ * boundary as already passed and aim for the one after.
+ */
+bool
+mainbus_timer_unstretch(unsigned *elapsed)
+{
+	const uint32_t period = CPU_FREQUENCY / HZ;
+	uint32_t count;
+	unsigned n;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	if (mips_timer_pending()) {
+		return false;
+	}
+	count = cpu_getcycles();
+	n = count / period;
+	if (period - count % period < period / 64) {
+		n++;
+	}
+	mips_timer_set((n + 1) * period);
+	*elapsed = n;
+	return true;
+}
@@ -62,6 +62,12 @@ config_rtclock(struct rtclock_softc *rtc, int unit)
 	return 0;
 }
 
+bool
+gettime_available(void)
+{
+	return the_clock != NULL;
+}
+
 void
 gettime(struct timespec *ts)
 {
@@ -41,7 +41,20 @@
 #include <pagetable.h>
 
 struct vnode;
+struct fs;
 
+/*
+ * User stacks. Thread slot N (see proc.h) gets the UTHREAD_STACKSIZE
+ * bytes ending UTHREAD_STACKSIZE*N below USERSTACK; slot 0, the main
+ * thread, is at the top. The lowest page of each slot is left unmapped
+ * as a guard, so a thread that runs off the end of its stack faults
+ * instead of scribbling on the next one; see as_stack_guard. The main
+ * thread's stack as set up by exec (down to stack_mainbase) is exempt,
+ * since a long argument list can take up more than its slot; any slots
+ * it runs into aren't given to threads (see as_first_threadstack).
+ */
+#define UTHREAD_STACKPAGES	16
+#define UTHREAD_STACKSIZE	(UTHREAD_STACKPAGES * PAGE_SIZE)
 
 /*
  * Address space - data structure associated with the virtual memory
@@ -71,7 +84,7 @@ struct addrspace {
 #else
     struct pagetable* pt;
 
-    struct lock *as_lock;
+    struct rwlock *as_lock; /* read: fault on resident page; write: table changes */
 
     struct region* region_list; /* linked list of memory regions */
 
@@ -79,6 +92,7 @@ struct addrspace {
     vaddr_t heap_end;
 
     vaddr_t stack_base;
+    vaddr_t stack_mainbase; /* bottom of the main thread's stack */
 
 #endif
 };
@@ -122,6 +136,25 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_first_threadstack - return the lowest thread slot whose stack
+ *                is clear of the main thread's. Usually 1, but a long
+ *                argument list can push the main stack into more slots.
+ *
+ *    as_define_threadstack - set up the stack for user thread slot
+ *                UTID, and hand back its initial stack pointer. Fails
+ *                if the heap or the main thread's stack is in the way.
+ *
+ *    as_grow_stack - extend the main thread's stack down to cover BASE.
+ *                Fails if the heap is in the way.
+ *
+ *    as_stack_guard - check whether VADDR is in a stack guard page.
+ *
+ *    as_define_stackpages - make the kernel pages in KPAGES (which must
+ *                come from alloc_user_page) the top NPAGES pages of the
+ *                stack, lowest first. Each page taken over is zeroed out
+ *                of KPAGES; whatever is left there on failure is still
+ *                the caller's to free.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -141,6 +174,13 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+unsigned          as_first_threadstack(struct addrspace *as);
+int               as_define_threadstack(struct addrspace *as, unsigned utid,
+                                        vaddr_t *initstackptr);
+int               as_grow_stack(struct addrspace *as, vaddr_t base);
+bool              as_stack_guard(struct addrspace *as, vaddr_t vaddr);
+int               as_define_stackpages(struct addrspace *as, vaddr_t *kpages,
+                                       unsigned npages);
 
 
 /*
@@ -148,9 +188,17 @@ int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
  *    load_elf - load an ELF user program executable into the current
  *               address space. Returns the entry point (initial PC)
  *               in the space pointed to by ENTRYPOINT.
+ *
+ *    elfcache_forget - drop the cached headers of file V. Call before
+ *               removing it, as the cache holds a reference.
+ *
+ *    elfcache_forgetfs - likewise for every file on FS. Call before
+ *               unmounting it.
  */
 
 int load_elf(struct vnode *v, vaddr_t *entrypoint);
+void elfcache_forget(struct vnode *v);
+void elfcache_forgetfs(struct fs *fs);
 
 
 #endif /* _ADDRSPACE_H_ */
@@ -0,0 +1,52 @@
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+/*
+ * Atomic operations on integers, for reference counts and flag words
+ * that are otherwise not worth a lock.
+ *
+ * get/set	Plain load/store. No ordering.
+ * add		Add DELTA to *P. No ordering.
+ * inc/dec	Add 1/-1. No ordering.
+ *
+ * fetch_add	Add DELTA to *P; returns the old value.
+ * fetch_or	Set the bits BITS in *P; returns the old value.
+ * cmpxchg	If *P is OLD, set it to NEW; returns the old value
+ *		either way (so it succeeded if that's OLD).
+ * add_unless	Add DELTA to *P unless it's UNLESS; returns true if it
+ *		added. Dropping a reference with this and UNLESS 1 lets
+ *		the last reference be handed on instead of released.
+ * inc_and_test	Add 1; true if the result is 0.
+ * dec_and_test	Subtract 1; true if the result is 0.
+ *
+ * The operations that return something are fully ordered: they act
+ * as membar_any_any (see membar.h) both before and after, so e.g.
+ * everything a thread did to an object happens before its reference
+ * is seen to go away. Those that don't return anything have no
+ * ordering; use membar.h explicitly if it's needed.
+ */
+
+#include <cdefs.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef ATOMIC_INLINE
+#define ATOMIC_INLINE INLINE
+#endif
+
+ATOMIC_INLINE int atomic_get(volatile int *p);
+ATOMIC_INLINE void atomic_set(volatile int *p, int val);
+ATOMIC_INLINE void atomic_add(volatile int *p, int delta);
+ATOMIC_INLINE void atomic_inc(volatile int *p);
+ATOMIC_INLINE void atomic_dec(volatile int *p);
+
+ATOMIC_INLINE int atomic_fetch_add(volatile int *p, int delta);
+ATOMIC_INLINE int atomic_fetch_or(volatile int *p, int bits);
+ATOMIC_INLINE int atomic_cmpxchg(volatile int *p, int old, int new);
+ATOMIC_INLINE bool atomic_add_unless(volatile int *p, int delta, int unless);
+ATOMIC_INLINE bool atomic_inc_and_test(volatile int *p);
+ATOMIC_INLINE bool atomic_dec_and_test(volatile int *p);
+
+/* Get the implementation. */
+#include <machine/atomic.h>
+
+#endif /* _ATOMIC_H_ */
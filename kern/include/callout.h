@@ -0,0 +1,85 @@
+#ifndef _CALLOUT_H_
+#define _CALLOUT_H_
+
+/*
+ * Callouts: functions to be called from the timer interrupt after a
+ * given number of hardclocks.
+ *
+ * Each cpu keeps its pending callouts in a hierarchical timing wheel
+ * (see callout.c), driven from hardclock(). A callout runs on the cpu
+ * it was scheduled from, in interrupt context, so the function may
+ * not sleep; it may take spinlocks and wake threads up.
+ */
+
+#include <spinlock.h>
+
+struct callout_wheel;
+
+struct callout {
+	struct callout *co_next;	/* Next on the same wheel slot */
+	struct callout **co_prevp;	/* What points to us; NULL if idle */
+	unsigned co_expire;		/* Wheel tick at which to fire */
+	void (*co_func)(void *);	/* Function to call */
+	void *co_arg;			/* Its argument */
+	struct callout_wheel *co_wheel;	/* Wheel we were last put on */
+};
+
+/*
+ * The wheel has CALLOUT_LEVELS levels of CALLOUT_SLOTS slots each.
+ * Level 0 covers the next CALLOUT_SLOTS ticks one tick per slot; each
+ * level above covers CALLOUT_SLOTS times as much with proportionally
+ * coarser slots, and is cascaded down as the time approaches. That
+ * makes scheduling, cancelling, and ticking all constant-time.
+ */
+#define CALLOUT_SLOTBITS	6
+#define CALLOUT_SLOTS		(1U << CALLOUT_SLOTBITS)
+#define CALLOUT_SLOTMASK	(CALLOUT_SLOTS - 1)
+#define CALLOUT_LEVELS		4
+
+/* Longest delay we can represent (about 46 hours at HZ=100). */
+#define CALLOUT_MAXTICKS	((1U << (CALLOUT_SLOTBITS*CALLOUT_LEVELS)) - 1)
+
+struct callout_wheel {
+	struct spinlock cw_lock;	/* Protects everything here */
+	unsigned cw_now;		/* Next tick to process */
+	unsigned cw_count;		/* Number of pending callouts */
+	struct callout *cw_expired;	/* Callouts being run this tick */
+	struct callout *volatile cw_running; /* Callout currently running */
+	struct callout *cw_slots[CALLOUT_LEVELS][CALLOUT_SLOTS];
+};
+
+/*
+ * Functions.
+ *
+ * callout_init      - Set up CO to call FUNC(ARG). Not scheduled.
+ * callout_schedule  - Arrange for CO to run on the current cpu once TICKS
+ *                     more hardclocks have happened; TICKS of 0 means the
+ *                     next one. If CO was already pending it is moved.
+ *                     Delays over CALLOUT_MAXTICKS are cut short.
+ * callout_stop      - Cancel CO. Returns true if it was pending. If it was
+ *                     running on another cpu, waits for it to finish, so
+ *                     afterwards CO can be freed; consequently it must not
+ *                     be called from CO's own function.
+ * callout_pending   - Check (unlocked) whether CO is scheduled.
+ *
+ * Scheduling and stopping the same callout must be serialized by the
+ * caller.
+ *
+ * callout_wheel_init - Set up a cpu's wheel.
+ * callout_hardclock  - Advance the current cpu's wheel by one tick and
+ *                      run whatever's due. Called from hardclock().
+ * callout_nextdue    - Number of hardclocks until the current cpu's wheel
+ *                      next needs one to do anything (1 means the very
+ *                      next one). CALLOUT_MAXTICKS if it's empty.
+ */
+void callout_init(struct callout *co, void (*func)(void *), void *arg);
+void callout_schedule(struct callout *co, unsigned ticks);
+bool callout_stop(struct callout *co);
+bool callout_pending(struct callout *co);
+
+void callout_wheel_init(struct callout_wheel *cw);
+void callout_hardclock(void);
+unsigned callout_nextdue(void);
+
+
+#endif /* _CALLOUT_H_ */
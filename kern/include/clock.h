@@ -40,6 +40,12 @@
 /*
  * hardclock() is called on every CPU HZ times a second, possibly only
  * when the CPU is not idle, for scheduling.
+ *
+ * An idle CPU doesn't take timer interrupts it has no use for: the
+ * idle loop calls hardclock_idle() before going to sleep, which lets
+ * the timer skip ticks until the next callout is due (or up to a
+ * second), and hardclock_unidle() on waking, which puts it back and
+ * catches up on the ticks that were skipped.
  */
 
 /* hardclocks per second */
@@ -47,17 +53,23 @@
 
 void hardclock_bootstrap(void);
 void hardclock(void);
+void hardclock_idle(void);
+void hardclock_unidle(void);
 
 /*
  * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
+ * timed operations. (This is a fairly simpleminded interface; use a
+ * callout, see callout.h, for anything else.)
  */
 void timerclock(void);
 
 /*
  * gettime() may be used to fetch the current time of day.
+ * gettime_available() says whether the clock device has been found
+ * yet; until it has, gettime() may not be called.
  */
 void gettime(struct timespec *ret);
+bool gettime_available(void);
 
 /*
  * arithmetic on times
@@ -73,11 +85,18 @@ void timespec_sub(const struct timespec *t1,
 		  const struct timespec *t2,
 		  struct timespec *ret);
 
+/*
+ * Convert an interval to hardclocks, rounding up.
+ */
+unsigned timespec_to_hardclocks(const struct timespec *ts);
+
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
+ * clocksleep_ticks() does the same for a number of hardclocks.
  */
 void clocksleep(int seconds);
+void clocksleep_ticks(unsigned ticks);
 
 
 #endif /* _CLOCK_H_ */
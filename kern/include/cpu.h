@@ -33,9 +33,29 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <callout.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
 
+/*
+ * Number of scheduler priority levels, and thus of run queues per
+ * cpu. Level 0 is the most favoured. See schedule() in thread.c.
+ */
+#define SCHED_NLEVELS	8
+
+/*
+ * Per-cpu statistics counters; see cpustat_add below.
+ */
+#define CPUSTAT_HARDCLOCKS	0	/* hardclock() calls */
+#define CPUSTAT_SKIPPEDTICKS	1	/* ...of which skipped while idle */
+#define CPUSTAT_TRAPS		2	/* mips_trap() calls */
+#define CPUSTAT_SYSCALLS	3	/* System calls */
+#define CPUSTAT_VMFAULTS	4	/* vm_fault() calls */
+#define CPUSTAT_EVICTIONS	5	/* Pages written out to swap */
+#define CPUSTAT_COREPAGES	6	/* Physical pages allocated, net */
+#define CPUSTAT_IDLETICKS	7	/* Hardclocks that found the cpu idle */
+#define CPUSTAT_NUM		8
+
 /*
  * Per-cpu structure
  *
@@ -59,15 +79,24 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
-	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	unsigned c_idleticks;		/* Ticks the timer is stretched over */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	bool c_irq_fromuser;		/* Interrupt being handled hit user mode */
+
+	/*
+	 * Statistics. Normally changed only by this cpu, but may be
+	 * read by anyone, so use the cpustat functions.
+	 */
+	volatile int c_stats[CPUSTAT_NUM];
 
 	/*
 	 * Accessed by other cpus.
-	 * Protected by the runqueue lock.
+	 * Protected by the runqueue lock. (c_runqueue_count is also
+	 * read unlocked by other cpus looking for work to steal.)
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_runqueue[SCHED_NLEVELS]; /* Run queues, by level */
+	volatile unsigned c_runqueue_count; /* Total threads on c_runqueue[] */
 	struct spinlock c_runqueue_lock;
 
 	/*
@@ -83,11 +112,22 @@ struct cpu {
 	 * struct tlbshootdown is machine-dependent and might
 	 * reasonably be either an address space and vaddr pair, or a
 	 * paddr, or something else.
+	 *
+	 * c_shootdown_seq counts shootdowns sent to this cpu; once it
+	 * has done them it copies the count to c_shootdown_done, which
+	 * senders watch (unlocked) to know when they're finished.
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	int c_numshootdown;
+	unsigned c_shootdown_seq;
+	volatile unsigned c_shootdown_done;
 	struct spinlock c_ipi_lock;
+
+	/*
+	 * Callouts scheduled on this cpu. Has its own lock.
+	 */
+	struct callout_wheel c_callouts;
 };
 
 #define TLBSHOOTDOWN_ALL  (-1)
@@ -115,6 +155,33 @@ void cpu_hatch(unsigned software_number);
  */
 void cpu_identify(char *buf, size_t max);
 
+/*
+ * Per-cpu statistics counters.
+ *
+ * Each cpu has its own copy of each CPUSTAT_* counter, and bumps only
+ * its own, so counting needs no locks and doesn't bounce anything
+ * between cpus. The total is the sum over all cpus. A counter can go
+ * down as well as up (e.g. CPUSTAT_COREPAGES is incremented by one
+ * cpu and decremented by another); it's only the sum that means
+ * anything then.
+ *
+ * cpustat_add	Add N to counter WHICH of the current cpu. Safe from
+ *		any context, including interrupt handlers and before
+ *		the cpu structures exist.
+ * cpustat_inc	Same with N of 1.
+ * cpustat_get	Read counter WHICH of cpu C.
+ * cpustat_sum	Read counter WHICH summed over all cpus. Unlocked, so
+ *		it's only a snapshot.
+ *
+ * cpu_printstats prints all the counters for each cpu, for the menu.
+ */
+void cpustat_add(unsigned which, int n);
+void cpustat_inc(unsigned which);
+unsigned cpustat_get(struct cpu *c, unsigned which);
+unsigned cpustat_sum(unsigned which);
+
+void cpu_printstats(void);
+
 /*
  * Hardware-level interrupt on/off, for the current CPU.
  *
@@ -123,6 +190,15 @@ void cpu_identify(char *buf, size_t max);
 void cpu_irqoff(void);
 void cpu_irqon(void);
 
+/*
+ * Read the current CPU's cycle counter. Only differences between two
+ * readings are meaningful, and only for short intervals on one CPU: on
+ * System/161 the counter starts over at each timer interrupt, which
+ * idle CPUs take at irregular times (see hardclock_idle), so readings
+ * from different CPUs aren't comparable.
+ */
+uint32_t cpu_getcycles(void);
+
 /*
  * Idle or shut down (respectively) the processor.
  *
@@ -153,6 +229,10 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_broadcast is the same for all CPUs but this one.
+ * Both wait until the shootdown has been done before returning, so
+ * that the caller can then reuse the page; so they must be called
+ * with interrupts on and no spinlocks held.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -167,6 +247,7 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping);
 
 void interprocessor_interrupt(void);
 
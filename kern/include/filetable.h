@@ -36,6 +36,7 @@
 
 #include <limits.h> /* for OPEN_MAX */
 
+struct rwlock;
 
 /*
  * The file table is an array of open files.
@@ -48,14 +49,16 @@
  * or even to make it dynamic with the limit being user-settable. (See
  * setrlimit(2) on a Unix machine.)
  *
- * Because we only have single-threaded processes, the file table is
- * never shared and so it doesn't require synchronization. On fork,
- * the table is copied. Another exercise: what would you need to do to
- * make this code safe for multithreaded processes? What happens if
- * one thread calls close() while another one is in the middle of e.g.
- * read() using the same file handle?
+ * On fork the table is copied, but it can still be looked at from
+ * more than one thread (e.g. by kernel code walking another process),
+ * so it has a reader-writer lock. Lookups, which are by far the most
+ * common operation, take it for reading and can proceed in parallel;
+ * changing a slot takes it for writing. filetable_get hands out its
+ * own reference to the openfile, so a concurrent close() can't free
+ * the file out from under a read() in progress.
  */
 struct filetable {
+	struct rwlock *ft_lock;
 	struct openfile *ft_openfiles[OPEN_MAX];
 };
 
@@ -0,0 +1,18 @@
+#ifndef _KERN_FUTEX_H_
+#define _KERN_FUTEX_H_
+
+/*
+ * Operations for the futex() system call.
+ *
+ * FUTEX_WAIT - If the int at UADDR still holds VAL, sleep until woken
+ *              by FUTEX_WAKE on the same address; otherwise fail with
+ *              EAGAIN. The check and going to sleep are atomic with
+ *              respect to FUTEX_WAKE.
+ * FUTEX_WAKE - Wake up to VAL threads waiting on UADDR. Returns the
+ *              number woken.
+ */
+#define FUTEX_WAIT	0
+#define FUTEX_WAKE	1
+
+
+#endif /* _KERN_FUTEX_H_ */
@@ -85,8 +85,8 @@
 /* Max bytes for atomic pipe I/O -- see description in the pipe() man page */
 #define __PIPE_BUF      512
 
-/* Max number of processes at once. */
-#define __PROCS_MAX       128
+/* Max number of processes at once (a power of two, well below __PID_MAX) */
+#define __PROCS_MAX       1024
 
 
 /*
@@ -0,0 +1,29 @@
+#ifndef _KERN_SPAWN_H_
+#define _KERN_SPAWN_H_
+
+/*
+ * File actions for the spawn() system call.
+ *
+ * The new process starts with a copy of the caller's file table, like
+ * after fork; then the actions are carried out on it in order, before
+ * the program is loaded.
+ *
+ * SPAWN_DUP2  - Make SA_NEWFD refer to the same file as SA_FD, as
+ *               with dup2().
+ * SPAWN_CLOSE - Close SA_FD. (SA_NEWFD is ignored.)
+ *
+ * At most SPAWN_MAXACTIONS actions may be given.
+ */
+struct spawn_action {
+	int sa_op;
+	int sa_fd;
+	int sa_newfd;
+};
+
+#define SPAWN_DUP2	1
+#define SPAWN_CLOSE	2
+
+#define SPAWN_MAXACTIONS	32
+
+
+#endif /* _KERN_SPAWN_H_ */
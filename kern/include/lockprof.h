@@ -0,0 +1,70 @@
+/*
+ * Lock contention profiling (options lockprof).
+ */
+
+#ifndef _LOCKPROF_H_
+#define _LOCKPROF_H_
+
+/*
+ * Statistics for one lock. This is embedded in struct spinlock,
+ * struct lock, and struct rwlock when the kernel is built with
+ * "options lockprof".
+ *
+ * Locks are grouped by name for reporting, so e.g. all the address
+ * space locks show up as one line. Sleep locks and reader-writer
+ * locks are always named;
+ * spinlocks are only profiled if they were given a name with
+ * SPINLOCK_INITIALIZER_NAMED, so the many anonymous spinlocks inside
+ * wait channels, sleep locks, etc. don't clutter the report.
+ *
+ * The counters are only updated by the holder of the lock, so they
+ * don't need any locking of their own. (A reader-writer lock can have
+ * several holders; it updates them under its spinlock, and counts a
+ * hold from the first reader in to the last one out.) Times are in nanoseconds, from
+ * the real-time clock, which (unlike the cpu cycle counter) keeps
+ * going across timer interrupts, sleeps, and moves between cpus.
+ * Until the clock device has attached during boot, nothing is timed.
+ */
+struct lockprof {
+	const char *lp_name;		/* Report under this; NULL = off */
+	bool lp_listed;			/* On the list of all locks yet? */
+	struct lockprof *lp_prev;	/* List of all profiled locks */
+	struct lockprof *lp_next;
+	uint32_t lp_acquires;		/* Times acquired */
+	uint32_t lp_contended;		/* ...of which had to wait */
+	uint64_t lp_waittime;		/* Total time spent waiting */
+	uint32_t lp_maxhold;		/* Longest time held */
+	uint64_t lp_holdstart;		/* When the current holder got it */
+};
+
+#define LOCKPROF_INITIALIZER(name) \
+	{ name, false, NULL, NULL, 0, 0, 0, 0, 0 }
+
+/*
+ * Functions.
+ *
+ * init		Set up the statistics for a lock named NAME.
+ * cleanup	Lock is going away; remember its totals under its name.
+ *
+ * now		Current time for WAITSTART (0 if there's no clock yet).
+ * acquired	Called by the new holder. WAITSTART is lockprof_now()
+ *		from when it started trying; CONTENDED says if someone
+ *		else had the lock at the time.
+ * releasing	Called by the holder just before it lets go.
+ *
+ * printstats	Print totals for each name, worst waiting time first.
+ * reset	Zero all the counters.
+ */
+void lockprof_init(struct lockprof *lp, const char *name);
+void lockprof_cleanup(struct lockprof *lp);
+
+uint64_t lockprof_now(void);
+void lockprof_acquired(struct lockprof *lp, uint64_t waitstart,
+		       bool contended);
+void lockprof_releasing(struct lockprof *lp);
+
+void lockprof_printstats(void);
+void lockprof_reset(void);
+
+
+#endif /* _LOCKPROF_H_ */
@@ -55,6 +55,13 @@ size_t mainbus_ramsize(void);
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
+/*
+ * Let the timer skip ticks while idle, and put it back. (Low-level;
+ * see hardclock_idle() and hardclock_unidle().)
+ */
+bool mainbus_timer_stretch(unsigned ticks);
+bool mainbus_timer_unstretch(unsigned *elapsed);
+
 /*
  * The various ways to shut down the system. (These are very low-level
  * and should generally not be called directly - md_poweroff, for
@@ -61,14 +61,22 @@ void pid_disown(pid_t targetpid);
 /*
  * Set the exit status of the current thread to status.  Wakes up any threads
  * waiting to read this status, and decrefs the current thread's pid.
+ * Also keeps the process's usage totals for the parent to collect.
  */
 void pid_setexitstatus(int status);
 
 /*
  * Causes the current thread to wait for the thread with pid PID to
- * exit, returning the exit status when it does.
+ * exit, returning the exit status when it does. PID may be WAIT_ANY
+ * for any child; FLAGS may be WNOHANG.
  */
 int pid_wait(pid_t targetpid, int *status, int flags, pid_t *retpid);
 
+/*
+ * Wake any of the current process's threads that are in pid_wait, so
+ * they notice the process is exiting and fail with EINTR.
+ */
+void pid_interrupt(void);
+
 
 #endif /* _PID_H_ */
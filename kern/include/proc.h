@@ -41,6 +41,30 @@
 
 struct addrspace;
 struct vnode;
+struct lock;
+struct cv;
+struct semaphore;
+struct wchan;
+
+/*
+ * User-level threads. A process has UTHREAD_MAX slots for them; the
+ * slot number is the thread id user code sees, and also picks the
+ * thread's user stack (see as_define_threadstack). The main thread
+ * starts in slot 0. A slot stays in use from thread creation until
+ * somebody collects the thread's exit value with thread_join.
+ */
+#define UTHREAD_MAX	16
+
+typedef enum {
+	UT_FREE,	/* not in use */
+	UT_RUNNING,	/* thread exists */
+	UT_ZOMBIE,	/* exited, waiting to be joined */
+} uthreadstate_t;
+
+struct uthread {
+	uthreadstate_t ut_state;
+	userptr_t ut_value;		/* Exit value, for thread_join */
+};
 
 /*
  * Process structure.
@@ -53,11 +77,31 @@ struct proc {
 
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
+	struct semaphore *p_vforksem;	/* vfork parent waiting for it back */
 
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
 	struct filetable *p_filetable;	/* table of open files */
 
+	/* user-level threads */
+	struct lock *p_threadlock;	/* Protects the following */
+	struct cv *p_threadcv;		/* Signaled when a thread exits */
+	struct uthread p_uthreads[UTHREAD_MAX];
+	unsigned p_nuthreads;		/* Threads that haven't exited */
+	volatile bool p_exiting;	/* Other threads must exit */
+	struct wchan *p_sleepchan;	/* proc_sleep (with p_lock) */
+
+	/* accounting (protected by p_lock) */
+	struct schedstats p_stats;	/* Threads that have left */
+	struct schedstats p_cstats;	/* Children that were waited for */
+
+	/* list of all processes, for ps (protected by allprocs_lock) */
+	struct proc *p_allnext;
+	struct proc **p_allprevp;
+
+	/* exited, waiting for the reaper (protected by reaper_lock) */
+	struct proc *p_reapnext;
+
 	/* add more material here as needed */
 };
 
@@ -67,13 +111,24 @@ extern struct proc *kproc;
 /* Call once during system startup to allocate data structures. */
 void proc_bootstrap(void);
 
+/* Start the thread that tears down exited processes. */
+void proc_reaper_bootstrap(void);
+
 /* Create a fresh process for use by runprogram(). */
 int proc_create_runprogram(const char *name, struct proc **ret);
 
-/* Create a fresh process for use by fork() */
-int proc_fork(struct proc **ret);
+/*
+ * Create a fresh process for use by fork() or vfork(). For vfork,
+ * VFORKSEM is non-NULL: the new process borrows the caller's address
+ * space instead of getting a copy, and does V on VFORKSEM when it
+ * gives it back by exec'ing or exiting.
+ */
+int proc_fork(struct semaphore *vforksem, struct proc **ret);
+
+/* Create a fresh process for use by spawn(): files but no address space. */
+int proc_spawn(const char *name, struct proc **ret);
 
-/* Undo proc_fork if nothing's run in the new process yet. */
+/* Undo proc_fork/proc_spawn if nothing's run in the new process yet. */
 void proc_unfork(struct proc *proc);
 
 /* Destroy a process. */
@@ -81,19 +136,77 @@ void proc_destroy(struct proc *proc);
 
 /*
  * Cause the current process to exit. The current thread switches
- * itself into the kernel process.
+ * itself into the kernel process. Any other threads are killed first.
+ * The files are closed and the exit status published right away;
+ * freeing the address space is normally left to the reaper thread.
  *
  * The status code should be prepared with one of the _MKWAIT macros
  * defined in <kern/wait.h>.
  */
 void proc_exit(int status);
 
+/*
+ * If the current process is a vfork child, it is done with its
+ * parent's address space (which the caller has already switched away
+ * from): wake the parent up.
+ */
+void proc_vforkdone(void);
+
+/*
+ * User-level thread operations, all on the current process.
+ *
+ * proc_newthread     - Claim a free slot, FIRST or above, for a new
+ *                      thread.
+ * proc_unnewthread   - Give back a slot from proc_newthread whose thread
+ *                      never got started.
+ * proc_threadexit    - Exit the current thread, leaving VALUE for
+ *                      thread_join. If it's the last thread, exit the
+ *                      whole process. Does not return.
+ * proc_threadjoin    - Wait for thread UTID to exit and collect its
+ *                      value. Fails with EINTR if the process starts
+ *                      exiting in the meantime.
+ * proc_killthreads   - Make every other thread exit, and wait until they
+ *                      have. Returns only in the one thread that gets
+ *                      there first; any others are told to exit too.
+ * proc_threadexec    - After exec: make the current (only) thread the
+ *                      main thread of the new program image.
+ * proc_checkexit     - If another thread has called proc_killthreads,
+ *                      exit. Called on the way back to user mode.
+ * proc_sleep         - Sleep for TICKS hardclocks. Fails with EINTR if
+ *                      the process starts exiting in the meantime.
+ */
+int proc_newthread(unsigned first, unsigned *utid);
+void proc_unnewthread(unsigned utid);
+__DEAD void proc_threadexit(userptr_t value);
+int proc_threadjoin(unsigned utid, userptr_t *value);
+void proc_killthreads(void);
+void proc_threadexec(void);
+void proc_checkexit(void);
+int proc_sleep(unsigned ticks);
+
 /* Attach a thread to a process. Must not already have a process. */
 int proc_addthread(struct proc *proc, struct thread *t);
 
 /* Detach a thread from its process. */
 void proc_remthread(struct thread *t);
 
+/* Set the niceness of all threads in a process. */
+void proc_setnice(struct proc *proc, int nice);
+
+/*
+ * Accounting.
+ *
+ * proc_getstats      - Get the totals for PROC's threads, including ones
+ *                      that have exited; or if CHILDREN is true, for its
+ *                      children that have exited and been waited for.
+ * proc_addchildstats - Add the totals of a child that was waited for.
+ * proc_printstats    - Print every process and thread with its totals,
+ *                      for the ps menu command.
+ */
+void proc_getstats(struct proc *proc, bool children, struct schedstats *ret);
+void proc_addchildstats(struct proc *proc, const struct schedstats *ss);
+void proc_printstats(void);
+
 /* Fetch the address space of the current process. */
 struct addrspace *proc_getas(void);
 
@@ -36,6 +36,7 @@
  */
 
 #include <cdefs.h>
+#include "opt-lockprof.h"
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -45,6 +46,10 @@
 /* Get the machine-dependent bits. */
 #include <machine/spinlock.h>
 
+#if OPT_LOCKPROF
+#include <lockprof.h>
+#endif
+
 /*
  * Basic spinlock.
  *
@@ -56,18 +61,61 @@
  */
 struct spinlock {
 	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
+	volatile spinlock_data_t splk_next; /* Next ticket (ticket locks). */
+	bool splk_ticket;		    /* Ticket lock? */
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
+#if OPT_LOCKPROF
+	struct lockprof splk_prof;	    /* Contention statistics. */
+#endif
 };
 
+/*
+ * Ticket locks.
+ *
+ * A plain spinlock is a test-and-set word: whoever happens to win the
+ * race when it's released gets it next, so under heavy contention some
+ * cpus can be starved for a long time, and every waiter hammers the
+ * same word with atomic operations. A ticket lock instead hands out
+ * numbers from splk_next with one atomic increment per acquire, and
+ * waiters just read splk_lock (the number now being served) until
+ * their turn comes up. That gives strict FIFO order, and the only
+ * write to splk_lock is the plain store by the releasing holder.
+ *
+ * The price is that a waiter that has taken a ticket can't give up,
+ * and a holder that is slow to release holds up everyone queued
+ * behind it in order; there's no gain when the lock is uncontended.
+ * So use ticket locks for the few global, heavily shared spinlocks
+ * and leave the rest alone. Both kinds are struct spinlock and work
+ * with the same functions (and wait channels); only initialization
+ * differs.
+ */
+
 /*
  * Initializer for cases where a spinlock needs to be static or global.
+ *
+ * The named version gives the lock a name for the lock profiler; the
+ * name is ignored if the profiler isn't compiled in.
  */
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#if OPT_LOCKPROF
+#define SPINLOCK_INITIALIZER_KIND(name, ticket) \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, ticket, \
+	  NULL, LOCKPROF_INITIALIZER(name) }
+#else
+#define SPINLOCK_INITIALIZER_KIND(name, ticket) \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, ticket, \
+	  NULL }
+#endif
+#define SPINLOCK_INITIALIZER_NAMED(name) \
+	SPINLOCK_INITIALIZER_KIND(name, false)
+#define SPINLOCK_INITIALIZER	SPINLOCK_INITIALIZER_NAMED(NULL)
+#define SPINLOCK_TICKET_INITIALIZER_NAMED(name) \
+	SPINLOCK_INITIALIZER_KIND(name, true)
 
 /*
  * Spinlock functions.
  *
  * init		Initialize the contents of a spinlock.
+ * init_ticket	Same, but make it a ticket lock.
  * cleanup	Opposite of init. Lock must be unlocked.
  *
  * acquire	Get the lock, spinning as necessary. Also disables interrupts.
@@ -77,6 +125,7 @@ struct spinlock {
  */
 
 void spinlock_init(struct spinlock *lk);
+void spinlock_init_ticket(struct spinlock *lk);
 void spinlock_cleanup(struct spinlock *lk);
 
 void spinlock_acquire(struct spinlock *lk);
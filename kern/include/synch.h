@@ -58,8 +58,12 @@ void sem_destroy(struct semaphore *);
  *     P (proberen): decrement count. If the count is 0, block until
  *                   the count is 1 again before decrementing.
  *     V (verhogen): increment count.
+ *
+ * P_timed is like P but gives up after TICKS hardclocks; it returns 0
+ * if it got the semaphore and ETIMEDOUT if not.
  */
 void P(struct semaphore *);
+int P_timed(struct semaphore *, unsigned ticks);
 void V(struct semaphore *);
 
 
@@ -77,6 +81,12 @@ struct lock {
 	struct wchan *lk_wchan;
 	struct spinlock lk_lock;
 	struct thread *volatile lk_holder;
+	struct cpu *volatile lk_holdercpu;	/* cpu lk_holder took it on */
+	unsigned lk_waitlevel;		/* Best level of sleepers; see below */
+	struct lock *lk_heldnext;	/* Next on the holder's t_heldlocks */
+#if OPT_LOCKPROF
+	struct lockprof lk_prof;		/* contention statistics */
+#endif
 };
 
 struct lock *lock_create(const char *name);
@@ -91,7 +101,20 @@ void lock_destroy(struct lock *);
  *    lock_do_i_hold - Return true if the current thread holds the lock;
  *                   false otherwise.
  *
- * These operations must be atomic. You get to write them.
+ * These operations must be atomic.
+ *
+ * Locks are adaptive: lock_acquire spins, for a bounded time, while
+ * the holder is running on another cpu, and sleeps otherwise. When
+ * threads are sleeping on a lock, lock_release hands it directly to
+ * the first of them, so sleepers are served in order.
+ *
+ * Locks do priority inheritance: a thread that goes to sleep on a lock
+ * lends its scheduler level to the holder if that's better than the
+ * holder's own, and if the holder is itself asleep on another lock,
+ * on to that one's holder, and so on. The holder keeps the best level
+ * lent to it by any lock it holds (lk_waitlevel) until it releases
+ * that lock. This bounds how long a thread can wait behind a less
+ * favoured holder that other threads keep off the cpu.
  */
 void lock_acquire(struct lock *);
 void lock_release(struct lock *);
@@ -125,6 +148,9 @@ void cv_destroy(struct cv *);
  * Operations:
  *    cv_wait      - Release the supplied lock, go to sleep, and, after
  *                   waking up again, re-acquire the lock.
+ *    cv_timedwait - Like cv_wait, but wake up anyway after TICKS
+ *                   hardclocks. Returns ETIMEDOUT if that's what
+ *                   happened, 0 otherwise.
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
  *    cv_broadcast - Wake up all threads sleeping on this CV.
  *
@@ -132,11 +158,63 @@ void cv_destroy(struct cv *);
  * in. Note that under normal circumstances the same lock should be used
  * on all operations with any particular CV.
  *
+ * cv_signal and cv_broadcast don't actually wake anyone; they move the
+ * waiters over to the lock, to be woken one at a time as it's released.
+ *
  * These operations must be atomic. You get to write them.
  */
 void cv_wait(struct cv *cv, struct lock *lock);
+int cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers can hold the lock at once, or one writer.
+ * Writers are preferred: once a writer is waiting, newly arriving
+ * readers wait too. When a writer releases the lock, the readers that
+ * were already waiting are all let in before the next writer, so
+ * neither side can starve the other.
+ *
+ * Neither readers nor writers may acquire the lock recursively.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct rwlock {
+        char *rw_name;
+	struct wchan *rw_rwchan;	/* readers wait here */
+	struct wchan *rw_wwchan;	/* writers wait here */
+	struct spinlock rw_lock;	/* protects everything below */
+	unsigned rw_readers;		/* readers holding the lock */
+	unsigned rw_readwait;		/* readers waiting */
+	unsigned rw_writewait;		/* writers waiting */
+	unsigned rw_readpass;		/* waiting readers to admit first */
+	struct thread *rw_writer;	/* writer holding the lock */
+#if OPT_LOCKPROF
+	struct lockprof rw_prof;	/* contention statistics (rw_lock) */
+#endif
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading.
+ *    rwlock_release_read  - Release a read hold.
+ *    rwlock_acquire_write - Get the lock for writing.
+ *    rwlock_release_write - Release a write hold.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                   the lock for writing. (Readers aren't tracked.)
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
@@ -33,6 +33,7 @@
 
 #include <cdefs.h> /* for __DEAD */
 struct trapframe; /* from <machine/trapframe.h> */
+struct addrspace; /* from <addrspace.h> */
 
 /*
  * The system call dispatcher.
@@ -51,9 +52,19 @@ void enter_forked_process(struct trapframe *tf);
 __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 		       vaddr_t stackptr, vaddr_t entrypoint);
 
+/* Enter user mode in a new thread of the current process. */
+__DEAD void enter_new_thread(userptr_t func, userptr_t arg,
+			     vaddr_t stackptr, vaddr_t entrypoint);
+
 /* Setup function for exec. */
 void exec_bootstrap(void);
 
+/* Setup function for futexes. */
+void futex_bootstrap(void);
+
+/* Wake every futex waiter in AS, e.g. because the process is exiting. */
+void futex_wakeall(struct addrspace *as);
+
 /*
  * Prototypes for IN-KERNEL entry points for system call implementations.
  *
@@ -63,18 +74,34 @@ void exec_bootstrap(void);
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t req, userptr_t rem);
 
 int sys_fork(struct trapframe *tf, pid_t *retval);
+int sys_vfork(struct trapframe *tf, pid_t *retval);
 int sys_execv(userptr_t prog, userptr_t args);
+int sys_spawn(userptr_t prog, userptr_t args, userptr_t actions,
+	      int nactions, pid_t *retval);
 __DEAD void sys__exit(int code);
 int sys_waitpid(pid_t pid, userptr_t returncode, int flags, pid_t *retval);
 int sys_getpid(pid_t *retval);
+int sys_getpriority(int which, int who, int *retval);
+int sys_setpriority(int which, int who, int prio);
+int sys_getrusage(int who, userptr_t usage);
+int sys___thread_create(userptr_t entry, userptr_t func, userptr_t arg,
+			int *retval);
+__DEAD void sys_thread_exit(userptr_t value);
+int sys_thread_join(int tid, userptr_t valuep);
 
 int sys_open(const_userptr_t filename, int flags, mode_t mode, int *retval);
 int sys_dup2(int oldfd, int newfd, int *retval);
 int sys_close(int fd);
 int sys_read(int fd, userptr_t buf, size_t size, int *retval);
 int sys_write(int fd, userptr_t buf, size_t size, int *retval);
+int sys_readv(int fd, const_userptr_t iov, int iovcnt, int *retval);
+int sys_writev(int fd, const_userptr_t iov, int iovcnt, int *retval);
+int sys_pread(int fd, userptr_t buf, size_t size, off_t pos, int *retval);
+int sys_pwrite(int fd, userptr_t buf, size_t size, off_t pos, int *retval);
+int sys_sendfile(int outfd, int infd, size_t count, int *retval);
 int sys_lseek(int fd, off_t offset, int code, off_t *retval);
 
 int sys_chdir(const_userptr_t path);
@@ -82,4 +109,6 @@ int sys___getcwd(userptr_t buf, size_t buflen, int *retval);
 
 int sys_sbrk(ssize_t amount, int *retval);
 
+int sys_futex(userptr_t uaddr, int op, int val, int *retval);
+
 #endif /* _SYSCALL_H_ */
@@ -56,6 +56,11 @@ int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int rwtest(int, char **);
+int timedwaittest(int, char **);
+int cvhandofftest(int, char **);
+int pitest(int, char **);
+int spinlockbench(int, char **);
 
 /* filesystem tests */
 int fstest(int, char **);
@@ -41,6 +41,7 @@
 #include <threadlist.h>
 
 struct cpu;
+struct addrspace;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -64,6 +65,20 @@ typedef enum {
 	S_ZOMBIE,	/* zombie; exited but not yet deleted */
 } threadstate_t;
 
+/*
+ * Scheduler accounting. Times are in hardclocks: the thread running
+ * when a hardclock comes in is charged for the whole tick, as in
+ * traditional Unix. A switch is voluntary if the thread went to sleep
+ * or yielded by itself, and involuntary if it was preempted.
+ */
+struct schedstats {
+	unsigned ss_uticks;		/* Ticks running in user mode */
+	unsigned ss_sticks;		/* Ticks running in the kernel */
+	unsigned ss_waitticks;		/* Ticks waiting on a run queue */
+	unsigned ss_nvcsw;		/* Voluntary context switches */
+	unsigned ss_nivcsw;		/* Involuntary context switches */
+};
+
 /* Thread structure. */
 struct thread {
 	/*
@@ -79,11 +94,42 @@ struct thread {
 	 */
 	struct thread_machdep t_machdep; /* Any machine-dependent goo */
 	struct threadlistnode t_listnode; /* Link for run/sleep/zombie lists */
+	struct wchan *t_wchan;		/* Channel we're on, if sleeping
+					   (protected by the wchan's lock) */
 	void *t_stack;			/* Kernel-level stack */
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
 
+	/*
+	 * Scheduler fields. While the thread is on a run queue these
+	 * are protected by that cpu's runqueue lock; otherwise they
+	 * belong to the thread itself, or to whoever is waking it up.
+	 * t_nice may be set at any time; it is applied the next time
+	 * the thread is queued.
+	 */
+	unsigned t_priority;		/* Current scheduler level; 0 is best */
+	int t_nice;			/* Niceness, PRIO_MIN to PRIO_MAX */
+	unsigned t_quantum;		/* Hardclocks left in current slice */
+	unsigned t_lastran;		/* t_cpu's hardclock count when last run */
+	unsigned t_inherit;		/* Level lent by lock waiters, if better */
+
+	/*
+	 * Accounting. Only changed by the cpu the thread is on, with
+	 * interrupts off; see thread_switch and thread_timeslice.
+	 */
+	struct schedstats t_stats;	/* Totals for this thread */
+	unsigned t_readysince;		/* t_cpu's hardclock count when queued */
+	bool t_readyidle;		/* t_cpu was idle when queued */
+
+	/*
+	 * Priority inheritance fields, protected by the lock code's
+	 * pi_lock (see synch.c). t_inherit above is also only changed
+	 * under pi_lock, via thread_setinherit.
+	 */
+	struct lock *t_heldlocks;	/* Sleep locks we hold */
+	struct lock *t_blockedon;	/* Sleep lock we're waiting for */
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -105,6 +151,9 @@ struct thread {
 	 * Public fields
 	 */
 
+	unsigned t_utid;		/* User thread slot in t_proc */
+	struct addrspace *t_ascopy;	/* as_copy source, held for reading */
+
 	/* add more here as needed */
 };
 
@@ -157,16 +206,53 @@ __DEAD void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Charge the current thread for one hardclock, and preempt it if its
+ * time slice is used up or a more favoured thread is waiting. Called
+ * from the timer interrupt.
+ */
+void thread_timeslice(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
 void schedule(void);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
- * timer interrupt.
+ * Get or set the base scheduler quantum, in hardclocks. This is the
+ * time slice of a thread at the most favoured level; less favoured
+ * levels get proportionally longer slices.
+ */
+unsigned thread_getquantum(void);
+void thread_setquantum(unsigned hardclocks);
+
+/*
+ * Priority inheritance support for the lock code.
+ *
+ * thread_schedlevel  - The level T is scheduled at: its own, or the
+ *                      level it inherits if that's better.
+ * thread_setinherit  - Set the level T inherits from threads waiting on
+ *                      locks it holds (SCHED_NLEVELS for none), moving
+ *                      it between run queues if it's on one.
+ */
+unsigned thread_schedlevel(const struct thread *t);
+void thread_setinherit(struct thread *t, unsigned level);
+
+/*
+ * Scheduler accounting.
+ *
+ * schedstats_zero  - Clear SS.
+ * schedstats_add   - Add the counts in FROM to TO.
+ */
+void schedstats_zero(struct schedstats *ss);
+void schedstats_add(struct schedstats *to, const struct schedstats *from);
+
+/*
+ * Set the niceness of a thread. NICE must be between PRIO_MIN and
+ * PRIO_MAX (from <kern/resource.h>); higher values lower the best
+ * scheduler level the thread can reach.
  */
-void thread_consider_migration(void);
+void thread_setnice(struct thread *t, int nice);
 
 
 #endif /* _THREAD_H_ */
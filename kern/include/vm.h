@@ -75,6 +75,7 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
 vaddr_t alloc_user_page(void);
+void cm_set_user_page(pp_num_t ppn, struct addrspace *as, vaddr_t vaddr);
 void tlb_insert_entry(uint32_t entryhi, uint32_t entrylo);
 
 /* TLB shootdown handling called from interprocessor_interrupt */
@@ -30,7 +30,7 @@
 #ifndef _VNODE_H_
 #define _VNODE_H_
 
-#include <spinlock.h>
+#include <atomic.h>
 struct uio;
 struct stat;
 
@@ -49,8 +49,9 @@ struct stat;
  * Note: vn_fs may be null if the vnode refers to a device.
  */
 struct vnode {
-	int vn_refcount;                /* Reference count */
-	struct spinlock vn_countlock;   /* Lock for vn_refcount */
+	volatile int vn_refcount;       /* Reference count (atomic.h) */
+	volatile int vn_wstart;         /* Writes started (atomic.h) */
+	volatile int vn_wdone;          /* Writes finished (atomic.h) */
 
 	struct fs *vn_fs;               /* Filesystem vnode belongs to */
 
@@ -231,14 +232,14 @@ struct vnode_ops {
 #define VOP_READ(vn, uio)               (__VOP(vn, read)(vn, uio))
 #define VOP_READLINK(vn, uio)           (__VOP(vn, readlink)(vn, uio))
 #define VOP_GETDIRENTRY(vn, uio)        (__VOP(vn,getdirentry)(vn, uio))
-#define VOP_WRITE(vn, uio)              (__VOP(vn, write)(vn, uio))
+#define VOP_WRITE(vn, uio)              vnode_write(vn, uio)
 #define VOP_IOCTL(vn, code, buf)        (__VOP(vn, ioctl)(vn,code,buf))
 #define VOP_STAT(vn, ptr) 	        (__VOP(vn, stat)(vn, ptr))
 #define VOP_GETTYPE(vn, result)         (__VOP(vn, gettype)(vn, result))
 #define VOP_ISSEEKABLE(vn)              (__VOP(vn, isseekable)(vn))
 #define VOP_FSYNC(vn)                   (__VOP(vn, fsync)(vn))
 #define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
-#define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
+#define VOP_TRUNCATE(vn, pos)           vnode_truncate(vn, pos)
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
 
 #define VOP_CREAT(vn,nm,excl,mode,res)  (__VOP(vn, creat)(vn,nm,excl,mode,res))
@@ -266,6 +267,19 @@ void vnode_decref(struct vnode *);
 #define VOP_INCREF(vn) 			vnode_incref(vn)
 #define VOP_DECREF(vn) 			vnode_decref(vn)
 
+/*
+ * Write counts. VOP_WRITE and VOP_TRUNCATE go through these, which
+ * bump vn_wstart before the change and vn_wdone after it, with full
+ * barriers (readers pair them with membar_load_load). If the two
+ * are equal and vn_wdone hasn't moved since some earlier point, the
+ * contents haven't changed and nobody is changing them. Device vnodes
+ * (vn_fs == NULL) are not counted. This is for caches, such as the
+ * one in loadelf.c; they must hold a reference to the vnode, because
+ * the counts start over when a vnode is reclaimed.
+ */
+int vnode_write(struct vnode *vn, struct uio *uio);
+int vnode_truncate(struct vnode *vn, off_t pos);
+
 /*
  * Vnode initialization (intended for use by filesystem code)
  * The reference count is initialized to 1.
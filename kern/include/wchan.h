@@ -35,7 +35,10 @@
  */
 
 
+#include <callout.h>
+
 struct spinlock; /* in spinlock.h */
+struct thread; /* in thread.h */
 struct wchan; /* Opaque */
 
 /*
@@ -76,5 +79,48 @@ void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Like wchan_wakeone, but returns the thread woken (NULL if none), so
+ * the caller can give it something, such as ownership of a lock,
+ * before letting go of the spinlock.
+ */
+struct thread *wchan_wakeone_thread(struct wchan *wc, struct spinlock *lk);
+
+/*
+ * Move one thread (ALL false) or all of them from one wait channel to
+ * another without waking them, so they'll be woken from TO instead.
+ * Both spinlocks must be held. A pending wchan_timeout for a moved
+ * thread no longer finds it and does nothing.
+ */
+void wchan_move(struct wchan *from, struct spinlock *fromlk,
+		struct wchan *to, struct spinlock *tolk, bool all);
+
+/*
+ * Return the best scheduler level (see thread_schedlevel) of the
+ * threads sleeping on WC, or SCHED_NLEVELS if there aren't any. The
+ * spinlock must be held.
+ */
+unsigned wchan_bestlevel(struct wchan *wc, struct spinlock *lk);
+
+/*
+ * Timed sleeps. wchan_timeout_start arranges for the current thread
+ * to be woken from WC after TICKS hardclocks if it's still sleeping
+ * there; then sleep with wchan_sleep as usual, as many times as need
+ * be, giving up once wt_timedout is set (it's protected by LK, which
+ * must be held for start). Afterwards call wchan_timeout_stop, with
+ * LK *not* held.
+ */
+struct wchan_timeout {
+	struct callout wt_callout;
+	struct thread *wt_thread;
+	struct wchan *wt_wchan;
+	struct spinlock *wt_lock;
+	bool wt_timedout;
+};
+
+void wchan_timeout_start(struct wchan_timeout *wt, struct wchan *wc,
+			 struct spinlock *lk, unsigned ticks);
+void wchan_timeout_stop(struct wchan_timeout *wt);
+
 
 #endif /* _WCHAN_H_ */
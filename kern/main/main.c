@@ -136,6 +136,8 @@ boot(void)
 	/* Late phase of initialization. */
 	kprintf_bootstrap();
     exec_bootstrap();
+	futex_bootstrap();
+	proc_reaper_bootstrap();
     thread_start_cpus();
 
     /* Default bootfs - but ignore failure, in case emu0 doesn't exist */
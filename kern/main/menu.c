@@ -35,6 +35,7 @@
 #include <limits.h>
 #include <lib.h>
 #include <uio.h>
+#include <cpu.h>
 #include <clock.h>
 #include <thread.h>
 #include <proc.h>
@@ -45,6 +46,11 @@
 #include <test.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-lockprof.h"
+
+#if OPT_LOCKPROF
+#include <lockprof.h>
+#endif
 
 /*
  * In-kernel menu and command dispatcher.
@@ -367,6 +373,34 @@ cmd_bootfs(int nargs, char **args)
 	return vfs_setbootfs(device);
 }
 
+/*
+ * Command to show or set the base scheduler quantum.
+ */
+static
+int
+cmd_quantum(int nargs, char **args)
+{
+	int ticks;
+
+	if (nargs == 1) {
+		kprintf("Scheduler quantum: %u hardclocks\n",
+			thread_getquantum());
+		return 0;
+	}
+	if (nargs != 2) {
+		kprintf("Usage: quantum [hardclocks]\n");
+		return EINVAL;
+	}
+
+	ticks = atoi(args[1]);
+	if (ticks <= 0) {
+		kprintf("quantum: must be positive\n");
+		return EINVAL;
+	}
+	thread_setquantum(ticks);
+	return 0;
+}
+
 static
 int
 cmd_kheapstats(int nargs, char **args)
@@ -408,6 +442,49 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_cpustats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	cpu_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_ps(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	proc_printstats();
+
+	return 0;
+}
+
+#if OPT_LOCKPROF
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	if (nargs == 1) {
+		lockprof_printstats();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockprof_reset();
+	}
+	else {
+		kprintf("Usage: lockstat [reset]\n");
+	}
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -447,6 +524,7 @@ static const char *opsmenu[] = {
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
+	"[quantum] Scheduler quantum         ",
 	"[panic]   Intentional panic         ",
 	"[q]       Quit and shut down        ",
 	NULL
@@ -481,6 +559,11 @@ static const char *testmenu[] = {
 	"[sy2] Lock test                     ",
 	"[sy3] CV test                       ",
 	"[sy4] CV test #2                    ",
+	"[sy5] RW lock test                  ",
+	"[sy6] Timed wait test               ",
+	"[sy7] CV handoff test               ",
+	"[sy8] Priority inheritance test     ",
+	"[sy9] Spinlock benchmark            ",
 	"[wt]  waitpid test                  ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
@@ -510,6 +593,11 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[cpus] Per-cpu statistics           ",
+	"[ps] Process and thread stats       ",
+#if OPT_LOCKPROF
+	"[lockstat] Lock contention stats    ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -550,6 +638,7 @@ static struct {
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
+	{ "quantum",	cmd_quantum },
 	{ "panic",	cmd_panic },
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
@@ -559,6 +648,11 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "cpus",       cmd_cpustats },
+	{ "ps",         cmd_ps },
+#if OPT_LOCKPROF
+	{ "lockstat",   cmd_lockstat },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -580,6 +674,11 @@ static struct {
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "sy5",	rwtest },
+	{ "sy6",	timedwaittest },
+	{ "sy7",	cvhandofftest },
+	{ "sy8",	pitest },
+	{ "sy9",	spinlockbench },
 
 	/* system call assignment tests */
 	/* For testing the wait implementation. */
@@ -36,7 +36,8 @@
 #include <kern/wait.h>
 #include <limits.h>
 #include <lib.h>
-#include <array.h>
+#include <atomic.h>
+#include <spinlock.h>
 #include <clock.h>
 #include <thread.h>
 #include <proc.h>
@@ -45,42 +46,89 @@
 #include <pid.h>
 
 /*
- * Structure for holding exit data of a thread.
+ * Structure for holding exit data of a process.
  *
- * If pi_ppid is INVALID_PID, the parent has gone away and will not be
- * waiting. If pi_ppid is INVALID_PID and pi_exited is true, the
- * structure can be freed.
+ * Each process's pidinfo points to its parent's. The parent's pi_lock
+ * protects its lists of children and everything about a child's
+ * exit: pi_exited, pi_exitstatus, pi_stats, pi_detached, and the list
+ * linkage. So a process exiting and its parent waiting only ever
+ * contend with each other, and never with unrelated processes.
+ *
+ * A child is on pi_children while it's running; when it exits it
+ * moves to pi_zombies, so waiting for any child just takes the first
+ * zombie and never has to look through the ones still running.
+ *
+ * pi_detached means the parent won't wait: either it has exited or
+ * it called pid_disown. A detached child is taken out of the process
+ * table as soon as it exits.
+ *
+ * Pidinfos are reference counted, because a child may still need its
+ * parent's lock after the parent has exited and been waited for. A
+ * pidinfo holds one reference for being in the process table, and
+ * one for each child that points at it.
  */
 struct pidinfo {
-	pid_t pi_pid;			// process id of this thread
-	pid_t pi_ppid;			// process id of parent thread
-	volatile bool pi_exited;	// true if thread has exited
+	pid_t pi_pid;			// process id of this process
+	struct pidinfo *pi_parent;	// parent's pidinfo (holds a ref)
+	volatile int pi_refcount;	// see above
+	bool pi_exited;			// true if process has exited
+	bool pi_detached;		// true if nobody will wait for it
 	int pi_exitstatus;		// status (only valid if exited)
-	struct cv *pi_cv;		// use to wait for thread exit
+	struct schedstats pi_stats;	// usage totals (only valid if exited)
+
+	struct lock *pi_lock;		// protects our children
+	struct cv *pi_cv;		// signaled when a child exits
+	struct pidinfo *pi_children;	// our children still running
+	struct pidinfo *pi_zombies;	// ...and those that have exited
+	struct pidinfo *pi_sibnext;	// next on parent's list
+	struct pidinfo **pi_sibprevp;	// what points to us in that list
 };
 
-
 /*
- * Global pid and exit data.
+ * The process table.
  *
- * The process table is an el-cheapo hash table. It's indexed by
- * (pid % PROCS_MAX), and only allows one process per slot. If a
- * new pid allocation would cause a hash collision, we just don't
- * use that pid.
+ * This is an array of slots that starts out small and doubles as
+ * needed, up to PROCS_MAX. A pid lives in slot (pid % PROCS_MAX), so
+ * the slot of a pid doesn't change when the table grows; each time a
+ * slot is reused it hands out the next pid up that maps to it, so
+ * pids aren't recycled quickly. Free slots are kept on a FIFO list,
+ * which makes allocating a pid constant-time.
+ *
+ * PROCS_MAX must be a power of two, so the modulus is cheap, and
+ * small enough next to the pid space that a slot goes through a good
+ * number of pids before coming back to the first. Only a busy system
+ * pays for a table that big.
+ *
+ * The table is protected by a spinlock, which is only held long
+ * enough to take a slot or look one up.
  */
-static struct lock *pidlock;		// lock for global exit data
-static struct pidinfo *pidinfo[PROCS_MAX]; // actual pid info
-static pid_t nextpid;			// next candidate pid
-static int nprocs;			// number of allocated pids
+struct pidslot {
+	struct pidinfo *ps_info;	// process in this slot; NULL if free
+	pid_t ps_nextpid;		// pid this slot will hand out next
+	int ps_nextfree;		// next on free list; -1 for none
+};
 
+#define PIDTABLE_INITSIZE	32
 
+#if (PROCS_MAX & (PROCS_MAX - 1)) != 0
+#error "PROCS_MAX must be a power of two"
+#endif
+#if PROCS_MAX > (PID_MAX + 1) / 16
+#error "PROCS_MAX is too big for the pid space; pids would recycle quickly"
+#endif
+
+static struct spinlock pidtable_lock = SPINLOCK_INITIALIZER;
+static struct pidslot *pidtable;	// the slots
+static unsigned pidtable_size;		// number of slots
+static int pidfree_head, pidfree_tail;	// list of free slots
+static unsigned nprocs;			// number of allocated pids
 
 /*
  * Create a pidinfo structure for the specified pid.
  */
 static
 struct pidinfo *
-pidinfo_create(pid_t pid, pid_t ppid)
+pidinfo_create(pid_t pid, struct pidinfo *parent)
 {
 	struct pidinfo *pi;
 
@@ -91,16 +139,32 @@ pidinfo_create(pid_t pid, pid_t ppid)
 		return NULL;
 	}
 
+	pi->pi_lock = lock_create("pidinfo");
+	if (pi->pi_lock == NULL) {
+		kfree(pi);
+		return NULL;
+	}
 	pi->pi_cv = cv_create("pidinfo cv");
 	if (pi->pi_cv == NULL) {
+		lock_destroy(pi->pi_lock);
 		kfree(pi);
 		return NULL;
 	}
 
 	pi->pi_pid = pid;
-	pi->pi_ppid = ppid;
+	pi->pi_parent = parent;
+	if (parent != NULL) {
+		atomic_inc(&parent->pi_refcount);
+	}
+	pi->pi_refcount = 1;
 	pi->pi_exited = false;
+	pi->pi_detached = false;
 	pi->pi_exitstatus = 0xbeef;  /* Recognizably invalid value */
+	schedstats_zero(&pi->pi_stats);
+	pi->pi_children = NULL;
+	pi->pi_zombies = NULL;
+	pi->pi_sibnext = NULL;
+	pi->pi_sibprevp = NULL;
 
 	return pi;
 }
@@ -113,169 +177,325 @@ void
 pidinfo_destroy(struct pidinfo *pi)
 {
 	KASSERT(pi->pi_exited == true);
-	KASSERT(pi->pi_ppid == INVALID_PID);
+	KASSERT(pi->pi_children == NULL);
+	KASSERT(pi->pi_zombies == NULL);
+	KASSERT(pi->pi_sibprevp == NULL);
 	cv_destroy(pi->pi_cv);
+	lock_destroy(pi->pi_lock);
 	kfree(pi);
 }
 
-////////////////////////////////////////////////////////////
-
 /*
- * pid_bootstrap: initialize.
+ * Drop a reference to a pidinfo, freeing it when the last one goes.
+ * That in turn drops its reference to its parent.
  */
+static
 void
-pid_bootstrap(void)
+pidinfo_decref(struct pidinfo *pi)
 {
-	int i;
+	struct pidinfo *parent;
 
-	pidlock = lock_create("pidlock");
-	if (pidlock == NULL) {
-		panic("Out of memory creating pid lock\n");
+	while (pi != NULL && atomic_dec_and_test(&pi->pi_refcount)) {
+		parent = pi->pi_parent;
+		pidinfo_destroy(pi);
+		pi = parent;
 	}
+}
 
-	/* not really necessary - should start zeroed */
-	for (i=0; i<PROCS_MAX; i++) {
-		pidinfo[i] = NULL;
+/*
+ * Put PI on LIST, one of its parent's lists of children. The parent
+ * must be locked.
+ */
+static
+void
+pidinfo_addchild(struct pidinfo **list, struct pidinfo *pi)
+{
+	KASSERT(lock_do_i_hold(pi->pi_parent->pi_lock));
+	KASSERT(pi->pi_sibprevp == NULL);
+
+	pi->pi_sibnext = *list;
+	if (pi->pi_sibnext != NULL) {
+		pi->pi_sibnext->pi_sibprevp = &pi->pi_sibnext;
 	}
+	pi->pi_sibprevp = list;
+	*list = pi;
+}
 
-	pidinfo[KERNEL_PID] = pidinfo_create(KERNEL_PID, INVALID_PID);
-	if (pidinfo[KERNEL_PID]==NULL) {
-		panic("Out of memory creating kernel pid data\n");
+/*
+ * Take PI off whichever of its parent's lists it's on. The parent
+ * must be locked.
+ */
+static
+void
+pidinfo_remchild(struct pidinfo *pi)
+{
+	KASSERT(lock_do_i_hold(pi->pi_parent->pi_lock));
+	KASSERT(pi->pi_sibprevp != NULL);
+
+	*pi->pi_sibprevp = pi->pi_sibnext;
+	if (pi->pi_sibnext != NULL) {
+		pi->pi_sibnext->pi_sibprevp = pi->pi_sibprevp;
 	}
+	pi->pi_sibnext = NULL;
+	pi->pi_sibprevp = NULL;
+}
 
-	nextpid = PID_MIN;
-	nprocs = 1;
+////////////////////////////////////////////////////////////
+
+/*
+ * Initialize slots FIRST through LAST-1 of TABLE and put them on the
+ * free list. The table must be locked, or not in use yet.
+ */
+static
+void
+pidtable_initslots(struct pidslot *table, unsigned first, unsigned last)
+{
+	unsigned i;
+
+	for (i=first; i<last; i++) {
+		table[i].ps_info = NULL;
+		table[i].ps_nextpid = i;
+		if (table[i].ps_nextpid < PID_MIN) {
+			table[i].ps_nextpid += PROCS_MAX;
+		}
+		table[i].ps_nextfree = -1;
+		if (pidfree_tail < 0) {
+			pidfree_head = i;
+		}
+		else {
+			table[pidfree_tail].ps_nextfree = i;
+		}
+		pidfree_tail = i;
+	}
 }
 
 /*
- * pi_get: look up a pidinfo in the process table.
+ * Make the table bigger. Called with the table unlocked, because we
+ * need to allocate memory; returns with it locked. If somebody else
+ * grew it in the meantime, that's fine too.
  */
 static
-struct pidinfo *
-pi_get(pid_t pid)
+int
+pidtable_grow(void)
 {
-	struct pidinfo *pi;
+	struct pidslot *newtable, *oldtable;
+	unsigned oldsize, newsize, i;
 
-	KASSERT(pid>=0);
-	KASSERT(pid != INVALID_PID);
-	KASSERT(lock_do_i_hold(pidlock));
+	spinlock_acquire(&pidtable_lock);
+	oldsize = pidtable_size;
+	spinlock_release(&pidtable_lock);
 
-	pi = pidinfo[pid % PROCS_MAX];
-	if (pi==NULL) {
-		return NULL;
+	newsize = oldsize * 2;
+	if (newsize > PROCS_MAX) {
+		newsize = PROCS_MAX;
 	}
-	if (pi->pi_pid != pid) {
-		return NULL;
+	newtable = kmalloc(newsize * sizeof(struct pidslot));
+	if (newtable == NULL) {
+		spinlock_acquire(&pidtable_lock);
+		return ENOMEM;
 	}
-	return pi;
+
+	spinlock_acquire(&pidtable_lock);
+	if (pidtable_size != oldsize) {
+		/* lost the race; use theirs */
+		oldtable = newtable;
+	}
+	else {
+		for (i=0; i<oldsize; i++) {
+			newtable[i] = pidtable[i];
+		}
+		oldtable = pidtable;
+		pidtable = newtable;
+		pidtable_size = newsize;
+		pidtable_initslots(pidtable, oldsize, newsize);
+	}
+	spinlock_release(&pidtable_lock);
+
+	kfree(oldtable);
+
+	spinlock_acquire(&pidtable_lock);
+	return 0;
 }
 
 /*
- * pi_put: insert a new pidinfo in the process table. The right slot
- * must be empty.
+ * pid_bootstrap: initialize.
  */
-static
 void
-pi_put(pid_t pid, struct pidinfo *pi)
+pid_bootstrap(void)
 {
-	KASSERT(lock_do_i_hold(pidlock));
+	struct pidinfo *pi;
 
-	KASSERT(pid != INVALID_PID);
+	pidtable = kmalloc(PIDTABLE_INITSIZE * sizeof(struct pidslot));
+	if (pidtable == NULL) {
+		panic("Out of memory creating process table\n");
+	}
+	pidtable_size = PIDTABLE_INITSIZE;
+	pidfree_head = pidfree_tail = -1;
+	pidtable_initslots(pidtable, 0, pidtable_size);
 
-	KASSERT(pidinfo[pid % PROCS_MAX] == NULL);
-	pidinfo[pid % PROCS_MAX] = pi;
-	nprocs++;
+	pi = pidinfo_create(KERNEL_PID, NULL);
+	if (pi==NULL) {
+		panic("Out of memory creating kernel pid data\n");
+	}
+
+	/* Slot KERNEL_PID is never used for anything else. */
+	KASSERT(pidfree_head == 0);
+	KASSERT(pidtable[1].ps_nextfree == 2);
+	pidtable[0].ps_nextfree = 2;
+	pidtable[KERNEL_PID].ps_info = pi;
+	pidtable[KERNEL_PID].ps_nextfree = -1;
+	nprocs = 1;
 }
 
 /*
- * pi_drop: remove a pidinfo structure from the process table and free
- * it. It should reflect a process that has already exited and been
- * waited for.
+ * pi_get: look up a pidinfo in the process table and return it with
+ * a reference the caller must drop with pidinfo_decref.
  */
 static
-void
-pi_drop(pid_t pid)
+struct pidinfo *
+pi_get(pid_t pid)
 {
 	struct pidinfo *pi;
+	unsigned slot;
 
-	KASSERT(lock_do_i_hold(pidlock));
+	KASSERT(pid>=0);
+	KASSERT(pid != INVALID_PID);
 
-	pi = pidinfo[pid % PROCS_MAX];
-	KASSERT(pi != NULL);
-	KASSERT(pi->pi_pid == pid);
+	slot = pid % PROCS_MAX;
 
-	pidinfo_destroy(pi);
-	pidinfo[pid % PROCS_MAX] = NULL;
-	nprocs--;
+	spinlock_acquire(&pidtable_lock);
+	if (slot >= pidtable_size) {
+		spinlock_release(&pidtable_lock);
+		return NULL;
+	}
+	pi = pidtable[slot].ps_info;
+	if (pi == NULL || pi->pi_pid != pid) {
+		spinlock_release(&pidtable_lock);
+		return NULL;
+	}
+	atomic_inc(&pi->pi_refcount);
+	spinlock_release(&pidtable_lock);
+	return pi;
 }
 
-////////////////////////////////////////////////////////////
-
 /*
- * Helper function for pid_alloc.
+ * pi_drop: remove a pidinfo from the process table, freeing its pid
+ * for reuse, and drop the table's reference to it. It should reflect
+ * a process that has exited and won't be waited for again (or never
+ * ran). Nobody's lock should be held, because this may free the
+ * pidinfo.
  */
 static
 void
-inc_nextpid(void)
+pi_drop(struct pidinfo *pi)
 {
-	KASSERT(lock_do_i_hold(pidlock));
+	struct pidslot *ps;
+	unsigned slot;
+
+	slot = pi->pi_pid % PROCS_MAX;
+
+	spinlock_acquire(&pidtable_lock);
+	KASSERT(slot < pidtable_size);
+	ps = &pidtable[slot];
+	KASSERT(ps->ps_info == pi);
+
+	ps->ps_info = NULL;
+	ps->ps_nextpid += PROCS_MAX;
+	if (ps->ps_nextpid > PID_MAX) {
+		ps->ps_nextpid = slot;
+		if (ps->ps_nextpid < PID_MIN) {
+			ps->ps_nextpid += PROCS_MAX;
+		}
+	}
 
-	nextpid++;
-	if (nextpid > PID_MAX) {
-		nextpid = PID_MIN;
+	ps->ps_nextfree = -1;
+	if (pidfree_tail < 0) {
+		pidfree_head = slot;
+	}
+	else {
+		pidtable[pidfree_tail].ps_nextfree = slot;
 	}
+	pidfree_tail = slot;
+	nprocs--;
+	spinlock_release(&pidtable_lock);
+
+	pidinfo_decref(pi);
 }
 
+////////////////////////////////////////////////////////////
+
 /*
  * pid_alloc: allocate a process id.
  */
 int
 pid_alloc(pid_t *retval)
 {
-	struct pidinfo *pi;
-	pid_t pid;
-	int count;
+	struct pidinfo *us, *pi;
+	struct pidslot *ps;
+	int slot;
+	int result;
 
 	KASSERT(curproc->p_pid != INVALID_PID);
 
-	/* lock the table */
-	lock_acquire(pidlock);
+	us = pi_get(curproc->p_pid);
+	KASSERT(us != NULL);
 
-	if (nprocs == PROCS_MAX) {
-		lock_release(pidlock);
-		return EAGAIN;
+	/* Take a free slot, growing the table if there aren't any. */
+	spinlock_acquire(&pidtable_lock);
+	while (pidfree_head < 0) {
+		if (pidtable_size == PROCS_MAX) {
+			spinlock_release(&pidtable_lock);
+			pidinfo_decref(us);
+			return EAGAIN;
+		}
+		spinlock_release(&pidtable_lock);
+		result = pidtable_grow();
+		if (result) {
+			spinlock_release(&pidtable_lock);
+			pidinfo_decref(us);
+			return result;
+		}
+	}
+	slot = pidfree_head;
+	ps = &pidtable[slot];
+	pidfree_head = ps->ps_nextfree;
+	if (pidfree_head < 0) {
+		pidfree_tail = -1;
 	}
+	KASSERT(ps->ps_info == NULL);
+	*retval = ps->ps_nextpid;
+	nprocs++;
+	spinlock_release(&pidtable_lock);
 
 	/*
-	 * The above test guarantees that this loop terminates, unless
-	 * our nprocs count is off. Even so, assert we aren't looping
-	 * forever.
+	 * Set up the pidinfo outside the table lock. Nobody can find
+	 * the slot in the meantime, because it's empty.
 	 */
-	count = 0;
-	while (pidinfo[nextpid % PROCS_MAX] != NULL) {
-
-		/* avoid various boundary cases by allowing extra loops */
-		KASSERT(count < PROCS_MAX*2+5);
-		count++;
-
-		inc_nextpid();
-	}
-
-	pid = nextpid;
-
-	pi = pidinfo_create(pid, curproc->p_pid);
+	pi = pidinfo_create(*retval, us);
 	if (pi==NULL) {
-		lock_release(pidlock);
+		spinlock_acquire(&pidtable_lock);
+		ps = &pidtable[slot];
+		ps->ps_nextfree = pidfree_head;
+		pidfree_head = slot;
+		if (pidfree_tail < 0) {
+			pidfree_tail = slot;
+		}
+		nprocs--;
+		spinlock_release(&pidtable_lock);
+		pidinfo_decref(us);
 		return ENOMEM;
 	}
 
-	pi_put(pid, pi);
+	lock_acquire(us->pi_lock);
+	pidinfo_addchild(&us->pi_children, pi);
+	lock_release(us->pi_lock);
 
-	inc_nextpid();
+	spinlock_acquire(&pidtable_lock);
+	pidtable[slot].ps_info = pi;
+	spinlock_release(&pidtable_lock);
 
-	lock_release(pidlock);
-
-	*retval = pid;
+	/* The child holds its own reference to us now. */
+	pidinfo_decref(us);
 	return 0;
 }
 
@@ -286,25 +506,26 @@ pid_alloc(pid_t *retval)
 void
 pid_unalloc(pid_t theirpid)
 {
-	struct pidinfo *them;
+	struct pidinfo *them, *us;
 
 	KASSERT(theirpid >= PID_MIN && theirpid <= PID_MAX);
 
-	lock_acquire(pidlock);
-
 	them = pi_get(theirpid);
 	KASSERT(them != NULL);
-	KASSERT(them->pi_exited == false);
-	KASSERT(them->pi_ppid == curproc->p_pid);
+	us = them->pi_parent;
+	KASSERT(us->pi_pid == curproc->p_pid);
 
+	lock_acquire(us->pi_lock);
+	KASSERT(them->pi_exited == false);
 	/* keep pidinfo_destroy from complaining */
 	them->pi_exitstatus = 0xdead;
 	them->pi_exited = true;
-	them->pi_ppid = INVALID_PID;
-
-	pi_drop(theirpid);
+	them->pi_detached = true;
+	pidinfo_remchild(them);
+	lock_release(us->pi_lock);
 
-	lock_release(pidlock);
+	pi_drop(them);
+	pidinfo_decref(them);
 }
 
 /*
@@ -314,22 +535,27 @@ pid_unalloc(pid_t theirpid)
 void
 pid_disown(pid_t theirpid)
 {
-	struct pidinfo *them;
+	struct pidinfo *them, *us;
+	bool exited;
 
 	KASSERT(theirpid >= PID_MIN && theirpid <= PID_MAX);
 
-	lock_acquire(pidlock);
-
 	them = pi_get(theirpid);
 	KASSERT(them != NULL);
-	KASSERT(them->pi_ppid==curproc->p_pid);
-
-	them->pi_ppid = INVALID_PID;
-	if (them->pi_exited) {
-		pi_drop(them->pi_pid);
+	us = them->pi_parent;
+	KASSERT(us->pi_pid == curproc->p_pid);
+
+	lock_acquire(us->pi_lock);
+	KASSERT(them->pi_detached == false);
+	them->pi_detached = true;
+	pidinfo_remchild(them);
+	exited = them->pi_exited;
+	lock_release(us->pi_lock);
+
+	if (exited) {
+		pi_drop(them);
 	}
-
-	lock_release(pidlock);
+	pidinfo_decref(them);
 }
 
 /*
@@ -343,42 +569,137 @@ pid_disown(pid_t theirpid)
 void
 pid_setexitstatus(int status)
 {
-	struct pidinfo *us;
-	int i;
+	struct pidinfo *us, *parent, *kid, *zombies;
+	struct schedstats stats, childstats;
+	bool detached;
 
-	lock_acquire(pidlock);
 	KASSERT(curproc->p_pid != INVALID_PID);
 
-	/* First, disown all children */
-	for (i=0; i<PROCS_MAX; i++) {
-		if (pidinfo[i]==NULL) {
-			continue;
-		}
-		if (pidinfo[i]->pi_ppid == curproc->p_pid) {
-			pidinfo[i]->pi_ppid = INVALID_PID;
-			if (pidinfo[i]->pi_exited) {
-				pi_drop(pidinfo[i]->pi_pid);
-			}
-		}
+	us = pi_get(curproc->p_pid);
+	KASSERT(us != NULL);
+
+	/*
+	 * First, disown all children. The ones that have already
+	 * exited can go now (once we've let go of our lock); the rest
+	 * will see they're detached when they exit.
+	 */
+	zombies = NULL;
+	lock_acquire(us->pi_lock);
+	while ((kid = us->pi_children) != NULL) {
+		pidinfo_remchild(kid);
+		kid->pi_detached = true;
 	}
+	while ((kid = us->pi_zombies) != NULL) {
+		pidinfo_remchild(kid);
+		kid->pi_detached = true;
+		kid->pi_sibnext = zombies;
+		zombies = kid;
+	}
+	lock_release(us->pi_lock);
+	while ((kid = zombies) != NULL) {
+		zombies = kid->pi_sibnext;
+		kid->pi_sibnext = NULL;
+		pi_drop(kid);
+	}
+
+	/* Collect our totals, and our children's, for the parent. */
+	proc_getstats(curproc, false, &stats);
+	proc_getstats(curproc, true, &childstats);
+	schedstats_add(&stats, &childstats);
 
 	/* Now, wake up our parent */
-	us = pi_get(curproc->p_pid);
-	KASSERT(us != NULL);
+	parent = us->pi_parent;
+	KASSERT(parent != NULL);
 
+	lock_acquire(parent->pi_lock);
 	us->pi_exitstatus = status;
+	us->pi_stats = stats;
 	us->pi_exited = true;
+	detached = us->pi_detached;
+	if (!detached) {
+		pidinfo_remchild(us);
+		pidinfo_addchild(&parent->pi_zombies, us);
+		cv_broadcast(parent->pi_cv, parent->pi_lock);
+	}
+	lock_release(parent->pi_lock);
 
-	if (us->pi_ppid == INVALID_PID) {
+	if (detached) {
 		/* no parent */
-		pi_drop(curproc->p_pid);
-	}
-	else {
-		cv_broadcast(us->pi_cv, pidlock);
+		pi_drop(us);
 	}
 
 	curproc->p_pid = INVALID_PID;
-	lock_release(pidlock);
+	pidinfo_decref(us);
+}
+
+/*
+ * Collect the exit status of THEM, a child of US that has exited, and
+ * take it off our lists. US must be locked. The caller must pi_drop
+ * THEM after unlocking.
+ */
+static
+void
+pi_collect(struct pidinfo *us, struct pidinfo *them, int *status, pid_t *ret)
+{
+	KASSERT(lock_do_i_hold(us->pi_lock));
+	KASSERT(them->pi_parent == us);
+	KASSERT(them->pi_exited);
+
+	if (status != NULL) {
+		*status = them->pi_exitstatus;
+	}
+	if (ret != NULL) {
+		*ret = them->pi_pid;
+	}
+
+	proc_addchildstats(curproc, &them->pi_stats);
+
+	/* Nobody can wait for it again. */
+	them->pi_detached = true;
+	pidinfo_remchild(them);
+}
+
+/*
+ * Wait for any child. The children that have already exited are on
+ * our zombie list, so this is constant-time, and reaping N children
+ * takes N calls no matter what order they exit in.
+ */
+static
+int
+pid_waitany(int *status, int flags, pid_t *ret)
+{
+	struct pidinfo *us, *them;
+
+	us = pi_get(curproc->p_pid);
+	KASSERT(us != NULL);
+
+	lock_acquire(us->pi_lock);
+	while ((them = us->pi_zombies) == NULL) {
+		if (us->pi_children == NULL) {
+			lock_release(us->pi_lock);
+			pidinfo_decref(us);
+			return ECHILD;
+		}
+		if (flags == WNOHANG) {
+			lock_release(us->pi_lock);
+			pidinfo_decref(us);
+			KASSERT(ret != NULL);
+			*ret = 0;
+			return 0;
+		}
+		if (curproc->p_exiting) {
+			lock_release(us->pi_lock);
+			pidinfo_decref(us);
+			return EINTR;
+		}
+		cv_wait(us->pi_cv, us->pi_lock);
+	}
+	pi_collect(us, them, status, ret);
+	lock_release(us->pi_lock);
+
+	pi_drop(them);
+	pidinfo_decref(us);
+	return 0;
 }
 
 /*
@@ -386,13 +707,16 @@ pid_setexitstatus(int status)
  * status and ret are a kernel pointers, but pid/flags may come from
  * userland and may thus be maliciously invalid.
  *
+ * THEIRPID may be WAIT_ANY to wait for whichever child exits first;
+ * *ret is then set to the pid found.
+ *
  * status may be null, in which case the status is thrown away. ret
- * may only be null if WNOHANG is not set.
+ * may only be null if WNOHANG is not set and THEIRPID is not WAIT_ANY.
  */
 int
 pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 {
-	struct pidinfo *them;
+	struct pidinfo *them, *us;
 
 	KASSERT(curproc->p_pid != INVALID_PID);
 
@@ -401,65 +725,90 @@ pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 		return EINVAL;
 	}
 
-	/*
-	 * We don't support the Unix meanings of negative pids or 0
-	 * (0 is INVALID_PID) and other code may break on them, so
-	 * check now.
-	 */
-	if (theirpid == INVALID_PID || theirpid<0) {
-		return ENOSYS;
-	}
-
 	/* Only valid options */
 	if (flags != 0 && flags != WNOHANG) {
 		return EINVAL;
 	}
 
-	lock_acquire(pidlock);
+	if (theirpid == WAIT_ANY) {
+		return pid_waitany(status, flags, ret);
+	}
+
+	/*
+	 * We don't support process groups, the other Unix meaning of
+	 * negative pids or 0 (0 is INVALID_PID), and other code may
+	 * break on them, so check now.
+	 */
+	if (theirpid == INVALID_PID || theirpid<0) {
+		return ENOSYS;
+	}
 
 	them = pi_get(theirpid);
 	if (them==NULL) {
-		lock_release(pidlock);
 		return ESRCH;
 	}
 
 	KASSERT(them->pi_pid==theirpid);
 
 	/* Only allow waiting for own children. */
-	if (them->pi_ppid != curproc->p_pid) {
-		lock_release(pidlock);
+	us = them->pi_parent;
+	if (us == NULL || us->pi_pid != curproc->p_pid) {
+		pidinfo_decref(them);
 		return EPERM;
 	}
 
-	if (them->pi_exited == false) {
+	lock_acquire(us->pi_lock);
+	if (them->pi_detached) {
+		/* disowned, or another thread already waited for it */
+		lock_release(us->pi_lock);
+		pidinfo_decref(them);
+		return EPERM;
+	}
+
+	while (them->pi_exited == false) {
 		if (flags == WNOHANG) {
-			lock_release(pidlock);
+			lock_release(us->pi_lock);
+			pidinfo_decref(them);
 			KASSERT(ret != NULL);
 			*ret = 0;
 			return 0;
 		}
-		/* don't need to loop on this */
-		cv_wait(them->pi_cv, pidlock);
-		KASSERT(them->pi_exited == true);
-	}
-
-	if (status != NULL) {
-		*status = them->pi_exitstatus;
-	}
-	if (ret != NULL) {
-		/*
-		 * In Unix you can wait for any of several possible
-		 * processes by passing particular magic values of
-		 * pid. wait then returns the pid you actually
-		 * found. We don't support this, so always return the
-		 * pid we looked for.
-		 */
-		*ret = theirpid;
+		if (curproc->p_exiting) {
+			lock_release(us->pi_lock);
+			pidinfo_decref(them);
+			return EINTR;
+		}
+		/* the cv is shared by all our children, so loop */
+		cv_wait(us->pi_cv, us->pi_lock);
+		if (them->pi_detached) {
+			lock_release(us->pi_lock);
+			pidinfo_decref(them);
+			return ESRCH;
+		}
 	}
 
-	them->pi_ppid = 0;
-	pi_drop(them->pi_pid);
+	pi_collect(us, them, status, ret);
+	lock_release(us->pi_lock);
 
-	lock_release(pidlock);
+	pi_drop(them);
+	pidinfo_decref(them);
 	return 0;
 }
+
+/*
+ * Kick our threads out of pid_wait; proc_killthreads has set
+ * p_exiting, which they check under pi_lock before sleeping.
+ */
+void
+pid_interrupt(void)
+{
+	struct pidinfo *us;
+
+	us = pi_get(curproc->p_pid);
+	KASSERT(us != NULL);
+
+	lock_acquire(us->pi_lock);
+	cv_broadcast(us->pi_cv, us->pi_lock);
+	lock_release(us->pi_lock);
+	pidinfo_decref(us);
+}
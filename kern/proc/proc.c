@@ -38,25 +38,53 @@
  * things they point to. Rearrange this (and/or change it to be a
  * regular lock) as needed.
  *
- * Unless you're implementing multithreaded user processes, the only
- * process that will have more than one thread is the kernel process.
+ * Besides the kernel process, a process has more than one thread if
+ * its program has called thread_create. The user-level thread
+ * bookkeeping (p_uthreads and friends) is protected by p_threadlock
+ * rather than p_lock, as joining and exiting have to sleep.
  */
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/wait.h>
 #include <spl.h>
 #include <proc.h>
 #include <current.h>
+#include <synch.h>
+#include <wchan.h>
+#include <callout.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include <pid.h>
 #include <filetable.h>
+#include <syscall.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
  */
 struct proc *kproc;
 
+/*
+ * All processes, for ps. A spinlock, because the kernel process is
+ * created before there are threads to hold a sleep lock.
+ */
+static struct spinlock allprocs_lock = SPINLOCK_INITIALIZER;
+static struct proc *allprocs;
+
+/*
+ * Processes that have exited and are waiting to be torn down, oldest
+ * first. See proc_exit. If more than REAPER_MAXQUEUE are waiting, the
+ * reaper isn't keeping up, and exiting processes tear themselves down
+ * rather than pile up more memory for it to free.
+ */
+#define REAPER_MAXQUEUE 16
+
+static struct spinlock reaper_lock = SPINLOCK_INITIALIZER;
+static struct proc *reaper_queue;
+static struct proc **reaper_tailp = &reaper_queue;
+static unsigned reaper_count;
+static struct semaphore *reaper_sem;
+
 /*
  * Create a proc structure.
  */
@@ -65,6 +93,7 @@ struct proc *
 proc_create(const char *name)
 {
 	struct proc *proc;
+	unsigned i;
 
 	proc = kmalloc(sizeof(*proc));
 	if (proc == NULL) {
@@ -82,11 +111,62 @@ proc_create(const char *name)
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
+	proc->p_vforksem = NULL;
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
 	proc->p_filetable = NULL;
 
+	/* user-level threads */
+	proc->p_threadlock = lock_create("proc threads");
+	if (proc->p_threadlock == NULL) {
+		spinlock_cleanup(&proc->p_lock);
+		threadarray_cleanup(&proc->p_threads);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
+	proc->p_threadcv = cv_create("proc threads");
+	if (proc->p_threadcv == NULL) {
+		lock_destroy(proc->p_threadlock);
+		spinlock_cleanup(&proc->p_lock);
+		threadarray_cleanup(&proc->p_threads);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
+	proc->p_sleepchan = wchan_create("proc sleep");
+	if (proc->p_sleepchan == NULL) {
+		cv_destroy(proc->p_threadcv);
+		lock_destroy(proc->p_threadlock);
+		spinlock_cleanup(&proc->p_lock);
+		threadarray_cleanup(&proc->p_threads);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
+	for (i=0; i<UTHREAD_MAX; i++) {
+		proc->p_uthreads[i].ut_state = UT_FREE;
+		proc->p_uthreads[i].ut_value = NULL;
+	}
+	proc->p_nuthreads = 0;
+	proc->p_exiting = false;
+
+	/* accounting */
+	schedstats_zero(&proc->p_stats);
+	schedstats_zero(&proc->p_cstats);
+
+	spinlock_acquire(&allprocs_lock);
+	proc->p_allnext = allprocs;
+	if (allprocs != NULL) {
+		allprocs->p_allprevp = &proc->p_allnext;
+	}
+	proc->p_allprevp = &allprocs;
+	allprocs = proc;
+	spinlock_release(&allprocs_lock);
+
+	proc->p_reapnext = NULL;
+
 	return proc;
 }
 
@@ -127,6 +207,15 @@ proc_destroy(struct proc *proc)
 	}
 
 	/* VM fields */
+	if (proc->p_vforksem != NULL) {
+		/*
+		 * A vfork child that never ran. The address space is
+		 * its parent's, which is still using it.
+		 */
+		KASSERT(proc != curproc);
+		proc->p_addrspace = NULL;
+		proc->p_vforksem = NULL;
+	}
 	if (proc->p_addrspace) {
 		/*
 		 * If p is the current process, remove it safely from
@@ -174,7 +263,17 @@ proc_destroy(struct proc *proc)
 		as_destroy(as);
 	}
 
+	spinlock_acquire(&allprocs_lock);
+	*proc->p_allprevp = proc->p_allnext;
+	if (proc->p_allnext != NULL) {
+		proc->p_allnext->p_allprevp = proc->p_allprevp;
+	}
+	spinlock_release(&allprocs_lock);
+
 	KASSERT(proc->p_pid == INVALID_PID);
+	wchan_destroy(proc->p_sleepchan);
+	cv_destroy(proc->p_threadcv);
+	lock_destroy(proc->p_threadlock);
 	threadarray_cleanup(&proc->p_threads);
 	spinlock_cleanup(&proc->p_lock);
 
@@ -195,6 +294,59 @@ proc_bootstrap(void)
 	kproc->p_pid = KERNEL_PID;
 }
 
+/*
+ * The reaper thread. Destroying a process means freeing every page
+ * and swap slot of its address space, which for a big process takes a
+ * while. None of that needs to happen before the exiting thread goes
+ * away or before the parent hears about the exit, so it's done here,
+ * off to the side. (The files are closed by proc_exit, since other
+ * processes can see those.)
+ */
+static
+void
+proc_reaper(void *unused1, unsigned long unused2)
+{
+	struct proc *proc;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		P(reaper_sem);
+		spinlock_acquire(&reaper_lock);
+		proc = reaper_queue;
+		KASSERT(proc != NULL);
+		reaper_queue = proc->p_reapnext;
+		if (reaper_queue == NULL) {
+			reaper_tailp = &reaper_queue;
+		}
+		reaper_count--;
+		spinlock_release(&reaper_lock);
+
+		proc->p_reapnext = NULL;
+		proc_destroy(proc);
+	}
+}
+
+/*
+ * Start the reaper.
+ */
+void
+proc_reaper_bootstrap(void)
+{
+	int result;
+
+	reaper_sem = sem_create("reaper", 0);
+	if (reaper_sem == NULL) {
+		panic("proc_reaper_bootstrap: Out of memory\n");
+	}
+	result = thread_fork("reaper", kproc, proc_reaper, NULL, 0);
+	if (result) {
+		panic("proc_reaper_bootstrap: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+}
+
 /*
  * Create a fresh proc for use by runprogram.
  *
@@ -225,6 +377,10 @@ proc_create_runprogram(const char *name, struct proc **ret)
 
 	newproc->p_addrspace = NULL;
 
+	/* The thread that will run the program is the main thread. */
+	newproc->p_uthreads[0].ut_state = UT_RUNNING;
+	newproc->p_nuthreads = 1;
+
 	/* VFS fields */
 
 	/*
@@ -250,11 +406,13 @@ proc_create_runprogram(const char *name, struct proc **ret)
  * is not null. (If RET is null, what we're creating is a kernel-only
  * thread and it doesn't need an address space or file handles.)
  * However, the new thread always inherits its current working
- * directory from the caller. The new thread is given no address space
- * (the caller decides that).
+ * directory from the caller. The new thread is given a copy of the
+ * caller's address space; or, for vfork (VFORKSEM not NULL), the
+ * same one, which the caller must leave alone until the new process
+ * signals VFORKSEM.
  */
 int
-proc_fork(struct proc **ret)
+proc_fork(struct semaphore *vforksem, struct proc **ret)
 {
 	struct proc *newproc;
 	struct addrspace *as;
@@ -284,12 +442,15 @@ proc_fork(struct proc **ret)
 
 	/* VM fields */
 	as = proc_getas();
-	if (as != NULL) {
+	if (vforksem != NULL) {
+		KASSERT(as != NULL);
+		newproc->p_addrspace = as;
+		newproc->p_vforksem = vforksem;
+	}
+	else if (as != NULL) {
 		result = as_copy(as, &newproc->p_addrspace);
 		if (result) {
-			pid_unalloc(newproc->p_pid);
-			newproc->p_pid = INVALID_PID;
-			proc_destroy(newproc);
+			proc_unfork(newproc);
 			return result;
 		}
 	}
@@ -299,11 +460,8 @@ proc_fork(struct proc **ret)
 	if (tbl != NULL) {
 		result = filetable_copy(tbl, &newproc->p_filetable);
 		if (result) {
-			as_destroy(newproc->p_addrspace);
-			newproc->p_addrspace = NULL;
-			pid_unalloc(newproc->p_pid);
-			newproc->p_pid = INVALID_PID;
-			proc_destroy(newproc);
+			/* proc_destroy knows not to free a borrowed as */
+			proc_unfork(newproc);
 			return result;
 		}
 	}
@@ -320,12 +478,72 @@ proc_fork(struct proc **ret)
 	}
 	spinlock_release(&curproc->p_lock);
 
+	/*
+	 * Only the calling thread is copied. It keeps its slot, since
+	 * its stack is at the same place in the copied address space.
+	 */
+	newproc->p_uthreads[curthread->t_utid].ut_state = UT_RUNNING;
+	newproc->p_nuthreads = 1;
+
 	*ret = newproc;
 	return 0;
 }
 
 /*
- * Undo proc_fork if nothing's run in the new process yet.
+ * Create a process for spawn(). This is proc_fork without the
+ * address space: the new process gets a copy of the caller's file
+ * handles and its current directory, and its main thread will load
+ * a fresh executable, so there's no point in copying the caller's
+ * memory only to throw it away.
+ */
+int
+proc_spawn(const char *name, struct proc **ret)
+{
+	struct proc *newproc;
+	struct filetable *tbl;
+	int result;
+
+	newproc = proc_create(name);
+	if (newproc == NULL) {
+		return ENOMEM;
+	}
+	/* Get a process ID */
+	result = pid_alloc(&newproc->p_pid);
+	if (result) {
+		proc_destroy(newproc);
+		return result;
+	}
+
+	/* VM fields */
+	newproc->p_addrspace = NULL;
+
+	/* VFS fields */
+	tbl = curproc->p_filetable;
+	if (tbl != NULL) {
+		result = filetable_copy(tbl, &newproc->p_filetable);
+		if (result) {
+			proc_unfork(newproc);
+			return result;
+		}
+	}
+
+	spinlock_acquire(&curproc->p_lock);
+	if (curproc->p_cwd != NULL) {
+		VOP_INCREF(curproc->p_cwd);
+		newproc->p_cwd = curproc->p_cwd;
+	}
+	spinlock_release(&curproc->p_lock);
+
+	/* The thread that will run the program is the main thread. */
+	newproc->p_uthreads[0].ut_state = UT_RUNNING;
+	newproc->p_nuthreads = 1;
+
+	*ret = newproc;
+	return 0;
+}
+
+/*
+ * Undo proc_fork or proc_spawn if nothing's run in the new process yet.
  */
 void
 proc_unfork(struct proc *newproc)
@@ -342,10 +560,31 @@ void
 proc_exit(int status)
 {
 	struct proc *proc = curproc;
+	bool queued;
 
 	/* The kernel isn't supposed to exit. */
 	KASSERT(proc != kproc);
 
+	/* Get rid of any other threads first. */
+	proc_killthreads();
+
+	/* Give back a borrowed address space. */
+	if (proc->p_vforksem != NULL) {
+		proc_setas(NULL);
+		as_deactivate();
+		proc_vforkdone();
+	}
+
+	/*
+	 * Close our files now, so that whoever is on the other end of
+	 * a pipe sees it closed, and unlinked files are freed, when we
+	 * exit rather than when the reaper gets to us.
+	 */
+	if (proc->p_filetable != NULL) {
+		filetable_destroy(proc->p_filetable);
+		proc->p_filetable = NULL;
+	}
+
 	/* Set exit status and wake up anyone waiting for us. */
 	pid_setexitstatus(status);
 
@@ -357,12 +596,284 @@ proc_exit(int status)
 	/* There should be no threads left in the target process. */
 	KASSERT(threadarray_num(&proc->p_threads) == 0);
 
-	/* Now we can destroy the process. */
-	proc_destroy(proc);
+	/*
+	 * Now the process can be destroyed; let the reaper do it,
+	 * unless it's not running yet or is too far behind.
+	 */
+	queued = false;
+	if (reaper_sem != NULL) {
+		spinlock_acquire(&reaper_lock);
+		if (reaper_count < REAPER_MAXQUEUE) {
+			proc->p_reapnext = NULL;
+			*reaper_tailp = proc;
+			reaper_tailp = &proc->p_reapnext;
+			reaper_count++;
+			queued = true;
+		}
+		spinlock_release(&reaper_lock);
+	}
+	if (queued) {
+		V(reaper_sem);
+	}
+	else {
+		proc_destroy(proc);
+	}
 
 	thread_exit();
 }
 
+/*
+ * A vfork child has stopped using its parent's address space; let
+ * the parent continue.
+ */
+void
+proc_vforkdone(void)
+{
+	struct proc *proc = curproc;
+	struct semaphore *sem;
+
+	spinlock_acquire(&proc->p_lock);
+	sem = proc->p_vforksem;
+	proc->p_vforksem = NULL;
+	spinlock_release(&proc->p_lock);
+
+	if (sem != NULL) {
+		/* After this the parent may destroy it. */
+		V(sem);
+	}
+}
+
+/*
+ * Take the current thread out of its process, marking its slot
+ * STATE, and exit it. The caller holds p_threadlock, which is
+ * released once we're no longer part of the process; after that the
+ * process may be destroyed at any moment by whoever was waiting for
+ * us, so we mustn't touch it again.
+ */
+static
+__DEAD
+void
+proc_threadleave(struct proc *proc, uthreadstate_t state, userptr_t value)
+{
+	struct uthread *ut;
+
+	KASSERT(lock_do_i_hold(proc->p_threadlock));
+	KASSERT(proc->p_nuthreads > 1);
+
+	ut = &proc->p_uthreads[curthread->t_utid];
+	KASSERT(ut->ut_state == UT_RUNNING);
+	ut->ut_state = state;
+	ut->ut_value = value;
+	proc->p_nuthreads--;
+
+	proc_remthread(curthread);
+	proc_addthread(kproc, curthread);
+
+	cv_broadcast(proc->p_threadcv, proc->p_threadlock);
+	lock_release(proc->p_threadlock);
+
+	thread_exit();
+}
+
+int
+proc_newthread(unsigned first, unsigned *utid)
+{
+	struct proc *proc = curproc;
+	unsigned i;
+
+	lock_acquire(proc->p_threadlock);
+	if (proc->p_exiting) {
+		lock_release(proc->p_threadlock);
+		return EINTR;
+	}
+	for (i=first; i<UTHREAD_MAX; i++) {
+		if (proc->p_uthreads[i].ut_state == UT_FREE) {
+			proc->p_uthreads[i].ut_state = UT_RUNNING;
+			proc->p_uthreads[i].ut_value = NULL;
+			proc->p_nuthreads++;
+			lock_release(proc->p_threadlock);
+			*utid = i;
+			return 0;
+		}
+	}
+	lock_release(proc->p_threadlock);
+	return EAGAIN;
+}
+
+void
+proc_unnewthread(unsigned utid)
+{
+	struct proc *proc = curproc;
+
+	KASSERT(utid < UTHREAD_MAX);
+
+	lock_acquire(proc->p_threadlock);
+	KASSERT(proc->p_uthreads[utid].ut_state == UT_RUNNING);
+	proc->p_uthreads[utid].ut_state = UT_FREE;
+	proc->p_nuthreads--;
+	/* proc_killthreads might be counting on us */
+	cv_broadcast(proc->p_threadcv, proc->p_threadlock);
+	lock_release(proc->p_threadlock);
+}
+
+void
+proc_threadexit(userptr_t value)
+{
+	struct proc *proc = curproc;
+
+	lock_acquire(proc->p_threadlock);
+	if (proc->p_nuthreads > 1) {
+		proc_threadleave(proc, UT_ZOMBIE, value);
+	}
+	lock_release(proc->p_threadlock);
+
+	/* Last one out; take the process with us. */
+	proc_exit(_MKWAIT_EXIT(0));
+	thread_exit();
+}
+
+int
+proc_threadjoin(unsigned utid, userptr_t *value)
+{
+	struct proc *proc = curproc;
+	struct uthread *ut;
+
+	if (utid >= UTHREAD_MAX) {
+		return ESRCH;
+	}
+	if (utid == curthread->t_utid) {
+		return EINVAL;
+	}
+	ut = &proc->p_uthreads[utid];
+
+	lock_acquire(proc->p_threadlock);
+	while (ut->ut_state == UT_RUNNING && !proc->p_exiting) {
+		cv_wait(proc->p_threadcv, proc->p_threadlock);
+	}
+	if (ut->ut_state == UT_FREE) {
+		/* never existed, or somebody else joined it first */
+		lock_release(proc->p_threadlock);
+		return ESRCH;
+	}
+	if (ut->ut_state == UT_RUNNING) {
+		lock_release(proc->p_threadlock);
+		return EINTR;
+	}
+	*value = ut->ut_value;
+	ut->ut_state = UT_FREE;
+	ut->ut_value = NULL;
+	lock_release(proc->p_threadlock);
+	return 0;
+}
+
+/*
+ * Threads notice p_exiting when they next head back to user mode, or
+ * when they're woken from thread_join, a futex wait, proc_sleep or
+ * waitpid, all of which give up with EINTR. Threads asleep for other
+ * reasons (e.g. reading from the console) hold us up until they get
+ * woken in the normal course of things.
+ */
+void
+proc_killthreads(void)
+{
+	struct proc *proc = curproc;
+	unsigned i;
+
+	lock_acquire(proc->p_threadlock);
+	if (proc->p_exiting) {
+		/* Somebody else got here first; they're waiting for us. */
+		proc_threadleave(proc, UT_FREE, NULL);
+	}
+	if (proc->p_nuthreads == 1) {
+		/* Nobody else around; don't bother. */
+		lock_release(proc->p_threadlock);
+		return;
+	}
+
+	proc->p_exiting = true;
+	cv_broadcast(proc->p_threadcv, proc->p_threadlock);
+	futex_wakeall(proc->p_addrspace);
+	spinlock_acquire(&proc->p_lock);
+	wchan_wakeall(proc->p_sleepchan, &proc->p_lock);
+	spinlock_release(&proc->p_lock);
+	pid_interrupt();
+	while (proc->p_nuthreads > 1) {
+		cv_wait(proc->p_threadcv, proc->p_threadlock);
+	}
+
+	/* Nobody's left to join the zombies. */
+	for (i=0; i<UTHREAD_MAX; i++) {
+		if (i != curthread->t_utid) {
+			proc->p_uthreads[i].ut_state = UT_FREE;
+			proc->p_uthreads[i].ut_value = NULL;
+		}
+	}
+	proc->p_exiting = false;
+	lock_release(proc->p_threadlock);
+}
+
+void
+proc_threadexec(void)
+{
+	struct proc *proc = curproc;
+	unsigned utid = curthread->t_utid;
+
+	lock_acquire(proc->p_threadlock);
+	KASSERT(proc->p_nuthreads == 1);
+	KASSERT(proc->p_uthreads[utid].ut_state == UT_RUNNING);
+	proc->p_uthreads[utid].ut_state = UT_FREE;
+	proc->p_uthreads[0].ut_state = UT_RUNNING;
+	curthread->t_utid = 0;
+	lock_release(proc->p_threadlock);
+}
+
+void
+proc_checkexit(void)
+{
+	struct proc *proc = curproc;
+
+	/*
+	 * Unlocked peek. If we miss it, we'll see it on our next
+	 * trip through the kernel, at worst the next timer interrupt.
+	 */
+	if (!proc->p_exiting) {
+		return;
+	}
+
+	lock_acquire(proc->p_threadlock);
+	if (proc->p_exiting) {
+		proc_threadleave(proc, UT_FREE, NULL);
+	}
+	lock_release(proc->p_threadlock);
+}
+
+int
+proc_sleep(unsigned ticks)
+{
+	struct proc *proc = curproc;
+	struct wchan_timeout wt;
+	unsigned chunk;
+	bool exiting = false;
+
+	while (ticks > 0 && !exiting) {
+		/* The callout wheel only reaches so far. */
+		chunk = ticks < CALLOUT_MAXTICKS ? ticks : CALLOUT_MAXTICKS;
+		ticks -= chunk;
+
+		/* proc_killthreads sets p_exiting, then wakes us under p_lock */
+		spinlock_acquire(&proc->p_lock);
+		wchan_timeout_start(&wt, proc->p_sleepchan, &proc->p_lock,
+				    chunk);
+		while (!wt.wt_timedout && !proc->p_exiting) {
+			wchan_sleep(proc->p_sleepchan, &proc->p_lock);
+		}
+		exiting = proc->p_exiting;
+		spinlock_release(&proc->p_lock);
+		wchan_timeout_stop(&wt);
+	}
+	return exiting ? EINTR : 0;
+}
+
 /*
  * Add a thread to a process. Either the thread or the process might
  * or might not be current.
@@ -417,6 +928,13 @@ proc_remthread(struct thread *t)
 	for (i=0; i<num; i++) {
 		if (threadarray_get(&proc->p_threads, i) == t) {
 			threadarray_remove(&proc->p_threads, i);
+			/*
+			 * Leave its totals behind. (Holding p_lock
+			 * keeps the clock from charging it meanwhile,
+			 * if it's us.)
+			 */
+			schedstats_add(&proc->p_stats, &t->t_stats);
+			schedstats_zero(&t->t_stats);
 			spinlock_release(&proc->p_lock);
 			spl = splhigh();
 			t->t_proc = NULL;
@@ -429,13 +947,194 @@ proc_remthread(struct thread *t)
 	panic("Thread (%p) has escaped from its process (%p)\n", t, proc);
 }
 
+/*
+ * Set the niceness of all threads in a process.
+ */
+void
+proc_setnice(struct proc *proc, int nice)
+{
+	unsigned i, num;
+
+	spinlock_acquire(&proc->p_lock);
+	num = threadarray_num(&proc->p_threads);
+	for (i=0; i<num; i++) {
+		thread_setnice(threadarray_get(&proc->p_threads, i), nice);
+	}
+	spinlock_release(&proc->p_lock);
+}
+
+/*
+ * Get the accounting totals of a process. The counters of running
+ * threads may change under us; this is only a snapshot.
+ */
+void
+proc_getstats(struct proc *proc, bool children, struct schedstats *ret)
+{
+	struct thread *t;
+	unsigned i, num;
+
+	spinlock_acquire(&proc->p_lock);
+	if (children) {
+		*ret = proc->p_cstats;
+	}
+	else {
+		*ret = proc->p_stats;
+		num = threadarray_num(&proc->p_threads);
+		for (i=0; i<num; i++) {
+			t = threadarray_get(&proc->p_threads, i);
+			schedstats_add(ret, &t->t_stats);
+		}
+	}
+	spinlock_release(&proc->p_lock);
+}
+
+/*
+ * Add the totals of a child (its own and its children's) that has
+ * just been waited for.
+ */
+void
+proc_addchildstats(struct proc *proc, const struct schedstats *ss)
+{
+	spinlock_acquire(&proc->p_lock);
+	schedstats_add(&proc->p_cstats, ss);
+	spinlock_release(&proc->p_lock);
+}
+
+/*
+ * ps.
+ *
+ * We can't print with allprocs_lock held, and can't hold on to a
+ * process without it, so first copy what we want to show into a
+ * table. Processes and threads created after we counted them are
+ * left out.
+ */
+
+#define PS_NAMELEN	24
+#define PS_SLACK	8	/* extra rows in case things were created */
+
+struct psrow {
+	bool ps_isproc;			/* process or thread row */
+	pid_t ps_pid;			/* process only */
+	unsigned ps_nthreads;		/* process only */
+	threadstate_t ps_state;		/* thread only */
+	unsigned ps_level;		/* thread only */
+	int ps_nice;			/* thread only */
+	char ps_name[PS_NAMELEN];
+	struct schedstats ps_stats;
+};
+
+static
+unsigned
+proc_psfill(struct psrow *rows, unsigned maxrows)
+{
+	struct proc *p;
+	struct thread *t;
+	struct psrow *row;
+	unsigned i, num, n;
+
+	n = 0;
+	spinlock_acquire(&allprocs_lock);
+	for (p = allprocs; p != NULL; p = p->p_allnext) {
+		spinlock_acquire(&p->p_lock);
+		num = threadarray_num(&p->p_threads);
+		if (n + 1 + num > maxrows) {
+			spinlock_release(&p->p_lock);
+			break;
+		}
+
+		row = &rows[n++];
+		row->ps_isproc = true;
+		row->ps_pid = p->p_pid;
+		row->ps_nthreads = num;
+		snprintf(row->ps_name, PS_NAMELEN, "%s", p->p_name);
+		row->ps_stats = p->p_stats;
+
+		for (i=0; i<num; i++) {
+			t = threadarray_get(&p->p_threads, i);
+			schedstats_add(&row->ps_stats, &t->t_stats);
+
+			rows[n].ps_isproc = false;
+			rows[n].ps_state = t->t_state;
+			rows[n].ps_level = thread_schedlevel(t);
+			rows[n].ps_nice = t->t_nice;
+			snprintf(rows[n].ps_name, PS_NAMELEN, "%s",
+				 t->t_name);
+			rows[n].ps_stats = t->t_stats;
+			n++;
+		}
+		spinlock_release(&p->p_lock);
+	}
+	spinlock_release(&allprocs_lock);
+	return n;
+}
+
+static
+unsigned
+proc_pscount(void)
+{
+	struct proc *p;
+	unsigned n;
+
+	n = 0;
+	spinlock_acquire(&allprocs_lock);
+	for (p = allprocs; p != NULL; p = p->p_allnext) {
+		spinlock_acquire(&p->p_lock);
+		n += 1 + threadarray_num(&p->p_threads);
+		spinlock_release(&p->p_lock);
+	}
+	spinlock_release(&allprocs_lock);
+	return n;
+}
+
+void
+proc_printstats(void)
+{
+	static const char *const statenames[] = {
+		"run", "ready", "sleep", "zombie",
+	};
+	struct psrow *rows, *row;
+	unsigned i, n, max;
+
+	max = proc_pscount() + PS_SLACK;
+	rows = kmalloc(max * sizeof(*rows));
+	if (rows == NULL) {
+		kprintf("ps: Out of memory\n");
+		return;
+	}
+	n = proc_psfill(rows, max);
+
+	kprintf("%5s %4s %8s %8s %8s %7s %7s  %s\n", "PID", "THR",
+		"UTICKS", "STICKS", "WAIT", "VCSW", "IVCSW", "NAME");
+	for (i=0; i<n; i++) {
+		row = &rows[i];
+		if (row->ps_isproc) {
+			kprintf("%5d %4u ", row->ps_pid, row->ps_nthreads);
+		}
+		else {
+			kprintf("%10s ", "");
+		}
+		kprintf("%8u %8u %8u %7u %7u  ", row->ps_stats.ss_uticks,
+			row->ps_stats.ss_sticks, row->ps_stats.ss_waitticks,
+			row->ps_stats.ss_nvcsw, row->ps_stats.ss_nivcsw);
+		if (row->ps_isproc) {
+			kprintf("%s\n", row->ps_name);
+		}
+		else {
+			kprintf("  %s (%s, level %u, nice %d)\n",
+				row->ps_name, statenames[row->ps_state],
+				row->ps_level, row->ps_nice);
+		}
+	}
+	kfree(rows);
+}
+
 /*
  * Fetch the address space of (the current) process.
  *
- * Caution: address spaces aren't refcounted. If you implement
- * multithreaded processes, make sure to set up a refcount scheme or
- * some other method to make this safe. Otherwise the returned address
- * space might disappear under you.
+ * Address spaces aren't refcounted. That's still safe with several
+ * threads in a process, because the address space only goes away (in
+ * exec or exit) after proc_killthreads has got rid of all the other
+ * threads that might be using it.
  */
 struct addrspace *
 proc_getas(void)
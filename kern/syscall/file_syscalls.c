@@ -43,6 +43,7 @@
 #include <current.h>
 #include <synch.h>
 #include <copyinout.h>
+#include <vm.h>
 #include <vfs.h>
 #include <vnode.h>
 #include <openfile.h>
@@ -105,45 +106,82 @@ sys_open(const_userptr_t upath, int flags, mode_t mode, int *retval)
 }
 
 /*
- * Common logic for read and write.
+ * Common logic for read, write, readv, writev, pread, and pwrite.
  *
- * Look up the fd, then use VOP_READ or VOP_WRITE.
+ * Look up the fd, then use VOP_READ or VOP_WRITE on a uio made from
+ * the IOVCNT iovecs at IOV (in kernel memory, describing user
+ * buffers), all in one go. The I/O happens at *POSP, or if POSP is
+ * NULL, at the file's seek position.
+ *
+ * An explicit position doesn't touch the seek position or its lock,
+ * so that I/O on the same file can go on in parallel. It has to be a
+ * seekable file, and the position can't be negative.
  */
 static
 int
-sys_readwrite(int fd, userptr_t buf, size_t size, enum uio_rw rw,
-	      int badaccmode, ssize_t *retval)
+sys_readwrite(int fd, struct iovec *iov, unsigned iovcnt, const off_t *posp,
+	      enum uio_rw rw, int badaccmode, ssize_t *retval)
 {
 	struct openfile *file;
-	bool locked;
 	off_t pos;
-	struct iovec iov;
+	bool locked;
 	struct uio useruio;
+	size_t size;
+	unsigned i;
 	int result;
 
+	/* add up the sizes; the total has to fit in the (signed) result */
+	size = 0;
+	for (i=0; i<iovcnt; i++) {
+		if (iov[i].iov_len > ((size_t)-1 >> 1) - size) {
+			return EINVAL;
+		}
+		size += iov[i].iov_len;
+	}
+
 	/* better be a valid file descriptor */
 	result = filetable_get(curproc->p_filetable, fd, &file);
 	if (result) {
 		return result;
 	}
 
-	/* Only lock the seek position if we're really using it. */
-	locked = VOP_ISSEEKABLE(file->of_vnode);
-	if (locked) {
-		lock_acquire(file->of_offsetlock);
-		pos = file->of_offset;
-	}
-	else {
-		pos = 0;
-	}
-
+	locked = false;
 	if (file->of_accmode == badaccmode) {
 		result = EBADF;
 		goto fail;
 	}
 
-	/* set up a uio with the buffer, its size, and the current offset */
-	uio_uinit(&iov, &useruio, buf, size, pos, rw);
+	if (posp == NULL) {
+		/* Only lock the seek position if we're really using it. */
+		locked = VOP_ISSEEKABLE(file->of_vnode);
+		if (locked) {
+			lock_acquire(file->of_offsetlock);
+			pos = file->of_offset;
+		}
+		else {
+			pos = 0;
+		}
+	}
+	else {
+		if (!VOP_ISSEEKABLE(file->of_vnode)) {
+			result = ESPIPE;
+			goto fail;
+		}
+		pos = *posp;
+		if (pos < 0) {
+			result = EINVAL;
+			goto fail;
+		}
+	}
+
+	/* set up a uio with the buffers, their size, and the current offset */
+	useruio.uio_iov = iov;
+	useruio.uio_iovcnt = iovcnt;
+	useruio.uio_offset = pos;
+	useruio.uio_resid = size;
+	useruio.uio_segflg = UIO_USERSPACE;
+	useruio.uio_rw = rw;
+	useruio.uio_space = proc_getas();
 
 	/* do the read or write */
 	result = (rw == UIO_READ) ?
@@ -183,7 +221,11 @@ fail:
 int
 sys_read(int fd, userptr_t buf, size_t size, int *retval)
 {
-	return sys_readwrite(fd, buf, size, UIO_READ, O_WRONLY, retval);
+	struct iovec iov;
+
+	iov.iov_ubase = buf;
+	iov.iov_len = size;
+	return sys_readwrite(fd, &iov, 1, NULL, UIO_READ, O_WRONLY, retval);
 }
 
 /*
@@ -192,7 +234,239 @@ sys_read(int fd, userptr_t buf, size_t size, int *retval)
 int
 sys_write(int fd, userptr_t buf, size_t size, int *retval)
 {
-	return sys_readwrite(fd, buf, size, UIO_WRITE, O_RDONLY, retval);
+	struct iovec iov;
+
+	iov.iov_ubase = buf;
+	iov.iov_len = size;
+	return sys_readwrite(fd, &iov, 1, NULL, UIO_WRITE, O_RDONLY,
+			     retval);
+}
+
+/*
+ * Number of iovecs readv and writev copy in on the stack; larger
+ * vectors are kmalloc'd.
+ */
+#define SMALL_IOVCNT 8
+
+/*
+ * Common logic for readv and writev: copy in the iovec array and
+ * use sys_readwrite.
+ */
+static
+int
+sys_readwritev(int fd, const_userptr_t uiov, int iovcnt, enum uio_rw rw,
+	       int badaccmode, ssize_t *retval)
+{
+	struct iovec smalliov[SMALL_IOVCNT], *iov;
+	int result;
+
+	if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+		return EINVAL;
+	}
+
+	if (iovcnt <= SMALL_IOVCNT) {
+		iov = smalliov;
+	}
+	else {
+		iov = kmalloc(iovcnt * sizeof(*iov));
+		if (iov == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	result = copyin(uiov, iov, iovcnt * sizeof(*iov));
+	if (result == 0) {
+		result = sys_readwrite(fd, iov, iovcnt, NULL, rw,
+				       badaccmode, retval);
+	}
+
+	if (iov != smalliov) {
+		kfree(iov);
+	}
+	return result;
+}
+
+/*
+ * readv() - use sys_readwritev
+ */
+int
+sys_readv(int fd, const_userptr_t iov, int iovcnt, int *retval)
+{
+	return sys_readwritev(fd, iov, iovcnt, UIO_READ, O_WRONLY, retval);
+}
+
+/*
+ * writev() - use sys_readwritev
+ */
+int
+sys_writev(int fd, const_userptr_t iov, int iovcnt, int *retval)
+{
+	return sys_readwritev(fd, iov, iovcnt, UIO_WRITE, O_RDONLY, retval);
+}
+
+/*
+ * pread() - use sys_readwrite with an explicit position
+ */
+int
+sys_pread(int fd, userptr_t buf, size_t size, off_t pos, int *retval)
+{
+	struct iovec iov;
+
+	iov.iov_ubase = buf;
+	iov.iov_len = size;
+	return sys_readwrite(fd, &iov, 1, &pos, UIO_READ, O_WRONLY, retval);
+}
+
+/*
+ * pwrite() - use sys_readwrite with an explicit position
+ */
+int
+sys_pwrite(int fd, userptr_t buf, size_t size, off_t pos, int *retval)
+{
+	struct iovec iov;
+
+	iov.iov_ubase = buf;
+	iov.iov_len = size;
+	return sys_readwrite(fd, &iov, 1, &pos, UIO_WRITE, O_RDONLY, retval);
+}
+
+/*
+ * Size of the kernel buffer sendfile copies through. If that much
+ * can't be had, it makes do with a page.
+ */
+#define SENDFILE_BUFSIZE (4 * PAGE_SIZE)
+
+/*
+ * sendfile() - copy up to COUNT bytes from INFD to OUTFD through a
+ * kernel buffer, starting at (and advancing) each file's seek
+ * position, like read and write. Stops early at end of file or on a
+ * short write; an error after some data has been copied just stops
+ * it early, too.
+ */
+int
+sys_sendfile(int outfd, int infd, size_t count, int *retval)
+{
+	struct openfile *in, *out, *locks[2];
+	bool inlocked, outlocked;
+	unsigned i, nlocks;
+	off_t inpos, outpos;
+	struct iovec iov;
+	struct uio ku;
+	char *buf;
+	size_t bufsize, copied, len, got, wrote;
+	int result;
+
+	/* the result has to fit in the (signed) return value */
+	if (count > ((size_t)-1 >> 1)) {
+		return EINVAL;
+	}
+
+	bufsize = SENDFILE_BUFSIZE;
+	buf = kmalloc(bufsize);
+	if (buf == NULL) {
+		bufsize = PAGE_SIZE;
+		buf = kmalloc(bufsize);
+		if (buf == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	result = filetable_get(curproc->p_filetable, infd, &in);
+	if (result) {
+		kfree(buf);
+		return result;
+	}
+	result = filetable_get(curproc->p_filetable, outfd, &out);
+	if (result) {
+		filetable_put(curproc->p_filetable, infd, in);
+		kfree(buf);
+		return result;
+	}
+
+	if (in == out) {
+		/* also, we'd deadlock on the offset lock */
+		result = EINVAL;
+		goto done;
+	}
+	if (in->of_accmode == O_WRONLY || out->of_accmode == O_RDONLY) {
+		result = EBADF;
+		goto done;
+	}
+
+	/*
+	 * Lock the seek positions we use, in address order so that two
+	 * sendfiles going opposite ways between the same files can't
+	 * deadlock.
+	 */
+	inlocked = VOP_ISSEEKABLE(in->of_vnode);
+	outlocked = VOP_ISSEEKABLE(out->of_vnode);
+	nlocks = 0;
+	if (inlocked) {
+		locks[nlocks++] = in;
+	}
+	if (outlocked) {
+		locks[nlocks++] = out;
+	}
+	if (nlocks == 2 && locks[1] < locks[0]) {
+		locks[0] = out;
+		locks[1] = in;
+	}
+	for (i=0; i<nlocks; i++) {
+		lock_acquire(locks[i]->of_offsetlock);
+	}
+	inpos = inlocked ? in->of_offset : 0;
+	outpos = outlocked ? out->of_offset : 0;
+
+	copied = 0;
+	while (copied < count) {
+		len = count - copied;
+		if (len > bufsize) {
+			len = bufsize;
+		}
+
+		uio_kinit(&iov, &ku, buf, len, inpos, UIO_READ);
+		result = VOP_READ(in->of_vnode, &ku);
+		if (result) {
+			break;
+		}
+		got = len - ku.uio_resid;
+		if (got == 0) {
+			/* EOF */
+			break;
+		}
+
+		uio_kinit(&iov, &ku, buf, got, outpos, UIO_WRITE);
+		result = VOP_WRITE(out->of_vnode, &ku);
+		wrote = got - ku.uio_resid;
+		inpos += wrote;
+		outpos += wrote;
+		copied += wrote;
+		if (result || wrote < got) {
+			/* leave the input at the first byte not written */
+			break;
+		}
+	}
+	if (copied > 0) {
+		result = 0;
+	}
+
+	if (inlocked) {
+		in->of_offset = inpos;
+	}
+	if (outlocked) {
+		out->of_offset = outpos;
+	}
+	for (i=nlocks; i-- > 0; ) {
+		lock_release(locks[i]->of_offsetlock);
+	}
+
+	*retval = copied;
+
+ done:
+	filetable_put(curproc->p_filetable, outfd, out);
+	filetable_put(curproc->p_filetable, infd, in);
+	kfree(buf);
+	return result;
 }
 
 /*
@@ -0,0 +1,219 @@
+/*
+ * Futexes: user-level synchronization with a kernel slow path.
+ *
+ * User code keeps its lock or condition state in an ordinary word of
+ * its own memory and gets and releases it with atomic instructions;
+ * it only calls in here to sleep when the word says it has to
+ * (FUTEX_WAIT) or to wake up sleepers (FUTEX_WAKE). So the kernel
+ * doesn't keep any state for a futex nobody is waiting on.
+ *
+ * Sleepers are kept in a fixed hash table of wait queues keyed on the
+ * address space and virtual address of the word. The bucket lock
+ * covers both reading the word and joining the queue in FUTEX_WAIT,
+ * which is what keeps a wakeup from slipping in between the two.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/futex.h>
+#include <lib.h>
+#include <synch.h>
+#include <proc.h>
+#include <current.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+#define FUTEX_BUCKETS	64
+
+/*
+ * One sleeping thread. Lives on the sleeper's stack; the waker takes
+ * it off the queue and sets fw_woken.
+ */
+struct futex_waiter {
+	struct futex_waiter *fw_next;
+	struct addrspace *fw_as;
+	vaddr_t fw_addr;
+	bool fw_woken;
+};
+
+/*
+ * A hash bucket. Everybody waiting in the bucket sleeps on the same
+ * CV and checks fw_woken on waking, so that the table doesn't need a
+ * CV per address. Collisions just cost an extra wakeup.
+ */
+struct futex_bucket {
+	struct lock *fb_lock;
+	struct cv *fb_cv;
+	struct futex_waiter *fb_waiters;	/* FIFO */
+};
+
+static struct futex_bucket futex_table[FUTEX_BUCKETS];
+
+/*
+ * Setup.
+ */
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_BUCKETS; i++) {
+		futex_table[i].fb_lock = lock_create("futex");
+		futex_table[i].fb_cv = cv_create("futex");
+		if (futex_table[i].fb_lock == NULL ||
+		    futex_table[i].fb_cv == NULL) {
+			panic("futex_bootstrap: Out of memory\n");
+		}
+		futex_table[i].fb_waiters = NULL;
+	}
+}
+
+static
+struct futex_bucket *
+futex_hash(struct addrspace *as, vaddr_t addr)
+{
+	uintptr_t hash;
+
+	hash = ((uintptr_t)as >> 4) ^ (addr >> 2);
+	return &futex_table[hash % FUTEX_BUCKETS];
+}
+
+/*
+ * FUTEX_WAIT. Note that reading the word may fault (and even page in
+ * from swap) with the bucket lock held; that only holds up other
+ * futex calls in the same bucket, and the fault path never comes back
+ * here, so it's safe.
+ */
+static
+int
+futex_wait(struct addrspace *as, userptr_t uaddr, int val)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter fw, **fwp;
+	int cur, result;
+
+	fb = futex_hash(as, (vaddr_t)uaddr);
+
+	lock_acquire(fb->fb_lock);
+	result = copyin((const_userptr_t)uaddr, &cur, sizeof(cur));
+	if (result) {
+		lock_release(fb->fb_lock);
+		return result;
+	}
+	if (cur != val) {
+		lock_release(fb->fb_lock);
+		return EAGAIN;
+	}
+	if (curproc->p_exiting) {
+		/* Exiting; futex_wakeall may already have been by. */
+		lock_release(fb->fb_lock);
+		return EINTR;
+	}
+
+	fw.fw_next = NULL;
+	fw.fw_as = as;
+	fw.fw_addr = (vaddr_t)uaddr;
+	fw.fw_woken = false;
+	for (fwp = &fb->fb_waiters; *fwp != NULL; fwp = &(*fwp)->fw_next) {
+		/* find the end */
+	}
+	*fwp = &fw;
+
+	while (!fw.fw_woken) {
+		cv_wait(fb->fb_cv, fb->fb_lock);
+	}
+	lock_release(fb->fb_lock);
+	return 0;
+}
+
+/*
+ * FUTEX_WAKE.
+ */
+static
+int
+futex_wake(struct addrspace *as, userptr_t uaddr, int val, int *retval)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter *fw, **fwp;
+	int woken;
+
+	if (val < 0) {
+		return EINVAL;
+	}
+
+	fb = futex_hash(as, (vaddr_t)uaddr);
+	woken = 0;
+
+	lock_acquire(fb->fb_lock);
+	fwp = &fb->fb_waiters;
+	while (*fwp != NULL && woken < val) {
+		fw = *fwp;
+		if (fw->fw_as == as && fw->fw_addr == (vaddr_t)uaddr) {
+			*fwp = fw->fw_next;
+			fw->fw_woken = true;
+			woken++;
+		}
+		else {
+			fwp = &fw->fw_next;
+		}
+	}
+	if (woken > 0) {
+		cv_broadcast(fb->fb_cv, fb->fb_lock);
+	}
+	lock_release(fb->fb_lock);
+
+	*retval = woken;
+	return 0;
+}
+
+void
+futex_wakeall(struct addrspace *as)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter *fw, **fwp;
+	unsigned i;
+	bool woken;
+
+	for (i=0; i<FUTEX_BUCKETS; i++) {
+		fb = &futex_table[i];
+		woken = false;
+
+		lock_acquire(fb->fb_lock);
+		fwp = &fb->fb_waiters;
+		while (*fwp != NULL) {
+			fw = *fwp;
+			if (fw->fw_as == as) {
+				*fwp = fw->fw_next;
+				fw->fw_woken = true;
+				woken = true;
+			}
+			else {
+				fwp = &fw->fw_next;
+			}
+		}
+		if (woken) {
+			cv_broadcast(fb->fb_cv, fb->fb_lock);
+		}
+		lock_release(fb->fb_lock);
+	}
+}
+
+int
+sys_futex(userptr_t uaddr, int op, int val, int *retval)
+{
+	struct addrspace *as;
+
+	if ((vaddr_t)uaddr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+	as = proc_getas();
+
+	*retval = 0;
+	switch (op) {
+	    case FUTEX_WAIT:
+		return futex_wait(as, uaddr, val);
+	    case FUTEX_WAKE:
+		return futex_wake(as, uaddr, val, retval);
+	}
+	return EINVAL;
+}
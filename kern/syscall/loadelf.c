@@ -48,11 +48,19 @@
  * To support dynamically linked executables with shared libraries
  * you'd need to change this to load the "ELF interpreter" (dynamic
  * linker). And you'd have to write a dynamic linker...
+ *
+ * The same few programs tend to get run over and over, so the parsed
+ * headers of recently run executables are cached, along with the
+ * first part of their text. Exec of one of those then doesn't need to
+ * read or check the headers again.
  */
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/stat.h>
 #include <lib.h>
+#include <spinlock.h>
+#include <membar.h>
 #include <uio.h>
 #include <proc.h>
 #include <current.h>
@@ -60,11 +68,472 @@
 #include <vnode.h>
 #include <elf.h>
 
+/*
+ * Cache sizing.
+ *
+ * ELFCACHE_SIZE     - number of executables remembered.
+ * ELFCACHE_MAXSEGS  - most loadable segments an executable may have.
+ * ELFCACHE_TEXTSIZE - how much of the start of the text to keep.
+ */
+#define ELFCACHE_SIZE		8
+#define ELFCACHE_MAXSEGS	8
+#define ELFCACHE_TEXTSIZE	(2 * PAGE_SIZE)
+
+/*
+ * A loadable segment.
+ */
+struct elfseg {
+	off_t es_offset;		/* Position in the file */
+	vaddr_t es_vaddr;		/* Load address */
+	size_t es_memsize;		/* Size in memory */
+	size_t es_filesize;		/* Size in the file */
+	uint32_t es_flags;		/* PF_R, PF_W, PF_X */
+};
+
+/*
+ * What we need to know to load an executable.
+ *
+ * The image holds a reference to the vnode, so it stays the same
+ * file and keeps its write counts while cached; a cached image is only
+ * used if no write has started since it was read (see vnode.h). The
+ * reference is given up when the file is removed or its filesystem
+ * unmounted. The contents are not changed once the image is built, so
+ * they can be used without locking. ei_refcount and ei_cached are
+ * protected by elfcache_lock.
+ */
+struct elfimage {
+	struct vnode *ei_vn;		/* File it came from */
+	off_t ei_size;			/* File's size */
+	int ei_wcount;			/* File's vn_wdone when read */
+	unsigned ei_refcount;		/* Loads in progress using it */
+	bool ei_cached;			/* Whether it's in elfcache[] */
+	unsigned ei_lastuse;		/* For picking what to replace */
+	vaddr_t ei_entrypoint;		/* Initial PC */
+	unsigned ei_nsegs;		/* Number of segments */
+	struct elfseg ei_segs[ELFCACHE_MAXSEGS];
+	unsigned ei_textseg;		/* Segment ei_text is the start of */
+	size_t ei_textlen;		/* Length of ei_text (may be 0) */
+	char *ei_text;			/* Copy of the start of the text */
+};
+
+static struct spinlock elfcache_lock = SPINLOCK_INITIALIZER;
+static struct elfimage *elfcache[ELFCACHE_SIZE];
+static unsigned elfcache_clock;
+
+/*
+ * Free an image.
+ */
+static
+void
+elfimage_destroy(struct elfimage *ei)
+{
+	if (ei->ei_text != NULL) {
+		kfree(ei->ei_text);
+	}
+	VOP_DECREF(ei->ei_vn);
+	kfree(ei);
+}
+
+/*
+ * Drop a reference to an image, destroying it if it's no longer
+ * cached either.
+ */
+static
+void
+elfimage_release(struct elfimage *ei)
+{
+	bool dead;
+
+	spinlock_acquire(&elfcache_lock);
+	KASSERT(ei->ei_refcount > 0);
+	ei->ei_refcount--;
+	dead = ei->ei_refcount == 0 && !ei->ei_cached;
+	spinlock_release(&elfcache_lock);
+
+	if (dead) {
+		elfimage_destroy(ei);
+	}
+}
+
+/*
+ * Take the image in slot SLOT out of the cache. Returns it if that
+ * means it should be destroyed, which the caller does after unlocking.
+ */
+static
+struct elfimage *
+elfcache_remove(unsigned slot)
+{
+	struct elfimage *ei;
+
+	KASSERT(spinlock_do_i_hold(&elfcache_lock));
+
+	ei = elfcache[slot];
+	elfcache[slot] = NULL;
+	ei->ei_cached = false;
+	return ei->ei_refcount == 0 ? ei : NULL;
+}
+
+/*
+ * Look for a cached image of file V, which currently has size SIZE and
+ * has had WCOUNT writes. Returns it with a reference, or NULL. A stale
+ * image of the same file is thrown out.
+ */
+static
+struct elfimage *
+elfcache_lookup(struct vnode *v, off_t size, int wcount)
+{
+	struct elfimage *ei, *dead = NULL;
+	unsigned i;
+
+	spinlock_acquire(&elfcache_lock);
+	for (i=0; i<ELFCACHE_SIZE; i++) {
+		ei = elfcache[i];
+		if (ei == NULL || ei->ei_vn != v) {
+			continue;
+		}
+		if (ei->ei_size == size && ei->ei_wcount == wcount) {
+			ei->ei_refcount++;
+			ei->ei_lastuse = ++elfcache_clock;
+			spinlock_release(&elfcache_lock);
+			return ei;
+		}
+		dead = elfcache_remove(i);
+		break;
+	}
+	spinlock_release(&elfcache_lock);
+
+	if (dead != NULL) {
+		elfimage_destroy(dead);
+	}
+	return NULL;
+}
+
+/*
+ * Add a newly read image to the cache, replacing the least recently
+ * used one if it's full. If someone else got there first, leave it
+ * out; it'll then go away when released.
+ */
+static
+void
+elfcache_insert(struct elfimage *ei)
+{
+	struct elfimage *dead = NULL;
+	unsigned i, victim;
+
+	spinlock_acquire(&elfcache_lock);
+	victim = 0;
+	for (i=0; i<ELFCACHE_SIZE; i++) {
+		if (elfcache[i] == NULL) {
+			victim = i;
+			continue;
+		}
+		if (elfcache[i]->ei_vn == ei->ei_vn) {
+			spinlock_release(&elfcache_lock);
+			return;
+		}
+		if (elfcache[victim] != NULL &&
+		    elfcache[i]->ei_lastuse < elfcache[victim]->ei_lastuse) {
+			victim = i;
+		}
+	}
+	if (elfcache[victim] != NULL) {
+		dead = elfcache_remove(victim);
+	}
+	elfcache[victim] = ei;
+	ei->ei_cached = true;
+	ei->ei_lastuse = ++elfcache_clock;
+	spinlock_release(&elfcache_lock);
+
+	if (dead != NULL) {
+		elfimage_destroy(dead);
+	}
+}
+
+/*
+ * Read from file V at OFFSET into kernel buffer BUF. WHAT is for the
+ * message if the file is too short.
+ */
+static
+int
+elf_read(struct vnode *v, off_t offset, void *buf, size_t len,
+	 const char *what)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, buf, len, offset, UIO_READ);
+	result = VOP_READ(v, &ku);
+	if (result) {
+		return result;
+	}
+
+	if (ku.uio_resid != 0) {
+		/* short read; problem with executable? */
+		kprintf("ELF: short read on %s - file truncated?\n", what);
+		return ENOEXEC;
+	}
+	return 0;
+}
+
+/*
+ * Read and check the headers of executable V, and the start of its
+ * text, into EI.
+ */
+static
+int
+elfimage_read(struct vnode *v, struct elfimage *ei)
+{
+	Elf_Ehdr eh;   /* Executable header */
+	Elf_Phdr ph;   /* "Program header" = segment header */
+	struct elfseg *es;
+	int result, i;
+
+	/*
+	 * Read the executable header from offset 0 in the file.
+	 */
+
+	result = elf_read(v, 0, &eh, sizeof(eh), "header");
+	if (result) {
+		return result;
+	}
+
+	/*
+	 * Check to make sure it's a 32-bit ELF-version-1 executable
+	 * for our processor type. If it's not, we can't run it.
+	 *
+	 * Ignore EI_OSABI and EI_ABIVERSION - properly, we should
+	 * define our own, but that would require tinkering with the
+	 * linker to have it emit our magic numbers instead of the
+	 * default ones. (If the linker even supports these fields,
+	 * which were not in the original elf spec.)
+	 */
+
+	if (eh.e_ident[EI_MAG0] != ELFMAG0 ||
+	    eh.e_ident[EI_MAG1] != ELFMAG1 ||
+	    eh.e_ident[EI_MAG2] != ELFMAG2 ||
+	    eh.e_ident[EI_MAG3] != ELFMAG3 ||
+	    eh.e_ident[EI_CLASS] != ELFCLASS32 ||
+	    eh.e_ident[EI_DATA] != ELFDATA2MSB ||
+	    eh.e_ident[EI_VERSION] != EV_CURRENT ||
+	    eh.e_version != EV_CURRENT ||
+	    eh.e_type!=ET_EXEC ||
+	    eh.e_machine!=EM_MACHINE) {
+		return ENOEXEC;
+	}
+
+	/*
+	 * Go through the list of segments and collect the loadable
+	 * ones.
+	 *
+	 * Ordinarily there will be one code segment, one read-only
+	 * data segment, and one data/bss segment, but there might
+	 * conceivably be more. More than ELFCACHE_MAXSEGS isn't
+	 * supported.
+	 *
+	 * Note that the expression eh.e_phoff + i*eh.e_phentsize is
+	 * mandated by the ELF standard - we use sizeof(ph) to load,
+	 * because that's the structure we know, but the file on disk
+	 * might have a larger structure, so we must use e_phentsize
+	 * to find where the phdr starts.
+	 */
+
+	ei->ei_nsegs = 0;
+	for (i=0; i<eh.e_phnum; i++) {
+		off_t offset = eh.e_phoff + i*eh.e_phentsize;
+
+		result = elf_read(v, offset, &ph, sizeof(ph), "phdr");
+		if (result) {
+			return result;
+		}
+
+		switch (ph.p_type) {
+		    case PT_NULL: /* skip */ continue;
+		    case PT_PHDR: /* skip */ continue;
+		    case PT_MIPS_REGINFO: /* skip */ continue;
+		    case PT_LOAD: break;
+		    default:
+			kprintf("loadelf: unknown segment type %d\n",
+				ph.p_type);
+			return ENOEXEC;
+		}
+
+		if (ei->ei_nsegs == ELFCACHE_MAXSEGS) {
+			kprintf("loadelf: too many segments\n");
+			return ENOEXEC;
+		}
+		es = &ei->ei_segs[ei->ei_nsegs++];
+		es->es_offset = ph.p_offset;
+		es->es_vaddr = ph.p_vaddr;
+		es->es_memsize = ph.p_memsz;
+		es->es_filesize = ph.p_filesz;
+		es->es_flags = ph.p_flags;
+
+		if (es->es_filesize > es->es_memsize) {
+			kprintf("ELF: warning: segment filesize > "
+				"segment memsize\n");
+			es->es_filesize = es->es_memsize;
+		}
+	}
+
+	ei->ei_entrypoint = eh.e_entry;
+
+	/*
+	 * Keep the start of the first executable segment. If there's
+	 * no memory for it, just go without.
+	 */
+
+	for (i=0; i<(int)ei->ei_nsegs; i++) {
+		es = &ei->ei_segs[i];
+		if ((es->es_flags & PF_X) == 0) {
+			continue;
+		}
+
+		ei->ei_textlen = es->es_filesize;
+		if (ei->ei_textlen > ELFCACHE_TEXTSIZE) {
+			ei->ei_textlen = ELFCACHE_TEXTSIZE;
+		}
+		ei->ei_text = kmalloc(ei->ei_textlen);
+		if (ei->ei_text == NULL) {
+			ei->ei_textlen = 0;
+			break;
+		}
+		ei->ei_textseg = i;
+
+		result = elf_read(v, es->es_offset, ei->ei_text,
+				  ei->ei_textlen, "segment");
+		if (result) {
+			return result;
+		}
+		break;
+	}
+
+	return 0;
+}
+
+/*
+ * Get the image of executable V, from the cache if possible. Returns
+ * it with a reference.
+ */
+static
+int
+elfimage_get(struct vnode *v, struct elfimage **ret)
+{
+	struct elfimage *ei;
+	struct stat st;
+	bool cacheable;
+	int wcount, result;
+
+	/*
+	 * Take the write count first, so a write that starts while we
+	 * read shows up. If one is already under way, don't use the
+	 * cache at all. Devices aren't counted, so never cache them.
+	 */
+	wcount = atomic_get(&v->vn_wdone);
+	membar_load_load();
+	cacheable = v->vn_fs != NULL && atomic_get(&v->vn_wstart) == wcount;
+
+	result = VOP_STAT(v, &st);
+	if (result) {
+		return result;
+	}
+
+	if (cacheable) {
+		ei = elfcache_lookup(v, st.st_size, wcount);
+		if (ei != NULL) {
+			*ret = ei;
+			return 0;
+		}
+	}
+
+	ei = kmalloc(sizeof(*ei));
+	if (ei == NULL) {
+		return ENOMEM;
+	}
+	VOP_INCREF(v);
+	ei->ei_vn = v;
+	ei->ei_size = st.st_size;
+	ei->ei_wcount = wcount;
+	ei->ei_refcount = 1;
+	ei->ei_cached = false;
+	ei->ei_lastuse = 0;
+	ei->ei_textseg = 0;
+	ei->ei_textlen = 0;
+	ei->ei_text = NULL;
+
+	result = elfimage_read(v, ei);
+	if (result) {
+		elfimage_destroy(ei);
+		return result;
+	}
+
+	/* The file's contents have to be read before the count is. */
+	membar_load_load();
+	if (cacheable && atomic_get(&v->vn_wstart) == wcount) {
+		elfcache_insert(ei);
+	}
+	*ret = ei;
+	return 0;
+}
+
+/*
+ * Throw out cached images of file V, or of any file on FS if V is
+ * NULL, so the cache doesn't keep them alive.
+ */
+static
+void
+elfcache_purge(struct vnode *v, struct fs *fs)
+{
+	struct elfimage *dead[ELFCACHE_SIZE];
+	struct elfimage *ei;
+	unsigned i, ndead = 0;
+
+	spinlock_acquire(&elfcache_lock);
+	for (i=0; i<ELFCACHE_SIZE; i++) {
+		ei = elfcache[i];
+		if (ei == NULL) {
+			continue;
+		}
+		if (v != NULL ? ei->ei_vn != v : ei->ei_vn->vn_fs != fs) {
+			continue;
+		}
+		ei = elfcache_remove(i);
+		if (ei != NULL) {
+			dead[ndead++] = ei;
+		}
+	}
+	spinlock_release(&elfcache_lock);
+
+	for (i=0; i<ndead; i++) {
+		elfimage_destroy(dead[i]);
+	}
+}
+
+/*
+ * Forget file V. Called when it's being removed.
+ */
+void
+elfcache_forget(struct vnode *v)
+{
+	elfcache_purge(v, NULL);
+}
+
+/*
+ * Forget every file on FS. Called before unmounting it.
+ */
+void
+elfcache_forgetfs(struct fs *fs)
+{
+	KASSERT(fs != NULL);
+	elfcache_purge(NULL, fs);
+}
+
 /*
  * Load a segment at virtual address VADDR. The segment in memory
  * extends from VADDR up to (but not including) VADDR+MEMSIZE. The
  * segment on disk is located at file offset OFFSET and has length
- * FILESIZE.
+ * FILESIZE. The first HEADLEN bytes of it are already in memory at
+ * HEAD, and are copied from there instead of being read.
  *
  * FILESIZE may be less than MEMSIZE; if so the remaining portion of
  * the in-memory segment should be zero-filled.
@@ -79,16 +548,17 @@ int
 load_segment(struct addrspace *as, struct vnode *v,
 	     off_t offset, vaddr_t vaddr,
 	     size_t memsize, size_t filesize,
+	     const char *head, size_t headlen,
 	     int is_executable)
 {
 	struct iovec iov;
 	struct uio u;
 	int result;
 
-	if (filesize > memsize) {
-		kprintf("ELF: warning: segment filesize > segment memsize\n");
-		filesize = memsize;
-	}
+	KASSERT(filesize <= memsize);
+	KASSERT(headlen <= filesize);
+
+	result = 0;
 
 	DEBUG(DB_EXEC, "ELF: Loading %lu bytes to 0x%lx\n",
 	      (unsigned long) filesize, (unsigned long) vaddr);
@@ -103,9 +573,18 @@ load_segment(struct addrspace *as, struct vnode *v,
 	u.uio_rw = UIO_READ;
 	u.uio_space = as;
 
-	result = VOP_READ(v, &u);
-	if (result) {
-		return result;
+	if (headlen > 0) {
+		result = uiomove((void *)head, headlen, &u);
+		if (result) {
+			return result;
+		}
+	}
+
+	if (u.uio_resid > 0) {
+		result = VOP_READ(v, &u);
+		if (result) {
+			return result;
+		}
 	}
 
 	if (u.uio_resid != 0) {
@@ -153,155 +632,73 @@ load_segment(struct addrspace *as, struct vnode *v,
 int
 load_elf(struct vnode *v, vaddr_t *entrypoint)
 {
-	Elf_Ehdr eh;   /* Executable header */
-	Elf_Phdr ph;   /* "Program header" = segment header */
-	int result, i;
-	struct iovec iov;
-	struct uio ku;
+	struct elfimage *ei;
+	struct elfseg *es;
 	struct addrspace *as;
+	const char *head;
+	size_t headlen;
+	unsigned i;
+	int result;
 
 	as = proc_getas();
 
-	/*
-	 * Read the executable header from offset 0 in the file.
-	 */
-
-	uio_kinit(&iov, &ku, &eh, sizeof(eh), 0, UIO_READ);
-	result = VOP_READ(v, &ku);
+	result = elfimage_get(v, &ei);
 	if (result) {
 		return result;
 	}
 
-	if (ku.uio_resid != 0) {
-		/* short read; problem with executable? */
-		kprintf("ELF: short read on header - file truncated?\n");
-		return ENOEXEC;
-	}
-
 	/*
-	 * Check to make sure it's a 32-bit ELF-version-1 executable
-	 * for our processor type. If it's not, we can't run it.
-	 *
-	 * Ignore EI_OSABI and EI_ABIVERSION - properly, we should
-	 * define our own, but that would require tinkering with the
-	 * linker to have it emit our magic numbers instead of the
-	 * default ones. (If the linker even supports these fields,
-	 * which were not in the original elf spec.)
+	 * Set up the address space.
 	 */
 
-	if (eh.e_ident[EI_MAG0] != ELFMAG0 ||
-	    eh.e_ident[EI_MAG1] != ELFMAG1 ||
-	    eh.e_ident[EI_MAG2] != ELFMAG2 ||
-	    eh.e_ident[EI_MAG3] != ELFMAG3 ||
-	    eh.e_ident[EI_CLASS] != ELFCLASS32 ||
-	    eh.e_ident[EI_DATA] != ELFDATA2MSB ||
-	    eh.e_ident[EI_VERSION] != EV_CURRENT ||
-	    eh.e_version != EV_CURRENT ||
-	    eh.e_type!=ET_EXEC ||
-	    eh.e_machine!=EM_MACHINE) {
-		return ENOEXEC;
-	}
-
-	/*
-	 * Go through the list of segments and set up the address space.
-	 *
-	 * Ordinarily there will be one code segment, one read-only
-	 * data segment, and one data/bss segment, but there might
-	 * conceivably be more. You don't need to support such files
-	 * if it's unduly awkward to do so.
-	 *
-	 * Note that the expression eh.e_phoff + i*eh.e_phentsize is
-	 * mandated by the ELF standard - we use sizeof(ph) to load,
-	 * because that's the structure we know, but the file on disk
-	 * might have a larger structure, so we must use e_phentsize
-	 * to find where the phdr starts.
-	 */
-
-	for (i=0; i<eh.e_phnum; i++) {
-		off_t offset = eh.e_phoff + i*eh.e_phentsize;
-		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
-
-		result = VOP_READ(v, &ku);
-		if (result) {
-			return result;
-		}
-
-		if (ku.uio_resid != 0) {
-			/* short read; problem with executable? */
-			kprintf("ELF: short read on phdr - file truncated?\n");
-			return ENOEXEC;
-		}
-
-		switch (ph.p_type) {
-		    case PT_NULL: /* skip */ continue;
-		    case PT_PHDR: /* skip */ continue;
-		    case PT_MIPS_REGINFO: /* skip */ continue;
-		    case PT_LOAD: break;
-		    default:
-			kprintf("loadelf: unknown segment type %d\n",
-				ph.p_type);
-			return ENOEXEC;
-		}
-
+	for (i=0; i<ei->ei_nsegs; i++) {
+		es = &ei->ei_segs[i];
 		result = as_define_region(as,
-					  ph.p_vaddr, ph.p_memsz,
-					  ph.p_flags & PF_R,
-					  ph.p_flags & PF_W,
-					  ph.p_flags & PF_X);
+					  es->es_vaddr, es->es_memsize,
+					  es->es_flags & PF_R,
+					  es->es_flags & PF_W,
+					  es->es_flags & PF_X);
 		if (result) {
-			return result;
+			goto done;
 		}
 	}
 
 	result = as_prepare_load(as);
 	if (result) {
-		return result;
+		goto done;
 	}
 
 	/*
 	 * Now actually load each segment.
 	 */
 
-	for (i=0; i<eh.e_phnum; i++) {
-		off_t offset = eh.e_phoff + i*eh.e_phentsize;
-		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
-
-		result = VOP_READ(v, &ku);
-		if (result) {
-			return result;
-		}
-
-		if (ku.uio_resid != 0) {
-			/* short read; problem with executable? */
-			kprintf("ELF: short read on phdr - file truncated?\n");
-			return ENOEXEC;
+	for (i=0; i<ei->ei_nsegs; i++) {
+		es = &ei->ei_segs[i];
+		if (i == ei->ei_textseg) {
+			head = ei->ei_text;
+			headlen = ei->ei_textlen;
 		}
-
-		switch (ph.p_type) {
-		    case PT_NULL: /* skip */ continue;
-		    case PT_PHDR: /* skip */ continue;
-		    case PT_MIPS_REGINFO: /* skip */ continue;
-		    case PT_LOAD: break;
-		    default:
-			kprintf("loadelf: unknown segment type %d\n",
-				ph.p_type);
-			return ENOEXEC;
+		else {
+			head = NULL;
+			headlen = 0;
 		}
-
-		result = load_segment(as, v, ph.p_offset, ph.p_vaddr,
-				      ph.p_memsz, ph.p_filesz,
-				      ph.p_flags & PF_X);
+		result = load_segment(as, v, es->es_offset, es->es_vaddr,
+				      es->es_memsize, es->es_filesize,
+				      head, headlen,
+				      es->es_flags & PF_X);
 		if (result) {
-			return result;
+			goto done;
 		}
 	}
 
 	result = as_complete_load(as);
 	if (result) {
-		return result;
+		goto done;
 	}
 
-	*entrypoint = eh.e_entry;
+	*entrypoint = ei->ei_entrypoint;
 
-	return 0;
+ done:
+	elfimage_release(ei);
+	return result;
 }
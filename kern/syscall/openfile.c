@@ -64,12 +64,10 @@ openfile_create(struct vnode *vn, int accmode)
 		return NULL;
 	}
 
-	spinlock_init(&file->of_reflock);
-
 	file->of_vnode = vn;
 	file->of_accmode = accmode;
 	file->of_offset = 0;
-	file->of_refcount = 1;
+	atomic_set(&file->of_refcount, 1);
 
 	return file;
 }
@@ -85,7 +83,6 @@ openfile_destroy(struct openfile *file)
 	/* balance vfs_open with vfs_close (not VOP_DECREF) */
 	vfs_close(file->of_vnode);
 
-	spinlock_cleanup(&file->of_reflock);
 	lock_destroy(file->of_offsetlock);
 	kfree(file);
 }
@@ -122,9 +119,7 @@ openfile_open(char *filename, int openflags, mode_t mode,
 void
 openfile_incref(struct openfile *file)
 {
-	spinlock_acquire(&file->of_reflock);
-	file->of_refcount++;
-	spinlock_release(&file->of_reflock);
+	atomic_inc(&file->of_refcount);
 }
 
 /*
@@ -134,16 +129,10 @@ openfile_incref(struct openfile *file)
 void
 openfile_decref(struct openfile *file)
 {
-	spinlock_acquire(&file->of_reflock);
+	KASSERT(atomic_get(&file->of_refcount) > 0);
 
 	/* if this is the last close of this file, free it up */
-	if (file->of_refcount == 1) {
-		spinlock_release(&file->of_reflock);
+	if (atomic_dec_and_test(&file->of_refcount)) {
 		openfile_destroy(file);
 	}
-	else {
-		KASSERT(file->of_refcount > 1);
-		file->of_refcount--;
-		spinlock_release(&file->of_reflock);
-	}
 }
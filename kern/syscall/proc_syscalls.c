@@ -33,13 +33,17 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <kern/wait.h>
 #include <lib.h>
 #include <machine/trapframe.h>
 #include <clock.h>
 #include <thread.h>
+#include <synch.h>
 #include <proc.h>
 #include <current.h>
+#include <addrspace.h>
 #include <copyinout.h>
 #include <pid.h>
 #include <syscall.h>
@@ -79,12 +83,13 @@ sys__exit(int status)
 
 static
 void
-fork_newthread(void *vtf, unsigned long junk)
+fork_newthread(void *vtf, unsigned long utid)
 {
 	struct trapframe mytf;
 	struct trapframe *ntf = vtf;
 
-	(void)junk;
+	/* We're the same thread as in the parent (see proc_fork). */
+	curthread->t_utid = utid;
 
 	/*
 	 * Now copy the trapframe to our stack, so we can free the one
@@ -98,8 +103,13 @@ fork_newthread(void *vtf, unsigned long junk)
 	enter_forked_process(&mytf);
 }
 
+/*
+ * Common code for fork and vfork. For vfork, VFORKSEM is passed on to
+ * proc_fork and the child borrows our address space.
+ */
+static
 int
-sys_fork(struct trapframe *tf, pid_t *retval)
+dofork(struct trapframe *tf, struct semaphore *vforksem, pid_t *retval)
 {
 	struct trapframe *ntf;
 	int result;
@@ -117,7 +127,7 @@ sys_fork(struct trapframe *tf, pid_t *retval)
 	}
 	*ntf = *tf;
 
-	result = proc_fork(&newproc);
+	result = proc_fork(vforksem, &newproc);
 	if (result) {
 		kfree(ntf);
 		return result;
@@ -125,7 +135,7 @@ sys_fork(struct trapframe *tf, pid_t *retval)
 	*retval = newproc->p_pid;
 
 	result = thread_fork(curthread->t_name, newproc,
-			     fork_newthread, ntf, 0);
+			     fork_newthread, ntf, curthread->t_utid);
 	if (result) {
 		proc_unfork(newproc);
 		kfree(ntf);
@@ -135,9 +145,43 @@ sys_fork(struct trapframe *tf, pid_t *retval)
 	return 0;
 }
 
+int
+sys_fork(struct trapframe *tf, pid_t *retval)
+{
+	return dofork(tf, NULL, retval);
+}
+
+/*
+ * sys_vfork
+ *
+ * Like fork, but the child runs in our address space, with us
+ * suspended, until it execs or exits. That saves copying the address
+ * space, which the child is almost always about to throw away. The
+ * other threads of the process, if any, keep running.
+ */
+int
+sys_vfork(struct trapframe *tf, pid_t *retval)
+{
+	struct semaphore *vforksem;
+	int result;
+
+	vforksem = sem_create("vfork", 0);
+	if (vforksem == NULL) {
+		return ENOMEM;
+	}
+
+	result = dofork(tf, vforksem, retval);
+	if (result == 0) {
+		/* Wait for our address space back. */
+		P(vforksem);
+	}
+	sem_destroy(vforksem);
+	return result;
+}
+
 /*
  * sys_waitpid
- * just pass off the work to the pid code.
+ * just pass off the work to the pid code. (pid may be WAIT_ANY.)
  */
 int
 sys_waitpid(pid_t pid, userptr_t retstatus, int flags, pid_t *retval)
@@ -150,8 +194,209 @@ sys_waitpid(pid_t pid, userptr_t retstatus, int flags, pid_t *retval)
 		return result;
 	}
 
-	if (retstatus != NULL) {
+	/* With WNOHANG and nobody done yet, there's no status. */
+	if (retstatus != NULL && *retval != 0) {
 		result = copyout(&status, retstatus, sizeof(int));
 	}
 	return result;
 }
+
+/*
+ * sys_getpriority, sys_setpriority
+ *
+ * The priority is the niceness used by the scheduler. We have no
+ * credentials and no way to find another process by pid, so only the
+ * calling process can be looked at or changed. Out-of-range values
+ * are clamped, as in Unix.
+ */
+static
+int
+priority_checkwho(int which, int who)
+{
+	if (which != PRIO_PROCESS) {
+		return EINVAL;
+	}
+	if (who != 0 && who != curproc->p_pid) {
+		return EPERM;
+	}
+	return 0;
+}
+
+int
+sys_getpriority(int which, int who, int *retval)
+{
+	int result;
+
+	result = priority_checkwho(which, who);
+	if (result) {
+		return result;
+	}
+	*retval = curthread->t_nice;
+	return 0;
+}
+
+int
+sys_setpriority(int which, int who, int prio)
+{
+	int result;
+
+	result = priority_checkwho(which, who);
+	if (result) {
+		return result;
+	}
+	if (prio < PRIO_MIN) {
+		prio = PRIO_MIN;
+	}
+	if (prio > PRIO_MAX) {
+		prio = PRIO_MAX;
+	}
+	proc_setnice(curproc, prio);
+	return 0;
+}
+
+/*
+ * sys_getrusage
+ *
+ * Only the scheduler accounting is kept: cpu time, split between user
+ * and kernel mode, and context switches. The rest reads as zero. Run
+ * queue waiting time has no place in struct rusage; see ps in the
+ * kernel menu for that.
+ */
+static
+void
+ticks_to_timeval(unsigned ticks, struct timeval *tv)
+{
+	tv->tv_sec = ticks / HZ;
+	tv->tv_usec = (ticks % HZ) * (1000000 / HZ);
+}
+
+int
+sys_getrusage(int who, userptr_t usage)
+{
+	struct schedstats ss;
+	struct rusage ru;
+
+	if (who != RUSAGE_SELF && who != RUSAGE_CHILDREN) {
+		return EINVAL;
+	}
+	proc_getstats(curproc, who == RUSAGE_CHILDREN, &ss);
+
+	bzero(&ru, sizeof(ru));
+	ticks_to_timeval(ss.ss_uticks, &ru.ru_utime);
+	ticks_to_timeval(ss.ss_sticks, &ru.ru_stime);
+	ru.ru_nvcsw = ss.ss_nvcsw;
+	ru.ru_nivcsw = ss.ss_nivcsw;
+
+	return copyout(&ru, usage, sizeof(ru));
+}
+
+/*
+ * sys___thread_create
+ *
+ * Start a new thread in the current process, running ENTRY(FUNC, ARG)
+ * on a stack of its own. ENTRY is the libc wrapper that calls FUNC
+ * and passes what it returns to thread_exit, so the kernel doesn't
+ * need to know how to return from FUNC. Returns the new thread id.
+ */
+
+struct thread_start {
+	vaddr_t ts_entry;
+	userptr_t ts_func;
+	userptr_t ts_arg;
+	vaddr_t ts_stack;
+};
+
+static
+void
+thread_newthread(void *vts, unsigned long utid)
+{
+	struct thread_start *ts = vts;
+	struct thread_start myts;
+
+	curthread->t_utid = utid;
+	myts = *ts;
+	kfree(ts);
+
+	/* Don't start if the process is on its way out. */
+	proc_checkexit();
+
+	enter_new_thread(myts.ts_func, myts.ts_arg, myts.ts_stack,
+			 myts.ts_entry);
+}
+
+int
+sys___thread_create(userptr_t entry, userptr_t func, userptr_t arg,
+		    int *retval)
+{
+	struct thread_start *ts;
+	unsigned utid;
+	int result;
+
+	ts = kmalloc(sizeof(*ts));
+	if (ts == NULL) {
+		return ENOMEM;
+	}
+	ts->ts_entry = (vaddr_t)entry;
+	ts->ts_func = func;
+	ts->ts_arg = arg;
+
+	/* Skip slots taken up by a long argv on the main stack. */
+	result = proc_newthread(as_first_threadstack(proc_getas()), &utid);
+	if (result) {
+		kfree(ts);
+		return result;
+	}
+
+	result = as_define_threadstack(proc_getas(), utid, &ts->ts_stack);
+	if (result) {
+		proc_unnewthread(utid);
+		kfree(ts);
+		return result;
+	}
+
+	result = thread_fork(curthread->t_name, curproc,
+			     thread_newthread, ts, utid);
+	if (result) {
+		proc_unnewthread(utid);
+		kfree(ts);
+		return result;
+	}
+
+	*retval = utid;
+	return 0;
+}
+
+/*
+ * sys_thread_exit
+ * The last thread to exit takes the process with it, with status 0.
+ */
+__DEAD
+void
+sys_thread_exit(userptr_t value)
+{
+	proc_threadexit(value);
+}
+
+/*
+ * sys_thread_join
+ */
+int
+sys_thread_join(int tid, userptr_t valuep)
+{
+	userptr_t value;
+	int result;
+
+	if (tid < 0) {
+		return ESRCH;
+	}
+
+	result = proc_threadjoin(tid, &value);
+	if (result) {
+		return result;
+	}
+
+	if (valuep != NULL) {
+		result = copyout(&value, valuep, sizeof(value));
+	}
+	return result;
+}
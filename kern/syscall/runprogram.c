@@ -36,10 +36,14 @@
 #include <kern/errno.h>
 #include <kern/fcntl.h>
 #include <kern/unistd.h>
+#include <kern/wait.h>
+#include <kern/spawn.h>
 #include <limits.h>
 #include <lib.h>
 #include <proc.h>
+#include <pid.h>
 #include <current.h>
+#include <thread.h>
 #include <synch.h>
 #include <copyinout.h>
 #include <addrspace.h>
@@ -55,11 +59,19 @@
  *
  * This is an abstraction that holds an argv while it's being shuffled
  * through the kernel during exec.
+ *
+ * The strings are packed end to end into whole pages, which become the
+ * top of the new program's stack: argbuf_copyout maps them there
+ * rather than copying them a second time. So the only copy is the one
+ * in from the old image (or the menu). Small argvs, the usual case,
+ * fit in one page.
  */
+#define ARG_PAGES (ARG_MAX / PAGE_SIZE)
+
 struct argbuf {
-    char* data;
+    vaddr_t pages[ARG_PAGES];   /* kernel addresses; 0 once mapped */
+    unsigned npages;
     size_t len;
-    size_t max;
     int nargs;
     bool tooksem;
 };
@@ -87,9 +99,8 @@ void exec_bootstrap(void) {
  */
 static void
 argbuf_init(struct argbuf* buf) {
-    buf->data = NULL;
+    buf->npages = 0;
     buf->len = 0;
-    buf->max = 0;
     buf->nargs = 0;
     buf->tooksem = false;
 }
@@ -99,12 +110,15 @@ argbuf_init(struct argbuf* buf) {
  */
 static void
 argbuf_cleanup(struct argbuf* buf) {
-    if (buf->data != NULL) {
-        kfree(buf->data);
-        buf->data = NULL;
+    unsigned i;
+
+    for (i = 0; i < buf->npages; i++) {
+        if (buf->pages[i] != 0) {
+            free_kpages(buf->pages[i]);
+        }
     }
+    buf->npages = 0;
     buf->len = 0;
-    buf->max = 0;
     buf->nargs = 0;
     if (buf->tooksem) {
         V(execthrottle);
@@ -113,15 +127,48 @@ argbuf_cleanup(struct argbuf* buf) {
 }
 
 /*
- * Allocate the memory for an argv buffer.
+ * Add another page to an argv buffer. Going past the first page
+ * counts as a large buffer and waits on the throttle.
  */
 static int
-argbuf_allocate(struct argbuf* buf, size_t size) {
-    buf->data = kmalloc(size);
-    if (buf->data == NULL) {
+argbuf_addpage(struct argbuf* buf) {
+    vaddr_t page;
+
+    if (buf->npages == ARG_PAGES) {
+        return E2BIG;
+    }
+    if (buf->npages > 0 && !buf->tooksem) {
+        P(execthrottle);
+        buf->tooksem = true;
+    }
+
+    page = alloc_user_page();
+    if (page == 0) {
         return ENOMEM;
     }
-    buf->max = size;
+    buf->pages[buf->npages++] = page;
+    return 0;
+}
+
+/*
+ * Return the kernel address of the next free byte in an argv buffer,
+ * and how much room there is after it in the same page, adding a page
+ * if the last one is full.
+ */
+static int
+argbuf_space(struct argbuf* buf, char** ptr, size_t* room) {
+    size_t offset;
+    int result;
+
+    if (buf->len == buf->npages * PAGE_SIZE) {
+        result = argbuf_addpage(buf);
+        if (result) {
+            return result;
+        }
+    }
+    offset = buf->len % PAGE_SIZE;
+    *ptr = (char*)buf->pages[buf->len / PAGE_SIZE] + offset;
+    *room = PAGE_SIZE - offset;
     return 0;
 }
 
@@ -133,17 +180,24 @@ argbuf_allocate(struct argbuf* buf, size_t size) {
  */
 static int
 argbuf_fromkernel(struct argbuf* buf, const char* progname) {
-    size_t len;
+    size_t len, room;
+    char* ptr;
     int result;
 
     len = strlen(progname) + 1;
-
-    result = argbuf_allocate(buf, len);
-    if (result) {
-        return result;
+    while (len > 0) {
+        result = argbuf_space(buf, &ptr, &room);
+        if (result) {
+            return result;
+        }
+        if (room > len) {
+            room = len;
+        }
+        memcpy(ptr, progname, room);
+        progname += room;
+        buf->len += room;
+        len -= room;
     }
-    strcpy(buf->data, progname);
-    buf->len = len;
     buf->nargs = 1;
 
     return 0;
@@ -155,7 +209,8 @@ argbuf_fromkernel(struct argbuf* buf, const char* progname) {
 static int
 argbuf_copyin(struct argbuf* buf, userptr_t uargv) {
     userptr_t thisarg;
-    size_t thisarglen;
+    size_t thisarglen, room;
+    char* ptr;
     int result;
 
     /* loop through the argv, grabbing each arg string */
@@ -175,12 +230,24 @@ argbuf_copyin(struct argbuf* buf, userptr_t uargv) {
             break;
         }
 
-        /* Use the pointer to fetch the argument string. */
-        result = copyinstr(thisarg, buf->data + buf->len,
-                           buf->max - buf->len, &thisarglen);
-        if (result == ENAMETOOLONG) {
-            return E2BIG;
-        } else if (result) {
+        /*
+         * Use the pointer to fetch the argument string. If it
+         * runs off the end of the page, take what fit and carry
+         * on in the next one.
+         */
+        while (1) {
+            result = argbuf_space(buf, &ptr, &room);
+            if (result) {
+                return result;
+            }
+            result = copyinstr(thisarg, ptr, room, &thisarglen);
+            if (result != ENAMETOOLONG) {
+                break;
+            }
+            buf->len += room;
+            thisarg += room;
+        }
+        if (result) {
             return result;
         }
 
@@ -198,102 +265,87 @@ argbuf_copyin(struct argbuf* buf, userptr_t uargv) {
  */
 static int
 argbuf_fromuser(struct argbuf* buf, userptr_t uargv) {
-    int result;
-
-    /* try with a small buffer */
-    result = argbuf_allocate(buf, PAGE_SIZE);
-    if (result) {
-        return result;
-    }
-
-    /* do the copyin */
-    result = argbuf_copyin(buf, uargv);
-    if (result == E2BIG) {
-        /*
-         * Try again with the full-size buffer. Just start
-         * over instead of trying to keep the page we already
-         * did; this is a bit inefficient but it's not that
-         * important.
-         */
-        argbuf_cleanup(buf);
-        argbuf_init(buf);
-
-        /* Wait on the semaphore, to throttle this allocation */
-        P(execthrottle);
-        buf->tooksem = true;
-
-        result = argbuf_allocate(buf, ARG_MAX);
-        if (result) {
-            return result;
-        }
-
-        result = argbuf_copyin(buf, uargv);
-    }
-    return result;
+    return argbuf_copyin(buf, uargv);
 }
 
 /*
- * Copy an argv out of kernel space to user space.
+ * Hand an argv over to the new process: build the argv pointer array
+ * just below the strings, then map the pages holding the strings in
+ * as the top of the stack.
  *
  * Note: ustackp is an in/out argument.
  */
 static int
 argbuf_copyout(struct argbuf* buf, vaddr_t* ustackp, int* argc_ret, userptr_t* uargv_ret) {
+    userptr_t ptrs[32];
     vaddr_t ustack;
     userptr_t ustringbase, uargvbase, uargv_i;
-    userptr_t thisarg;
-    size_t thisarglen;
-    size_t pos;
+    const char* str;
+    size_t pos, n;
+    unsigned i;
     int result;
 
-    /* Begin the stack at the passed in top. */
-    ustack = *ustackp;
-
-    /*
-     * Allocate space.
-     *
-     * buf->pos is the amount of space used by the strings; put that
-     * first, then align the stack, then make space for the argv
-     * pointers. Allow an extra slot for the ending NULL.
-     */
-
-    ustack -= buf->len;
-    ustack -= (ustack & (sizeof(void*) - 1));
+    /* The strings' pages go right at the top of the stack. */
+    KASSERT(*ustackp == USERSTACK);
+    ustack = USERSTACK - buf->npages * PAGE_SIZE;
     ustringbase = (userptr_t)ustack;
 
+    /* Make space for the argv pointers, with an extra slot for the NULL. */
     ustack -= (buf->nargs + 1) * sizeof(userptr_t);
     uargvbase = (userptr_t)ustack;
 
-    /* Now copy the data out. */
+    /* Leave at least the usual amount of stack below all that. */
+    result = as_grow_stack(proc_getas(), ustack - STACK_SIZE);
+    if (result) {
+        return result;
+    }
+
+    /*
+     * Find the start of each string and write out the pointers, a
+     * batch at a time. This has to be done while the pages are still
+     * ours, as once they're mapped they can be paged out.
+     */
     pos = 0;
+    n = 0;
     uargv_i = uargvbase;
     while (pos < buf->len) {
         /* The user address of the string will be ustringbase + pos. */
-        thisarg = ustringbase + pos;
-
-        /* Place it in the argv array. */
-        result = copyout(&thisarg, uargv_i, sizeof(thisarg));
-        if (result) {
-            return result;
+        ptrs[n++] = ustringbase + pos;
+
+        /* Skip over it. */
+        do {
+            str = (const char*)buf->pages[pos / PAGE_SIZE];
+        } while (str[pos++ % PAGE_SIZE] != 0);
+
+        if (n == sizeof(ptrs) / sizeof(ptrs[0]) || pos == buf->len) {
+            result = copyout(ptrs, uargv_i, n * sizeof(userptr_t));
+            if (result) {
+                return result;
+            }
+            uargv_i += n * sizeof(userptr_t);
+            n = 0;
         }
-
-        /* Push out the string. */
-        result = copyoutstr(buf->data + pos, thisarg,
-                            buf->len - pos, &thisarglen);
-        if (result) {
-            return result;
-        }
-
-        /* thisarglen includes the \0 */
-        pos += thisarglen;
-        uargv_i += sizeof(thisarg);
     }
     /* Should have come out even... */
     KASSERT(pos == buf->len);
+    KASSERT(uargv_i == uargvbase + buf->nargs * sizeof(userptr_t));
 
     /* Add the NULL. */
-    thisarg = NULL;
-    result = copyout(&thisarg, uargv_i, sizeof(userptr_t));
+    ptrs[0] = NULL;
+    result = copyout(ptrs, uargv_i, sizeof(userptr_t));
+    if (result) {
+        return result;
+    }
+
+    /* Don't hand the process whatever was in the rest of the last page. */
+    if (buf->len % PAGE_SIZE != 0) {
+        i = buf->len / PAGE_SIZE;
+        bzero((char*)buf->pages[i] + buf->len % PAGE_SIZE,
+              PAGE_SIZE - buf->len % PAGE_SIZE);
+    }
+
+    /* Now put the strings in place. */
+    result = as_define_stackpages(proc_getas(), buf->pages, buf->npages);
     if (result) {
         return result;
     }
@@ -371,7 +423,10 @@ loadexec(char* path, vaddr_t* entrypoint, vaddr_t* stackptr) {
      * Note: once this is done, execv() must not fail, because there's
      * nothing left for it to return an error to.
      */
-    if (oldvm) {
+    if (curproc->p_vforksem != NULL) {
+        /* It was borrowed from our vfork parent; give it back. */
+        proc_vforkdone();
+    } else if (oldvm) {
         as_destroy(oldvm);
     }
 
@@ -520,7 +575,7 @@ int runprogram(char* progname) {
  *
  * 1. Copy in the program name.
  * 2. Copy in the argv with copyin_args.
- * 3. Load the executable.
+ * 3. Get rid of any other threads, and load the executable.
  * 4. Copy the argv out again with copyout_args.
  * 5. Warp to usermode.
  */
@@ -554,6 +609,12 @@ int sys_execv(userptr_t prog, userptr_t uargv) {
         return result;
     }
 
+    /*
+     * Other threads have to go before their address space does.
+     * (If the exec then fails, they stay gone.)
+     */
+    proc_killthreads();
+
     /* Load the executable. Note: must not fail after this succeeds. */
     result = loadexec(path, &entrypoint, &stackptr);
     if (result) {
@@ -562,6 +623,9 @@ int sys_execv(userptr_t prog, userptr_t uargv) {
         return result;
     }
 
+    /* We're the main thread of the new program. */
+    proc_threadexec();
+
     /* don't need this any more */
     kfree(path);
 
@@ -582,3 +646,198 @@ int sys_execv(userptr_t prog, userptr_t uargv) {
     panic("enter_new_process returned\n");
     return EINVAL;
 }
+
+/*
+ * spawn.
+ *
+ * This is fork and execv in one go, without copying the caller's
+ * address space only to throw it away again. The new process gets a
+ * copy of the file table, which the file actions are applied to; then
+ * its thread loads the program. The caller waits until the load has
+ * finished, so that exec errors (no such file, bad executable, etc.)
+ * come back from spawn itself rather than as an exit status.
+ */
+
+struct spawninfo {
+    char* path;
+    struct argbuf* argv;
+    struct semaphore* done;
+    int result;
+};
+
+/*
+ * Carry out the file actions on the new process's file table. We
+ * have the only reference to the table, so nothing can change under
+ * us, but use the usual interface anyway.
+ */
+static int
+spawn_fileactions(struct filetable* ft, const struct spawn_action* actions, int nactions) {
+    struct openfile *file, *oldfile;
+    int i, result;
+
+    for (i = 0; i < nactions; i++) {
+        if (ft == NULL) {
+            return EBADF;
+        }
+        switch (actions[i].sa_op) {
+        case SPAWN_DUP2:
+            if (!filetable_okfd(ft, actions[i].sa_newfd)) {
+                return EBADF;
+            }
+            result = filetable_get(ft, actions[i].sa_fd, &file);
+            if (result) {
+                return result;
+            }
+            openfile_incref(file);
+            filetable_put(ft, actions[i].sa_fd, file);
+            filetable_placeat(ft, file, actions[i].sa_newfd, &oldfile);
+            if (oldfile != NULL) {
+                openfile_decref(oldfile);
+            }
+            break;
+        case SPAWN_CLOSE:
+            if (!filetable_okfd(ft, actions[i].sa_fd)) {
+                return EBADF;
+            }
+            filetable_placeat(ft, NULL, actions[i].sa_fd, &oldfile);
+            if (oldfile == NULL) {
+                return EBADF;
+            }
+            openfile_decref(oldfile);
+            break;
+        default:
+            return EINVAL;
+        }
+    }
+    return 0;
+}
+
+/*
+ * First function run by the new process's thread.
+ */
+static void
+spawn_newthread(void* data, unsigned long unused) {
+    struct spawninfo* si = data;
+    vaddr_t entrypoint, stackptr;
+    int argc;
+    userptr_t uargv;
+    int result;
+
+    (void)unused;
+
+    result = loadexec(si->path, &entrypoint, &stackptr);
+    if (result == 0) {
+        result = argbuf_copyout(si->argv, &stackptr, &argc, &uargv);
+        if (result) {
+            /* If copyout fails, *we* messed up, so panic */
+            panic("spawn: copyout_args failed: %s\n", strerror(result));
+        }
+    }
+
+    /* Report back. After this SI belongs to the parent again. */
+    si->result = result;
+    V(si->done);
+
+    if (result) {
+        /* The parent collects our exit status and returns RESULT. */
+        proc_exit(_MKWAIT_EXIT(255));
+        thread_exit();
+    }
+
+    /* Warp to user mode. */
+    enter_new_process(argc, uargv, NULL /*uenv*/, stackptr, entrypoint);
+
+    /* enter_new_process does not return. */
+    panic("enter_new_process returned\n");
+}
+
+int sys_spawn(userptr_t prog, userptr_t uargv, userptr_t uactions, int nactions, pid_t* retval) {
+    struct spawninfo si;
+    struct argbuf kargv;
+    struct spawn_action* actions;
+    struct proc* newproc;
+    pid_t pid, waitedpid;
+    int status;
+    int result;
+
+    if (nactions < 0 || nactions > SPAWN_MAXACTIONS) {
+        return EINVAL;
+    }
+
+    si.path = kmalloc(PATH_MAX);
+    if (si.path == NULL) {
+        return ENOMEM;
+    }
+    result = copyinstr(prog, si.path, PATH_MAX, NULL);
+    if (result) {
+        kfree(si.path);
+        return result;
+    }
+
+    actions = NULL;
+    if (nactions > 0) {
+        actions = kmalloc(nactions * sizeof(*actions));
+        if (actions == NULL) {
+            kfree(si.path);
+            return ENOMEM;
+        }
+        result = copyin(uactions, actions, nactions * sizeof(*actions));
+        if (result) {
+            kfree(actions);
+            kfree(si.path);
+            return result;
+        }
+    }
+
+    argbuf_init(&kargv);
+    result = argbuf_fromuser(&kargv, uargv);
+    if (result) {
+        goto fail;
+    }
+    si.argv = &kargv;
+
+    si.done = sem_create("spawn", 0);
+    if (si.done == NULL) {
+        result = ENOMEM;
+        goto fail;
+    }
+
+    /* Name the process now; loadexec may destroy the path. */
+    result = proc_spawn(si.path, &newproc);
+    if (result) {
+        goto fail_sem;
+    }
+    pid = newproc->p_pid;
+
+    result = spawn_fileactions(newproc->p_filetable, actions, nactions);
+    if (result) {
+        proc_unfork(newproc);
+        goto fail_sem;
+    }
+
+    result = thread_fork(si.path, newproc, spawn_newthread, &si, 0);
+    if (result) {
+        proc_unfork(newproc);
+        goto fail_sem;
+    }
+
+    /* Wait for the program to be loaded. */
+    P(si.done);
+    result = si.result;
+    if (result) {
+        /* It's exiting; reap it. */
+        pid_wait(pid, &status, 0, &waitedpid);
+    } else {
+        *retval = pid;
+    }
+
+fail_sem:
+    sem_destroy(si.done);
+fail:
+    argbuf_cleanup(&kargv);
+    if (actions != NULL) {
+        kfree(actions);
+    }
+    kfree(si.path);
+    return result;
+}
@@ -10,7 +10,7 @@
 #include <pagetable.h>
 
 static void free_heap_pages(struct addrspace *as, vaddr_t new_end, vaddr_t old_end) {
-    KASSERT(lock_do_i_hold(as->as_lock));
+    KASSERT(rwlock_do_i_hold_write(as->as_lock));
     KASSERT(new_end < old_end);
 
     vaddr_t start_page = ROUNDUP(new_end, PAGE_SIZE);
@@ -24,7 +24,17 @@ static void free_heap_pages(struct addrspace *as, vaddr_t new_end, vaddr_t old_e
             continue;
         }
 
+        /*
+         * Other threads of the process may have it in the TLB on
+         * other cpus; the frame can't be reused until they've all
+         * let go of it.
+         */
         if (entry->in_mem) {
+            struct tlbshootdown tlb;
+            tlb.vaddr = vaddr;
+            vm_tlbshootdown(&tlb);
+            ipi_tlbshootdown_broadcast(&tlb);
+
             paddr_t paddr = PPAGE_TO_PADDR(entry->ppn);
             free_kpages(PADDR_TO_KVADDR(paddr));
         }
@@ -35,10 +45,6 @@ static void free_heap_pages(struct addrspace *as, vaddr_t new_end, vaddr_t old_e
         entry->valid = false;
         entry->in_mem = false;
         entry->swap_offset = SWAP_OFFSET_NONE;
-
-        struct tlbshootdown tlb;
-        tlb.vaddr = vaddr;
-        vm_tlbshootdown(&tlb);
     }
 }
 
@@ -49,20 +55,20 @@ int sys_sbrk(ssize_t amount, int *retval) {
         return EFAULT;
     }
 
-    lock_acquire(as->as_lock);
+    rwlock_acquire_write(as->as_lock);
 
     vaddr_t old_heap_end = as->heap_end;
     vaddr_t new_heap_end = old_heap_end + amount;
 
     if (amount == 0) {
         *retval = (int)old_heap_end;
-        lock_release(as->as_lock);
+        rwlock_release_write(as->as_lock);
         return 0;
     }
 
     if (amount < 0) {
         if (new_heap_end < as->heap_start) {
-            lock_release(as->as_lock);
+            rwlock_release_write(as->as_lock);
             return EINVAL;
         }
 
@@ -70,7 +76,7 @@ int sys_sbrk(ssize_t amount, int *retval) {
 
         as->heap_end = new_heap_end;
         *retval = (int)old_heap_end;
-        lock_release(as->as_lock);
+        rwlock_release_write(as->as_lock);
         return 0;
     }
 
@@ -79,13 +85,13 @@ int sys_sbrk(ssize_t amount, int *retval) {
 
     /* Check if heap collides with stack */
     if (new_heap_top >= as->stack_base) {
-        lock_release(as->as_lock);
+        rwlock_release_write(as->as_lock);
         return ENOMEM;
     }
 
     as->heap_end = new_heap_end;
     *retval = (int)old_heap_end;
 
-    lock_release(as->as_lock);
+    rwlock_release_write(as->as_lock);
     return 0;
 }
@@ -32,10 +32,15 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <kern/wait.h>
 #include <lib.h>
 #include <clock.h>
 #include <thread.h>
+#include <current.h>
+#include <spinlock.h>
 #include <synch.h>
 #include <test.h>
 
@@ -400,3 +405,585 @@ cvtest2(int nargs, char **args)
 	kprintf("cvtest2 done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Reader-writer lock test.
+ *
+ * Writers update testval1 and testval2 in two steps with a delay in
+ * between; readers check that they never see the two differ, and
+ * writers check that no reader is inside with them. We also keep
+ * track of how many readers were in at once, which should be more
+ * than one on a multiprocessor.
+ */
+
+#define NRWLOOPS	60
+#define RWWRITEREVERY	4	/* every fourth thread is a writer */
+
+static struct rwlock *testrw;
+static struct spinlock rwstat_lock = SPINLOCK_INITIALIZER;
+static unsigned rwreaders;
+static unsigned rwmaxreaders;
+static volatile bool rwfailed;
+
+static
+void
+rwdelay(void)
+{
+	volatile int j;
+
+	for (j=0; j<500; j++);
+}
+
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	int i;
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		if (num % RWWRITEREVERY == 0) {
+			rwlock_acquire_write(testrw);
+			if (rwreaders != 0) {
+				kprintf("thread %lu: writer shares the lock "
+					"with %u readers\n", num, rwreaders);
+				rwfailed = true;
+			}
+			testval1 = num;
+			rwdelay();
+			testval2 = num;
+			rwlock_release_write(testrw);
+		}
+		else {
+			rwlock_acquire_read(testrw);
+			spinlock_acquire(&rwstat_lock);
+			rwreaders++;
+			if (rwreaders > rwmaxreaders) {
+				rwmaxreaders = rwreaders;
+			}
+			spinlock_release(&rwstat_lock);
+
+			if (testval1 != testval2) {
+				kprintf("thread %lu: reader saw a partial "
+					"write\n", num);
+				rwfailed = true;
+			}
+			rwdelay();
+
+			spinlock_acquire(&rwstat_lock);
+			rwreaders--;
+			spinlock_release(&rwstat_lock);
+			rwlock_release_read(testrw);
+		}
+	}
+	V(donesem);
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	if (testrw == NULL) {
+		testrw = rwlock_create("testrw");
+		if (testrw == NULL) {
+			panic("rwtest: rwlock_create failed\n");
+		}
+	}
+	kprintf("Starting rwlock test...\n");
+
+	testval1 = testval2 = 0;
+	rwreaders = rwmaxreaders = 0;
+	rwfailed = false;
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("rwtest", NULL, rwtestthread, NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	kprintf("At most %u readers held the lock at once\n", rwmaxreaders);
+	if (rwfailed) {
+		kprintf("Test failed\n");
+	}
+	kprintf("Rwlock test done.\n");
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Timed wait test.
+ *
+ * P_timed and cv_timedwait on something nobody signals must time out,
+ * and not too early; and one that does get signalled must not.
+ */
+
+#define TIMEDWAIT_TICKS	20
+
+static struct semaphore *timedsem;
+static struct lock *timedlock;
+static struct cv *timedcv;
+
+/*
+ * Return how many hardclocks have gone by since START, rounded down.
+ */
+static
+unsigned
+ticks_since(const struct timespec *start)
+{
+	struct timespec now, diff;
+
+	gettime(&now);
+	timespec_sub(&now, start, &diff);
+	return (unsigned)diff.tv_sec * HZ + diff.tv_nsec / (1000000000 / HZ);
+}
+
+static
+void
+timedwaker(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	clocksleep_ticks(TIMEDWAIT_TICKS / 4);
+	V(timedsem);
+	lock_acquire(timedlock);
+	cv_signal(timedcv, timedlock);
+	lock_release(timedlock);
+}
+
+int
+timedwaittest(int nargs, char **args)
+{
+	struct timespec start;
+	unsigned elapsed;
+	bool failed = false;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	if (timedsem == NULL) {
+		timedsem = sem_create("timedsem", 0);
+		timedlock = lock_create("timedlock");
+		timedcv = cv_create("timedcv");
+		if (timedsem == NULL || timedlock == NULL ||
+		    timedcv == NULL) {
+			panic("timedwaittest: out of memory\n");
+		}
+	}
+	kprintf("Starting timed wait test...\n");
+
+	/* Nobody around: both should time out. */
+	gettime(&start);
+	result = P_timed(timedsem, TIMEDWAIT_TICKS);
+	elapsed = ticks_since(&start);
+	if (result != ETIMEDOUT || elapsed < TIMEDWAIT_TICKS - 1) {
+		kprintf("P_timed: got %d after %u ticks\n", result, elapsed);
+		failed = true;
+	}
+
+	gettime(&start);
+	lock_acquire(timedlock);
+	result = cv_timedwait(timedcv, timedlock, TIMEDWAIT_TICKS);
+	KASSERT(lock_do_i_hold(timedlock));
+	lock_release(timedlock);
+	elapsed = ticks_since(&start);
+	if (result != ETIMEDOUT || elapsed < TIMEDWAIT_TICKS - 1) {
+		kprintf("cv_timedwait: got %d after %u ticks\n",
+			result, elapsed);
+		failed = true;
+	}
+
+	/*
+	 * Now with a thread to wake us, well before the timeout. Hold
+	 * the lock throughout, so the waker can't get to cv_signal
+	 * until we're waiting on the cv.
+	 */
+	lock_acquire(timedlock);
+	result = thread_fork("timedwaker", NULL, timedwaker, NULL, 0);
+	if (result) {
+		panic("timedwaittest: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+
+	result = P_timed(timedsem, TIMEDWAIT_TICKS * 10);
+	if (result != 0) {
+		kprintf("P_timed: timed out despite V\n");
+		failed = true;
+	}
+
+	result = cv_timedwait(timedcv, timedlock, TIMEDWAIT_TICKS * 10);
+	lock_release(timedlock);
+	if (result != 0) {
+		kprintf("cv_timedwait: timed out despite cv_signal\n");
+		failed = true;
+	}
+
+	if (failed) {
+		kprintf("Test failed\n");
+	}
+	kprintf("Timed wait test done.\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * CV handoff test.
+ *
+ * A crowd of threads waits on one CV; a single broadcast must get
+ * every one of them out of cv_wait, one at a time, each holding the
+ * lock, and without any of them having to be signalled again.
+ */
+
+static struct lock *handofflock;
+static struct cv *handoffcv;
+static volatile unsigned handoffwaiting;
+static volatile unsigned handoffinside;
+static volatile bool handoffgo;
+static volatile bool handofffailed;
+
+static
+void
+handoffthread(void *junk, unsigned long num)
+{
+	volatile int j;
+
+	(void)junk;
+	(void)num;
+
+	lock_acquire(handofflock);
+	handoffwaiting++;
+	while (!handoffgo) {
+		cv_wait(handoffcv, handofflock);
+	}
+	if (!lock_do_i_hold(handofflock) || handoffinside != 0) {
+		handofffailed = true;
+	}
+	handoffinside++;
+	for (j=0; j<1000; j++);
+	handoffinside--;
+	handoffwaiting--;
+	lock_release(handofflock);
+
+	V(donesem);
+}
+
+int
+cvhandofftest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	if (handofflock == NULL) {
+		handofflock = lock_create("handofflock");
+		handoffcv = cv_create("handoffcv");
+		if (handofflock == NULL || handoffcv == NULL) {
+			panic("cvhandofftest: out of memory\n");
+		}
+	}
+	kprintf("Starting CV handoff test...\n");
+
+	handoffwaiting = 0;
+	handoffinside = 0;
+	handoffgo = false;
+	handofffailed = false;
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("handofftest", NULL, handoffthread,
+				     NULL, i);
+		if (result) {
+			panic("cvhandofftest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	/* Wait until they're all on the CV, then let them all go. */
+	lock_acquire(handofflock);
+	while (handoffwaiting < NTHREADS) {
+		lock_release(handofflock);
+		clocksleep_ticks(1);
+		lock_acquire(handofflock);
+	}
+	handoffgo = true;
+	cv_broadcast(handoffcv, handofflock);
+	lock_release(handofflock);
+
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	if (handofffailed || handoffwaiting != 0) {
+		kprintf("Test failed\n");
+	}
+	kprintf("CV handoff test done.\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Priority inheritance test.
+ *
+ * The nicest possible thread takes a lock and has some work to do
+ * before it lets go. A pack of CPU hogs at ordinary niceness then
+ * keeps every cpu busy, and a thread with the least possible
+ * niceness comes along wanting the lock. Without priority inheritance
+ * the holder gets no cpu until the hogs have sunk to its level, and
+ * the favoured thread waits all that time too; with it, the holder
+ * runs at the waiter's level and the wait is about as long as the
+ * holder's work. The hogs give up after PIHOG_TICKS regardless, so
+ * the test ends either way.
+ */
+
+#define PI_NHOGS	16
+#define PIWORK_TICKS	(HZ / 10)
+#define PIWAIT_TICKS	(PIWORK_TICKS + HZ / 4)
+#define PIHOG_TICKS	(5 * HZ)
+
+static struct lock *pilock;
+static struct semaphore *piheldsem;
+static volatile bool pidone;
+static volatile unsigned piwaited;
+
+static
+void
+piholder(void *junk, unsigned long num)
+{
+	struct timespec start;
+
+	(void)junk;
+	(void)num;
+
+	lock_acquire(pilock);
+	V(piheldsem);
+	gettime(&start);
+	while (ticks_since(&start) < PIWORK_TICKS) {
+		/* compute */
+	}
+	lock_release(pilock);
+	V(donesem);
+}
+
+static
+void
+pihog(void *junk, unsigned long num)
+{
+	struct timespec start;
+
+	(void)junk;
+	(void)num;
+
+	gettime(&start);
+	while (!pidone && ticks_since(&start) < PIHOG_TICKS) {
+		/* hog */
+	}
+	V(donesem);
+}
+
+static
+void
+piwaiter(void *junk, unsigned long num)
+{
+	struct timespec start;
+
+	(void)junk;
+	(void)num;
+
+	gettime(&start);
+	lock_acquire(pilock);
+	piwaited = ticks_since(&start);
+	lock_release(pilock);
+	pidone = true;
+	V(donesem);
+}
+
+/*
+ * Fork a test thread with niceness NICE. New threads start at the
+ * level their (inherited) niceness allows.
+ */
+static
+void
+pifork(const char *name, int nice,
+       void (*func)(void *, unsigned long), unsigned long num)
+{
+	int oldnice, result;
+
+	oldnice = curthread->t_nice;
+	thread_setnice(curthread, nice);
+	result = thread_fork(name, NULL, func, NULL, num);
+	thread_setnice(curthread, oldnice);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+}
+
+int
+pitest(int nargs, char **args)
+{
+	int i;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	if (pilock == NULL) {
+		pilock = lock_create("pilock");
+		piheldsem = sem_create("piheldsem", 0);
+		if (pilock == NULL || piheldsem == NULL) {
+			panic("pitest: out of memory\n");
+		}
+	}
+	kprintf("Starting priority inheritance test...\n");
+
+	pidone = false;
+	piwaited = 0;
+
+	pifork("piholder", PRIO_MAX, piholder, 0);
+	P(piheldsem);
+	for (i=0; i<PI_NHOGS; i++) {
+		pifork("pihog", 0, pihog, i);
+	}
+	pifork("piwaiter", PRIO_MIN, piwaiter, 0);
+
+	for (i=0; i<PI_NHOGS + 2; i++) {
+		P(donesem);
+	}
+
+	kprintf("Favoured thread waited %u ticks for the lock\n", piwaited);
+	if (piwaited > PIWAIT_TICKS) {
+		kprintf("Test failed\n");
+	}
+	kprintf("Priority inheritance test done.\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// spinlock benchmark
+
+/*
+ * Spinlock benchmark: SPBENCH_NTHREADS threads fight over one
+ * spinlock for SPBENCH_TICKS, first a plain one and then a ticket
+ * lock, and we report how many times each thread got it. The total
+ * is the throughput; the spread between the luckiest and unluckiest
+ * thread shows how fair the lock is. This is only interesting with
+ * several cpus. The shared counter checks that the lock works.
+ */
+
+#define SPBENCH_NTHREADS	16
+#define SPBENCH_TICKS		(2*HZ)
+#define SPBENCH_HOLDLOOPS	20
+
+static struct spinlock spbenchlock;
+static volatile bool spbenchstop;
+static volatile unsigned spbenchshared;
+static unsigned spbenchcounts[SPBENCH_NTHREADS];
+
+static
+void
+spbenchthread(void *junk, unsigned long num)
+{
+	unsigned count = 0;
+	volatile unsigned i;
+
+	(void)junk;
+
+	while (!spbenchstop) {
+		spinlock_acquire(&spbenchlock);
+		spbenchshared++;
+		for (i=0; i<SPBENCH_HOLDLOOPS; i++) {
+			/* hold it a little while */
+		}
+		spinlock_release(&spbenchlock);
+		count++;
+	}
+	spbenchcounts[num] = count;
+	V(donesem);
+}
+
+/*
+ * Run one round. Returns true if the lock let two cpus in at once.
+ */
+static
+bool
+spbenchround(const char *kind, bool ticket)
+{
+	unsigned i, total, min, max;
+	int result;
+
+	if (ticket) {
+		spinlock_init_ticket(&spbenchlock);
+	}
+	else {
+		spinlock_init(&spbenchlock);
+	}
+	spbenchstop = false;
+	spbenchshared = 0;
+
+	for (i=0; i<SPBENCH_NTHREADS; i++) {
+		result = thread_fork("spbench", NULL, spbenchthread, NULL, i);
+		if (result) {
+			panic("spinlockbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	clocksleep_ticks(SPBENCH_TICKS);
+	spbenchstop = true;
+	for (i=0; i<SPBENCH_NTHREADS; i++) {
+		P(donesem);
+	}
+	spinlock_cleanup(&spbenchlock);
+
+	total = 0;
+	min = max = spbenchcounts[0];
+	for (i=0; i<SPBENCH_NTHREADS; i++) {
+		total += spbenchcounts[i];
+		if (spbenchcounts[i] < min) {
+			min = spbenchcounts[i];
+		}
+		if (spbenchcounts[i] > max) {
+			max = spbenchcounts[i];
+		}
+	}
+	kprintf("%-8s %10u acquires, per thread min %u max %u\n",
+		kind, total, min, max);
+	return spbenchshared != total;
+}
+
+int
+spinlockbench(int nargs, char **args)
+{
+	bool failed;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting spinlock benchmark...\n");
+
+	failed = spbenchround("plain", false);
+	failed = spbenchround("ticket", true) || failed;
+
+	if (failed) {
+		kprintf("Test failed\n");
+	}
+	kprintf("Spinlock benchmark done.\n");
+	return 0;
+}
@@ -35,6 +35,7 @@
 #include <lib.h>
 #include <stdarg.h>
 #include <spl.h>
+#include <clock.h>
 #include <thread.h>
 #include <proc.h>
 #include <current.h>
@@ -66,13 +67,12 @@ static
 void
 waitfirstthread(void *junk, unsigned long num)
 {
-	unsigned long i;
 	(void)junk;
 
 	kprintf("waitfirstthread %lu started...\n", num);
 
-	for (i = 0; i < 100 * (num + 1); i++)
-		thread_yield();
+	/* Take a little while, without hogging the cpu. */
+	clocksleep_ticks(num + 1);
 
 	kprintf("waitfirstthread %lu exiting.\n", num);
 
@@ -84,13 +84,12 @@ static
 void
 exitfirstthread(void *junk, unsigned long num)
 {
-	unsigned long i;
 	(void)junk;
 
 	kprintf("exitfirstthread %lu started...\n", num);
 
-	for (i = 0; i <  100 * (num + 1); i++)
-		thread_yield();
+	/* Take a little while, without hogging the cpu. */
+	clocksleep_ticks(num + 1);
 
 	kprintf("exitfirstthread %lu exiting.\n", num);
 
@@ -108,7 +107,7 @@ dofork(const char *name, void (*func)(void *, unsigned long),
 	struct proc *proc;
 	int result;
 
-	result = proc_fork(&proc);
+	result = proc_fork(NULL, &proc);
 	if (result) {
 		return result;
 	}
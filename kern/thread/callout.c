@@ -0,0 +1,272 @@
+/*
+ * Per-cpu timing wheels for callouts.
+ *
+ * A callout due in DELTA ticks goes on level L, the lowest level
+ * whose span (CALLOUT_SLOTS^(L+1) ticks) exceeds DELTA, in the slot
+ * picked by the corresponding bits of its expiry time. Every tick
+ * runs one level 0 slot; whenever the level 0 index wraps around to
+ * zero, the current slot of level 1 is emptied and its callouts put
+ * back in (which sends them to level 0), and so on up. This is the
+ * classic scheme from Varghese & Lauck, as used in BSD and Linux.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <current.h>
+#include <callout.h>
+
+/*
+ * Put CO on the right slot of CW. The wheel must be locked and
+ * CO->co_expire set.
+ */
+static
+void
+callout_insert(struct callout_wheel *cw, struct callout *co)
+{
+	unsigned delta, level, slot;
+	struct callout **head;
+
+	delta = co->co_expire - cw->cw_now;
+	KASSERT(delta <= CALLOUT_MAXTICKS);
+
+	for (level = 0; level < CALLOUT_LEVELS - 1; level++) {
+		if (delta < (1U << (CALLOUT_SLOTBITS * (level + 1)))) {
+			break;
+		}
+	}
+	slot = (co->co_expire >> (CALLOUT_SLOTBITS * level)) &
+		CALLOUT_SLOTMASK;
+
+	head = &cw->cw_slots[level][slot];
+	co->co_next = *head;
+	if (co->co_next != NULL) {
+		co->co_next->co_prevp = &co->co_next;
+	}
+	co->co_prevp = head;
+	*head = co;
+}
+
+/*
+ * Take CO off whatever list it's on. The wheel must be locked.
+ */
+static
+void
+callout_unlink(struct callout *co)
+{
+	KASSERT(co->co_prevp != NULL);
+
+	*co->co_prevp = co->co_next;
+	if (co->co_next != NULL) {
+		co->co_next->co_prevp = co->co_prevp;
+	}
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+}
+
+/*
+ * Empty slot SLOT of level LEVEL and redistribute its callouts, which
+ * are now close enough to go on lower levels.
+ */
+static
+void
+callout_cascade(struct callout_wheel *cw, unsigned level, unsigned slot)
+{
+	struct callout *co;
+
+	while ((co = cw->cw_slots[level][slot]) != NULL) {
+		callout_unlink(co);
+		callout_insert(cw, co);
+	}
+}
+
+/*
+ * Take CO off its wheel if it's pending there. Returns true if it was.
+ */
+static
+bool
+callout_remove(struct callout *co)
+{
+	struct callout_wheel *cw;
+	bool pending = false;
+
+	cw = co->co_wheel;
+	if (cw == NULL) {
+		/* never scheduled */
+		return false;
+	}
+
+	spinlock_acquire(&cw->cw_lock);
+	if (co->co_prevp != NULL) {
+		callout_unlink(co);
+		cw->cw_count--;
+		pending = true;
+	}
+	spinlock_release(&cw->cw_lock);
+	return pending;
+}
+
+void
+callout_init(struct callout *co, void (*func)(void *), void *arg)
+{
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+	co->co_expire = 0;
+	co->co_func = func;
+	co->co_arg = arg;
+	co->co_wheel = NULL;
+}
+
+void
+callout_schedule(struct callout *co, unsigned ticks)
+{
+	struct callout_wheel *cw;
+	int spl;
+
+	/*
+	 * Take it off wherever it was, possibly another cpu. (Don't
+	 * wait for it if it's running; it may be rescheduling itself.)
+	 */
+	callout_remove(co);
+
+	if (ticks > CALLOUT_MAXTICKS) {
+		ticks = CALLOUT_MAXTICKS;
+	}
+
+	/* Stay on this cpu until the callout is on its wheel. */
+	spl = splhigh();
+	cw = &curcpu->c_callouts;
+	spinlock_acquire(&cw->cw_lock);
+	co->co_wheel = cw;
+	co->co_expire = cw->cw_now + ticks;
+	callout_insert(cw, co);
+	cw->cw_count++;
+	spinlock_release(&cw->cw_lock);
+	splx(spl);
+}
+
+bool
+callout_stop(struct callout *co)
+{
+	struct callout_wheel *cw;
+	bool pending;
+
+	pending = callout_remove(co);
+
+	/*
+	 * If it's running right now on its cpu, wait for it to finish
+	 * so the caller can safely free it. Callouts are short and run
+	 * with interrupts off, so just spin.
+	 */
+	cw = co->co_wheel;
+	while (cw != NULL && cw->cw_running == co) {
+		/* spin */
+	}
+
+	return pending;
+}
+
+bool
+callout_pending(struct callout *co)
+{
+	return co->co_prevp != NULL;
+}
+
+void
+callout_wheel_init(struct callout_wheel *cw)
+{
+	unsigned level, slot;
+
+	spinlock_init(&cw->cw_lock);
+	cw->cw_now = 0;
+	cw->cw_count = 0;
+	cw->cw_expired = NULL;
+	cw->cw_running = NULL;
+	for (level = 0; level < CALLOUT_LEVELS; level++) {
+		for (slot = 0; slot < CALLOUT_SLOTS; slot++) {
+			cw->cw_slots[level][slot] = NULL;
+		}
+	}
+}
+
+void
+callout_hardclock(void)
+{
+	struct callout_wheel *cw;
+	struct callout *co;
+	unsigned now, level, slot;
+
+	cw = &curcpu->c_callouts;
+
+	spinlock_acquire(&cw->cw_lock);
+	now = cw->cw_now;
+
+	/* When a level's index wraps, pull the next level down. */
+	slot = now & CALLOUT_SLOTMASK;
+	for (level = 1; slot == 0 && level < CALLOUT_LEVELS; level++) {
+		slot = (now >> (CALLOUT_SLOTBITS * level)) & CALLOUT_SLOTMASK;
+		callout_cascade(cw, level, slot);
+	}
+
+	/*
+	 * Move what's due to cw_expired and advance the clock before
+	 * running anything, so a callout that reschedules itself goes
+	 * to a later tick. Keeping them on a list (rather than in a
+	 * local variable) lets callout_stop take them off while we're
+	 * running the others with the wheel unlocked.
+	 */
+	slot = now & CALLOUT_SLOTMASK;
+	KASSERT(cw->cw_expired == NULL);
+	cw->cw_expired = cw->cw_slots[0][slot];
+	if (cw->cw_expired != NULL) {
+		cw->cw_expired->co_prevp = &cw->cw_expired;
+	}
+	cw->cw_slots[0][slot] = NULL;
+	cw->cw_now = now + 1;
+
+	while ((co = cw->cw_expired) != NULL) {
+		KASSERT(co->co_expire == now);
+		callout_unlink(co);
+		cw->cw_count--;
+		cw->cw_running = co;
+		spinlock_release(&cw->cw_lock);
+
+		co->co_func(co->co_arg);
+
+		spinlock_acquire(&cw->cw_lock);
+		cw->cw_running = NULL;
+	}
+	spinlock_release(&cw->cw_lock);
+}
+
+unsigned
+callout_nextdue(void)
+{
+	struct callout_wheel *cw;
+	unsigned k, slot;
+
+	cw = &curcpu->c_callouts;
+
+	spinlock_acquire(&cw->cw_lock);
+	if (cw->cw_count == 0) {
+		spinlock_release(&cw->cw_lock);
+		return CALLOUT_MAXTICKS;
+	}
+
+	/*
+	 * Everything on level 0 is due within CALLOUT_SLOTS ticks, so
+	 * the first nonempty slot from here on is the next one to run.
+	 * Failing that, the next tick that wraps level 0 around has to
+	 * cascade the upper levels, and there's always one in range.
+	 */
+	for (k = 0; k < CALLOUT_SLOTS; k++) {
+		slot = (cw->cw_now + k) & CALLOUT_SLOTMASK;
+		if (slot == 0 || cw->cw_slots[0][slot] != NULL) {
+			break;
+		}
+	}
+	spinlock_release(&cw->cw_lock);
+
+	return k + 1;
+}
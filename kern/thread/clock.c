@@ -31,6 +31,8 @@
 #include <lib.h>
 #include <cpu.h>
 #include <wchan.h>
+#include <mainbus.h>
+#include <callout.h>
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
@@ -38,9 +40,9 @@
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution that one second.
+ * Callbacks at specific points in the future are handled by the
+ * callout wheels (callout.c), which hardclock advances; timed sleeps
+ * are built on those, so they have a resolution of one hardclock.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -50,14 +52,15 @@
  * Timing constants. These should be tuned along with any work done on
  * the scheduler.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
-#define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
+#define SCHEDULE_HARDCLOCKS	100	/* Reschedule every 100 hardclocks. */
+#define IDLE_MAXTICKS		HZ	/* Longest an idle cpu skips ticks. */
 
 /*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
+ * Threads in clocksleep wait here. Nobody wakes this channel; each
+ * sleeper is woken individually by its own timeout.
  */
-static struct wchan *lbolt;
-static struct spinlock lbolt_lock;
+static struct wchan *clocksleep_wchan;
+static struct spinlock clocksleep_lock;
 
 /*
  * Setup.
@@ -65,24 +68,38 @@ static struct spinlock lbolt_lock;
 void
 hardclock_bootstrap(void)
 {
-	spinlock_init(&lbolt_lock);
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
+	spinlock_init(&clocksleep_lock);
+	clocksleep_wchan = wchan_create("clocksleep");
+	if (clocksleep_wchan == NULL) {
+		panic("Couldn't create clocksleep wchan\n");
 	}
 }
 
 /*
  * This is called once per second, on one processor, by the timer
- * code.
+ * code. Nothing needs it at the moment.
  */
 void
 timerclock(void)
 {
-	/* Just broadcast on lbolt */
-	spinlock_acquire(&lbolt_lock);
-	wchan_wakeall(lbolt, &lbolt_lock);
-	spinlock_release(&lbolt_lock);
+}
+
+/*
+ * Account for ticks that went by without a timer interrupt while the
+ * cpu was idle. There's no one to charge them to and the run queue is
+ * empty, so all that needs doing is to keep the clock and the callout
+ * wheel up to date.
+ */
+static
+void
+hardclock_skipped(unsigned ticks)
+{
+	while (ticks-- > 0) {
+		cpustat_inc(CPUSTAT_HARDCLOCKS);
+		cpustat_inc(CPUSTAT_SKIPPEDTICKS);
+		cpustat_inc(CPUSTAT_IDLETICKS);
+		callout_hardclock();
+	}
 }
 
 /*
@@ -93,17 +110,118 @@ void
 hardclock(void)
 {
 	/*
-	 * Collect statistics here as desired.
+	 * If the timer was stretched for idling, this interrupt also
+	 * stands for the ticks before it.
 	 */
+	if (curcpu->c_idleticks > 0) {
+		hardclock_skipped(curcpu->c_idleticks - 1);
+		curcpu->c_idleticks = 0;
+	}
 
-	curcpu->c_hardclocks++;
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
-		thread_consider_migration();
+	cpustat_inc(CPUSTAT_HARDCLOCKS);
+	if (curcpu->c_isidle) {
+		cpustat_inc(CPUSTAT_IDLETICKS);
 	}
-	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
+	callout_hardclock();
+	if ((cpustat_get(curcpu->c_self, CPUSTAT_HARDCLOCKS) %
+	     SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	thread_yield();
+	thread_timeslice();
+}
+
+/*
+ * Called from the idle loop, with interrupts off, just before the cpu
+ * waits for an interrupt. If nothing needs the next few hardclocks,
+ * arrange for the timer not to go off until something does.
+ */
+void
+hardclock_idle(void)
+{
+	unsigned ticks;
+
+	KASSERT(curcpu->c_isidle);
+
+	if (curcpu->c_idleticks > 0) {
+		/* still stretched; its interrupt is pending */
+		return;
+	}
+
+	ticks = callout_nextdue();
+	if (ticks > IDLE_MAXTICKS) {
+		ticks = IDLE_MAXTICKS;
+	}
+	if (ticks > 1 && mainbus_timer_stretch(ticks)) {
+		curcpu->c_idleticks = ticks;
+	}
+}
+
+/*
+ * Called from the idle loop, with interrupts off, after the cpu wakes
+ * up. If something other than the timer woke us, go back to regular
+ * ticks and account for the ones that went by.
+ */
+void
+hardclock_unidle(void)
+{
+	unsigned elapsed;
+
+	if (curcpu->c_idleticks == 0) {
+		/* not stretched, or the timer went off and hardclock ran */
+		return;
+	}
+	if (!mainbus_timer_unstretch(&elapsed)) {
+		/* the timer is just going off; hardclock will catch up */
+		return;
+	}
+	curcpu->c_idleticks = 0;
+	hardclock_skipped(elapsed);
+}
+
+/*
+ * Convert a time interval to hardclocks, rounding up. Saturates
+ * rather than overflowing.
+ */
+unsigned
+timespec_to_hardclocks(const struct timespec *ts)
+{
+	const unsigned nsecs_per_tick = 1000000000 / HZ;
+	unsigned ticks;
+
+	if (ts->tv_sec < 0) {
+		return 0;
+	}
+	if (ts->tv_sec >= (time_t)(~0U / HZ) - 1) {
+		return ~0U;
+	}
+	ticks = (unsigned)ts->tv_sec * HZ;
+	ticks += ((unsigned)ts->tv_nsec + nsecs_per_tick - 1) / nsecs_per_tick;
+	return ticks;
+}
+
+/*
+ * Suspend execution for the given number of hardclocks.
+ */
+void
+clocksleep_ticks(unsigned ticks)
+{
+	struct wchan_timeout wt;
+	unsigned chunk;
+
+	while (ticks > 0) {
+		/* The callout wheel only reaches so far. */
+		chunk = ticks < CALLOUT_MAXTICKS ? ticks : CALLOUT_MAXTICKS;
+		ticks -= chunk;
+
+		spinlock_acquire(&clocksleep_lock);
+		wchan_timeout_start(&wt, clocksleep_wchan, &clocksleep_lock,
+				    chunk);
+		while (!wt.wt_timedout) {
+			wchan_sleep(clocksleep_wchan, &clocksleep_lock);
+		}
+		spinlock_release(&clocksleep_lock);
+		wchan_timeout_stop(&wt);
+	}
 }
 
 /*
@@ -112,10 +230,7 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-	spinlock_acquire(&lbolt_lock);
-	while (num_secs > 0) {
-		wchan_sleep(lbolt, &lbolt_lock);
-		num_secs--;
+	if (num_secs > 0) {
+		clocksleep_ticks((unsigned)num_secs * HZ);
 	}
-	spinlock_release(&lbolt_lock);
 }
@@ -0,0 +1,274 @@
+/*
+ * Lock contention profiling.
+ *
+ * Only compiled in with "options lockprof"; without it the hooks in
+ * spinlock.c and synch.c disappear entirely.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <lockprof.h>
+
+/*
+ * Totals by name. Used both for locks that have been destroyed (whose
+ * own names go away with them, hence the copy) and for building the
+ * report. If we run out of names, everything else is lumped together.
+ */
+#define LOCKPROF_NAMELEN	32
+#define LOCKPROF_MAXNAMES	64
+
+struct lockprof_total {
+	char lt_name[LOCKPROF_NAMELEN];
+	uint32_t lt_acquires;
+	uint32_t lt_contended;
+	uint64_t lt_waittime;
+	uint32_t lt_maxhold;
+};
+
+/*
+ * The list of live profiled locks and the totals of dead ones. The
+ * spinlock protecting them has no name, so it isn't itself profiled
+ * (which would recurse).
+ */
+static struct spinlock lockprof_listlock = SPINLOCK_INITIALIZER;
+static struct lockprof *lockprof_list;
+static struct lockprof_total lockprof_retired[LOCKPROF_MAXNAMES];
+static unsigned lockprof_numretired;
+
+/* Scratch space for lockprof_printstats; only the menu calls it. */
+static struct lockprof_total lockprof_report[LOCKPROF_MAXNAMES];
+
+/*
+ * Find (or add) the entry for NAME in a table of totals.
+ */
+static
+struct lockprof_total *
+lockprof_findname(struct lockprof_total *tab, unsigned *num,
+		  const char *name)
+{
+	char buf[LOCKPROF_NAMELEN];
+	unsigned i;
+
+	/* compare against the truncated name, as that's what's stored */
+	snprintf(buf, sizeof(buf), "%s", name);
+	for (i=0; i<*num; i++) {
+		if (!strcmp(tab[i].lt_name, buf)) {
+			return &tab[i];
+		}
+	}
+
+	if (*num == LOCKPROF_MAXNAMES) {
+		i = LOCKPROF_MAXNAMES - 1;
+		strcpy(tab[i].lt_name, "(others)");
+		return &tab[i];
+	}
+
+	i = (*num)++;
+	strcpy(tab[i].lt_name, buf);
+	tab[i].lt_acquires = 0;
+	tab[i].lt_contended = 0;
+	tab[i].lt_waittime = 0;
+	tab[i].lt_maxhold = 0;
+	return &tab[i];
+}
+
+/*
+ * Add the counters from LP into a table of totals.
+ */
+static
+void
+lockprof_fold(struct lockprof_total *tab, unsigned *num,
+	      const struct lockprof *lp)
+{
+	struct lockprof_total *lt;
+
+	lt = lockprof_findname(tab, num, lp->lp_name);
+	lt->lt_acquires += lp->lp_acquires;
+	lt->lt_contended += lp->lp_contended;
+	lt->lt_waittime += lp->lp_waittime;
+	if (lp->lp_maxhold > lt->lt_maxhold) {
+		lt->lt_maxhold = lp->lp_maxhold;
+	}
+}
+
+/*
+ * Put a lock on the list. For sleep locks this happens when they're
+ * created; for statically initialized spinlocks, on first use.
+ */
+static
+void
+lockprof_addlist(struct lockprof *lp)
+{
+	spinlock_acquire(&lockprof_listlock);
+	if (!lp->lp_listed) {
+		lp->lp_prev = NULL;
+		lp->lp_next = lockprof_list;
+		if (lockprof_list != NULL) {
+			lockprof_list->lp_prev = lp;
+		}
+		lockprof_list = lp;
+		lp->lp_listed = true;
+	}
+	spinlock_release(&lockprof_listlock);
+}
+
+void
+lockprof_init(struct lockprof *lp, const char *name)
+{
+	lp->lp_name = name;
+	lp->lp_listed = false;
+	lp->lp_prev = lp->lp_next = NULL;
+	lp->lp_acquires = 0;
+	lp->lp_contended = 0;
+	lp->lp_waittime = 0;
+	lp->lp_maxhold = 0;
+	lp->lp_holdstart = 0;
+
+	if (name != NULL) {
+		lockprof_addlist(lp);
+	}
+}
+
+void
+lockprof_cleanup(struct lockprof *lp)
+{
+	if (!lp->lp_listed) {
+		return;
+	}
+
+	spinlock_acquire(&lockprof_listlock);
+	if (lp->lp_prev != NULL) {
+		lp->lp_prev->lp_next = lp->lp_next;
+	}
+	else {
+		lockprof_list = lp->lp_next;
+	}
+	if (lp->lp_next != NULL) {
+		lp->lp_next->lp_prev = lp->lp_prev;
+	}
+	lp->lp_listed = false;
+
+	lockprof_fold(lockprof_retired, &lockprof_numretired, lp);
+	spinlock_release(&lockprof_listlock);
+}
+
+uint64_t
+lockprof_now(void)
+{
+	struct timespec ts;
+
+	if (!gettime_available()) {
+		return 0;
+	}
+	gettime(&ts);
+	/* (only 32x32 multiplies; the seconds wrap after 136 years) */
+	return (uint64_t)(uint32_t)ts.tv_sec * 1000000000U + ts.tv_nsec;
+}
+
+void
+lockprof_acquired(struct lockprof *lp, uint64_t waitstart, bool contended)
+{
+	uint64_t now;
+
+	if (lp->lp_name == NULL) {
+		return;
+	}
+	if (!lp->lp_listed) {
+		lockprof_addlist(lp);
+	}
+
+	now = lockprof_now();
+	lp->lp_acquires++;
+	if (contended) {
+		lp->lp_contended++;
+		/* skip it if the clock appeared while we were waiting */
+		if (waitstart != 0 && now >= waitstart) {
+			lp->lp_waittime += now - waitstart;
+		}
+	}
+	lp->lp_holdstart = now;
+}
+
+void
+lockprof_releasing(struct lockprof *lp)
+{
+	uint64_t now;
+
+	if (lp->lp_name == NULL) {
+		return;
+	}
+
+	now = lockprof_now();
+	if (lp->lp_holdstart == 0 || now < lp->lp_holdstart) {
+		return;
+	}
+	if (now - lp->lp_holdstart > lp->lp_maxhold) {
+		/* saturate rather than wrap after 4 seconds */
+		lp->lp_maxhold = now - lp->lp_holdstart > 0xffffffffU ?
+			0xffffffffU : (uint32_t)(now - lp->lp_holdstart);
+	}
+}
+
+void
+lockprof_printstats(void)
+{
+	struct lockprof *lp;
+	struct lockprof_total tmp;
+	unsigned num, i, j;
+
+	/*
+	 * Collect the totals. The counters of live locks may be
+	 * changing underneath us; that's fine for a report.
+	 */
+	spinlock_acquire(&lockprof_listlock);
+	num = lockprof_numretired;
+	for (i=0; i<num; i++) {
+		lockprof_report[i] = lockprof_retired[i];
+	}
+	for (lp = lockprof_list; lp != NULL; lp = lp->lp_next) {
+		lockprof_fold(lockprof_report, &num, lp);
+	}
+	spinlock_release(&lockprof_listlock);
+
+	/* Sort by time spent waiting, worst first. */
+	for (i=1; i<num; i++) {
+		tmp = lockprof_report[i];
+		for (j=i; j>0; j--) {
+			if (lockprof_report[j-1].lt_waittime >=
+			    tmp.lt_waittime) {
+				break;
+			}
+			lockprof_report[j] = lockprof_report[j-1];
+		}
+		lockprof_report[j] = tmp;
+	}
+
+	kprintf("%-24s %10s %10s %14s %12s\n", "lock", "acquires",
+		"contended", "wait ns", "max hold ns");
+	for (i=0; i<num; i++) {
+		kprintf("%-24s %10u %10u %14llu %12u\n",
+			lockprof_report[i].lt_name,
+			lockprof_report[i].lt_acquires,
+			lockprof_report[i].lt_contended,
+			(unsigned long long)lockprof_report[i].lt_waittime,
+			lockprof_report[i].lt_maxhold);
+	}
+}
+
+void
+lockprof_reset(void)
+{
+	struct lockprof *lp;
+
+	spinlock_acquire(&lockprof_listlock);
+	lockprof_numretired = 0;
+	for (lp = lockprof_list; lp != NULL; lp = lp->lp_next) {
+		lp->lp_acquires = 0;
+		lp->lp_contended = 0;
+		lp->lp_waittime = 0;
+		lp->lp_maxhold = 0;
+	}
+	spinlock_release(&lockprof_listlock);
+}
@@ -30,6 +30,7 @@
 /* Make sure to build out-of-line versions of inline functions */
 #define SPINLOCK_INLINE   /* empty */
 #define MEMBAR_INLINE     /* empty */
+#define ATOMIC_INLINE     /* empty */
 
 #include <types.h>
 #include <lib.h>
@@ -37,6 +38,7 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <membar.h>
+#include <atomic.h>	/* only for the out-of-line copies */
 #include <current.h>	/* for curcpu */
 
 /*
@@ -51,7 +53,22 @@ void
 spinlock_init(struct spinlock *splk)
 {
 	spinlock_data_set(&splk->splk_lock, 0);
+	spinlock_data_set(&splk->splk_next, 0);
+	splk->splk_ticket = false;
 	splk->splk_holder = NULL;
+#if OPT_LOCKPROF
+	lockprof_init(&splk->splk_prof, NULL);
+#endif
+}
+
+/*
+ * Initialize a ticket lock.
+ */
+void
+spinlock_init_ticket(struct spinlock *splk)
+{
+	spinlock_init(splk);
+	splk->splk_ticket = true;
 }
 
 /*
@@ -61,7 +78,68 @@ void
 spinlock_cleanup(struct spinlock *splk)
 {
 	KASSERT(splk->splk_holder == NULL);
-	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	/* (for plain spinlocks splk_next is always 0) */
+	KASSERT(spinlock_data_get(&splk->splk_lock) ==
+		spinlock_data_get(&splk->splk_next));
+#if OPT_LOCKPROF
+	lockprof_cleanup(&splk->splk_prof);
+#endif
+}
+
+/*
+ * Wait for a plain spinlock and take it. Returns true if it looked
+ * held when we started (only a peek, but good enough for the lock
+ * profiler).
+ */
+static
+bool
+spinlock_wait_tas(struct spinlock *splk)
+{
+	bool contended;
+
+	contended = spinlock_data_get(&splk->splk_lock) != 0;
+
+	while (1) {
+		/*
+		 * Do test-test-and-set, that is, read first before
+		 * doing test-and-set, to reduce bus contention.
+		 *
+		 * Test-and-set is a machine-level atomic operation
+		 * that writes 1 into the lock word and returns the
+		 * previous value. If that value was 0, the lock was
+		 * previously unheld and we now own it. If it was 1,
+		 * we don't.
+		 */
+		if (spinlock_data_get(&splk->splk_lock) != 0) {
+			continue;
+		}
+		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
+			continue;
+		}
+		break;
+	}
+	return contended;
+}
+
+/*
+ * Same for a ticket lock: take a number and wait for it to come up.
+ * We only read while waiting; the only store to splk_lock is the
+ * holder's release.
+ */
+static
+bool
+spinlock_wait_ticket(struct spinlock *splk)
+{
+	spinlock_data_t ticket;
+	bool contended;
+
+	ticket = spinlock_data_fetchinc(&splk->splk_next);
+	contended = spinlock_data_get(&splk->splk_lock) != ticket;
+
+	while (spinlock_data_get(&splk->splk_lock) != ticket) {
+		/* spin */
+	}
+	return contended;
 }
 
 /*
@@ -75,6 +153,10 @@ void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+	bool contended;
+#if OPT_LOCKPROF
+	uint64_t waitstart;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -90,28 +172,24 @@ spinlock_acquire(struct spinlock *splk)
 		mycpu = NULL;
 	}
 
-	while (1) {
-		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
-		 */
-		if (spinlock_data_get(&splk->splk_lock) != 0) {
-			continue;
-		}
-		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
-			continue;
-		}
-		break;
+#if OPT_LOCKPROF
+	/* Anonymous spinlocks aren't profiled; don't pay for the clock. */
+	waitstart = splk->splk_prof.lp_name != NULL ? lockprof_now() : 0;
+#endif
+	if (splk->splk_ticket) {
+		contended = spinlock_wait_ticket(splk);
+	}
+	else {
+		contended = spinlock_wait_tas(splk);
 	}
 
 	membar_store_any();
 	splk->splk_holder = mycpu;
+#if OPT_LOCKPROF
+	lockprof_acquired(&splk->splk_prof, waitstart, contended);
+#else
+	(void)contended;
+#endif
 }
 
 /*
@@ -127,9 +205,19 @@ spinlock_release(struct spinlock *splk)
 		curcpu->c_spinlocks--;
 	}
 
+#if OPT_LOCKPROF
+	lockprof_releasing(&splk->splk_prof);
+#endif
 	splk->splk_holder = NULL;
 	membar_any_store();
-	spinlock_data_set(&splk->splk_lock, 0);
+	if (splk->splk_ticket) {
+		/* Serve the next ticket. Only the holder writes this. */
+		spinlock_data_set(&splk->splk_lock,
+				  spinlock_data_get(&splk->splk_lock) + 1);
+	}
+	else {
+		spinlock_data_set(&splk->splk_lock, 0);
+	}
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
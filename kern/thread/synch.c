@@ -33,13 +33,27 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
+#include <cpu.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
 
+/*
+ * Maximum number of times lock_acquire polls a running holder before
+ * giving up and going to sleep.
+ */
+#define LOCK_SPIN_MAX	1000
+
+/*
+ * Longest chain of lock holders priority inheritance follows. Chains
+ * are normally short; this just keeps a deadlock cycle from looping.
+ */
+#define PI_MAXDEPTH	16
+
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
@@ -120,6 +134,33 @@ P(struct semaphore *sem)
 	spinlock_release(&sem->sem_lock);
 }
 
+int
+P_timed(struct semaphore *sem, unsigned ticks)
+{
+	struct wchan_timeout wt;
+	int result;
+
+        KASSERT(sem != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&sem->sem_lock);
+	wchan_timeout_start(&wt, sem->sem_wchan, &sem->sem_lock, ticks);
+        while (sem->sem_count == 0 && !wt.wt_timedout) {
+		wchan_sleep(sem->sem_wchan, &sem->sem_lock);
+        }
+	if (sem->sem_count > 0) {
+		sem->sem_count--;
+		result = 0;
+	}
+	else {
+		result = ETIMEDOUT;
+	}
+	spinlock_release(&sem->sem_lock);
+	wchan_timeout_stop(&wt);
+
+	return result;
+}
+
 void
 V(struct semaphore *sem)
 {
@@ -162,6 +203,12 @@ lock_create(const char *name)
 	}
 	spinlock_init(&lock->lk_lock);
 	lock->lk_holder = NULL;
+	lock->lk_holdercpu = NULL;
+	lock->lk_waitlevel = SCHED_NLEVELS;
+	lock->lk_heldnext = NULL;
+#if OPT_LOCKPROF
+	lockprof_init(&lock->lk_prof, lock->lk_name);
+#endif
 
         return lock;
 }
@@ -172,6 +219,9 @@ lock_destroy(struct lock *lock)
         KASSERT(lock != NULL);
 
 	KASSERT(lock->lk_holder == NULL);
+#if OPT_LOCKPROF
+	lockprof_cleanup(&lock->lk_prof);
+#endif
 	spinlock_cleanup(&lock->lk_lock);
 	wchan_destroy(lock->lk_wchan);
 
@@ -179,6 +229,261 @@ lock_destroy(struct lock *lock)
         kfree(lock);
 }
 
+/*
+ * Priority inheritance.
+ *
+ * pi_lock protects the inheritance state: each lock's lk_waitlevel
+ * and lk_heldnext, each thread's t_heldlocks and t_blockedon, and
+ * changes to t_inherit. Changes of lk_holder are made under it too,
+ * so that a chain of holders can be followed from one lock to the
+ * next without taking their spinlocks, which could deadlock. It comes
+ * after the lock spinlocks and before the run queue locks.
+ *
+ * lk_waitlevel only ever improves while the lock is held (a sleeper
+ * only leaves by being handed the lock), so it's recomputed from the
+ * sleepers when the lock changes hands.
+ *
+ * Threads that cv_signal/cv_broadcast moved onto a lock's wait
+ * channel lend their level to its holder, but don't have t_blockedon
+ * set, so a chain that reaches one of them stops there.
+ *
+ * A free lock with lk_waitlevel at SCHED_NLEVELS has nobody blocked
+ * on it, so no chain can reach it; such a lock can be taken, and let
+ * go of again if still nobody is waiting, under just its spinlock,
+ * which keeps new waiters out meanwhile. See pi_take_fast and
+ * pi_drop_fast. pi_lock is only needed once there's contention.
+ *
+ * Reader-writer locks don't do any of this.
+ */
+static struct spinlock pi_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Lend LEVEL to the holder of LOCK, and on down the chain.
+ */
+static
+void
+pi_boost(struct lock *lock, unsigned level)
+{
+	struct thread *holder;
+	unsigned depth;
+
+	KASSERT(spinlock_do_i_hold(&pi_lock));
+
+	for (depth = 0; lock != NULL && depth < PI_MAXDEPTH; depth++) {
+		if (level >= lock->lk_waitlevel) {
+			/* Already lent at least this much from here on. */
+			break;
+		}
+		lock->lk_waitlevel = level;
+
+		holder = lock->lk_holder;
+		if (holder == NULL) {
+			break;
+		}
+		if (level < holder->t_inherit) {
+			thread_setinherit(holder, level);
+		}
+		lock = holder->t_blockedon;
+	}
+}
+
+/*
+ * LOCK's sleepers may have changed; pass on their best level.
+ */
+static
+void
+pi_waiters(struct lock *lock)
+{
+	unsigned level;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+	/* lk_waitlevel can't go up while we hold the spinlock. */
+	level = wchan_bestlevel(lock->lk_wchan, &lock->lk_lock);
+	if (level >= lock->lk_waitlevel) {
+		return;
+	}
+
+	spinlock_acquire(&pi_lock);
+	pi_boost(lock, level);
+	spinlock_release(&pi_lock);
+}
+
+/*
+ * Make T the holder of LOCK, which it inherits from.
+ */
+static
+void
+pi_take(struct lock *lock, struct thread *t)
+{
+	KASSERT(spinlock_do_i_hold(&pi_lock));
+	KASSERT(lock->lk_holder == NULL);
+
+	lock->lk_holder = t;
+	lock->lk_heldnext = t->t_heldlocks;
+	t->t_heldlocks = lock;
+	t->t_blockedon = NULL;
+	if (lock->lk_waitlevel < t->t_inherit) {
+		thread_setinherit(t, lock->lk_waitlevel);
+	}
+}
+
+/*
+ * Make the current thread the holder of LOCK without pi_lock, if
+ * nobody has lent LOCK a level (and so nobody can be following a
+ * chain to it). Returns false if pi_take is needed instead.
+ */
+static
+bool
+pi_take_fast(struct lock *lock)
+{
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+	KASSERT(lock->lk_holder == NULL);
+	KASSERT(curthread->t_blockedon == NULL);
+
+	if (lock->lk_waitlevel != SCHED_NLEVELS) {
+		return false;
+	}
+	lock->lk_holder = curthread;
+	lock->lk_heldnext = curthread->t_heldlocks;
+	curthread->t_heldlocks = lock;
+	return true;
+}
+
+/*
+ * Let go of LOCK without pi_lock, if nobody is waiting for it. It
+ * isn't lending us anything then, so our level stays as it is.
+ * Returns false if pi_drop is needed instead.
+ */
+static
+bool
+pi_drop_fast(struct lock *lock)
+{
+	struct lock **lp;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+	KASSERT(lock->lk_holder == curthread);
+
+	if (lock->lk_waitlevel != SCHED_NLEVELS ||
+	    !wchan_isempty(lock->lk_wchan, &lock->lk_lock)) {
+		return false;
+	}
+	lp = &curthread->t_heldlocks;
+	while (*lp != lock) {
+		KASSERT(*lp != NULL);
+		lp = &(*lp)->lk_heldnext;
+	}
+	*lp = lock->lk_heldnext;
+	lock->lk_heldnext = NULL;
+	lock->lk_holder = NULL;
+	return true;
+}
+
+/*
+ * The current thread is letting go of LOCK. Stop inheriting from it.
+ */
+static
+void
+pi_drop(struct lock *lock)
+{
+	struct lock **lp;
+	unsigned level;
+
+	KASSERT(spinlock_do_i_hold(&pi_lock));
+	KASSERT(lock->lk_holder == curthread);
+
+	level = SCHED_NLEVELS;
+	lp = &curthread->t_heldlocks;
+	while (*lp != NULL) {
+		if (*lp == lock) {
+			*lp = lock->lk_heldnext;
+			continue;
+		}
+		if ((*lp)->lk_waitlevel < level) {
+			level = (*lp)->lk_waitlevel;
+		}
+		lp = &(*lp)->lk_heldnext;
+	}
+	lock->lk_heldnext = NULL;
+	lock->lk_holder = NULL;
+
+	if (level != curthread->t_inherit) {
+		thread_setinherit(curthread, level);
+	}
+}
+
+/*
+ * Check (without locking) whether the holder of LOCK is running right
+ * now on some other cpu. If so it's probably about to let go, and
+ * it's cheaper to spin than to sleep and be woken up.
+ */
+static
+bool
+lock_holder_running(struct lock *lock)
+{
+	struct thread *holder;
+	volatile struct cpu *c;
+
+	holder = lock->lk_holder;
+	c = lock->lk_holdercpu;
+	if (holder == NULL || c == NULL || c == curcpu->c_self) {
+		return false;
+	}
+	return c->c_curthread == holder && !c->c_isidle;
+}
+
+/*
+ * Wait until LOCK is ours, then take it. The lock's spinlock must be
+ * held; it's released on return. lock_release hands the lock straight
+ * to the thread it wakes, so a waiter may find on waking that it
+ * already holds it; likewise a cv waiter that cv_signal/cv_broadcast
+ * moved onto the lock's wait channel.
+ */
+static
+void
+lock_wait(struct lock *lock)
+{
+	unsigned spins = 0;
+#if OPT_LOCKPROF
+	uint64_t waitstart;
+	bool contended;
+
+	waitstart = lockprof_now();
+	contended = lock->lk_holder != NULL;
+#endif
+
+	while (lock->lk_holder != NULL && lock->lk_holder != curthread) {
+		if (spins < LOCK_SPIN_MAX && lock_holder_running(lock)) {
+			/* Spin without the spinlock, then check again. */
+			spinlock_release(&lock->lk_lock);
+			while (spins < LOCK_SPIN_MAX &&
+			       lock_holder_running(lock)) {
+				spins++;
+			}
+			spinlock_acquire(&lock->lk_lock);
+			continue;
+		}
+		/* Lend our level to the holder, and sleep. */
+		spinlock_acquire(&pi_lock);
+		curthread->t_blockedon = lock;
+		pi_boost(lock, thread_schedlevel(curthread));
+		spinlock_release(&pi_lock);
+                wchan_sleep(lock->lk_wchan, &lock->lk_lock);
+	}
+
+	if (lock->lk_holder == NULL && !pi_take_fast(lock)) {
+		spinlock_acquire(&pi_lock);
+		pi_take(lock, curthread);
+		spinlock_release(&pi_lock);
+	}
+	KASSERT(curthread->t_blockedon == NULL);
+	lock->lk_holdercpu = curcpu->c_self;
+#if OPT_LOCKPROF
+	lockprof_acquired(&lock->lk_prof, waitstart, contended);
+#endif
+	spinlock_release(&lock->lk_lock);
+}
+
 void
 lock_acquire(struct lock *lock)
 {
@@ -187,13 +492,36 @@ lock_acquire(struct lock *lock)
 
 	spinlock_acquire(&lock->lk_lock);
 	KASSERT(lock->lk_holder != curthread);
-	while (lock->lk_holder != NULL) {
-		/* As in the semaphore. */
-                wchan_sleep(lock->lk_wchan, &lock->lk_lock);
-	}
+	lock_wait(lock);
+}
 
-	lock->lk_holder = curthread;
-	spinlock_release(&lock->lk_lock);
+/*
+ * Give LOCK to the first thread waiting for it, if any, and wake it
+ * up; otherwise leave it free. Handing it over directly, rather than
+ * letting the waiter compete for it once it runs, means a thread that
+ * comes along in the meantime can't take it first and send the waiter
+ * back to sleep. The lock's spinlock must be held.
+ */
+static
+void
+lock_handoff(struct lock *lock)
+{
+	struct thread *next;
+
+	lock->lk_holdercpu = NULL;
+	if (lock->lk_holder != NULL && pi_drop_fast(lock)) {
+		return;
+	}
+	spinlock_acquire(&pi_lock);
+	if (lock->lk_holder != NULL) {
+		pi_drop(lock);
+	}
+	next = wchan_wakeone_thread(lock->lk_wchan, &lock->lk_lock);
+	lock->lk_waitlevel = wchan_bestlevel(lock->lk_wchan, &lock->lk_lock);
+	if (next != NULL) {
+		pi_take(lock, next);
+	}
+	spinlock_release(&pi_lock);
 }
 
 void
@@ -203,8 +531,10 @@ lock_release(struct lock *lock)
 
 	spinlock_acquire(&lock->lk_lock);
 	KASSERT(lock->lk_holder == curthread);
-	lock->lk_holder = NULL;
-	wchan_wakeone(lock->lk_wchan, &lock->lk_lock);
+#if OPT_LOCKPROF
+	lockprof_releasing(&lock->lk_prof);
+#endif
+	lock_handoff(lock);
 	spinlock_release(&lock->lk_lock);
 }
 
@@ -266,6 +596,19 @@ cv_destroy(struct cv *cv)
         kfree(cv);
 }
 
+/*
+ * Get LOCK back after sleeping on a CV. If cv_signal or cv_broadcast
+ * moved us to the lock's wait channel, lock_release has already
+ * handed it to us.
+ */
+static
+void
+cv_relock(struct lock *lock)
+{
+	spinlock_acquire(&lock->lk_lock);
+	lock_wait(lock);
+}
+
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
@@ -281,23 +624,262 @@ cv_wait(struct cv *cv, struct lock *lock)
 	 * logic to make that work cleanly.
 	 */
 	spinlock_release(&cv->cv_wchanlock);
-	lock_acquire(lock);
+	cv_relock(lock);
 }
 
-void
-cv_signal(struct cv *cv, struct lock *lock)
+int
+cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks)
 {
-	(void)lock;
+	struct wchan_timeout wt;
+	bool timedout;
+
 	spinlock_acquire(&cv->cv_wchanlock);
-	wchan_wakeone(cv->cv_wchan, &cv->cv_wchanlock);
+	lock_release(lock);
+	wchan_timeout_start(&wt, cv->cv_wchan, &cv->cv_wchanlock, ticks);
+	wchan_sleep(cv->cv_wchan, &cv->cv_wchanlock);
+	timedout = wt.wt_timedout;
 	spinlock_release(&cv->cv_wchanlock);
+	wchan_timeout_stop(&wt);
+	cv_relock(lock);
+
+	return timedout ? ETIMEDOUT : 0;
 }
 
+/*
+ * Signalling uses wait morphing: rather than waking the waiters only
+ * for them to find the lock held (by the signaller, normally) and go
+ * back to sleep on it, move them straight to the lock's wait channel.
+ * They then get woken one at a time as the lock is passed along. If
+ * the caller doesn't hold the lock and nobody else does either, hand
+ * it to the first of them right away, since no release is coming.
+ */
+static
 void
-cv_broadcast(struct cv *cv, struct lock *lock)
+cv_morph(struct cv *cv, struct lock *lock, bool all)
 {
-	(void)lock;
 	spinlock_acquire(&cv->cv_wchanlock);
-	wchan_wakeall(cv->cv_wchan, &cv->cv_wchanlock);
+	spinlock_acquire(&lock->lk_lock);
+	wchan_move(cv->cv_wchan, &cv->cv_wchanlock,
+		   lock->lk_wchan, &lock->lk_lock, all);
+	if (lock->lk_holder == NULL) {
+		lock_handoff(lock);
+	}
+	else {
+		/* They're waiting for the lock now. */
+		pi_waiters(lock);
+	}
+	spinlock_release(&lock->lk_lock);
 	spinlock_release(&cv->cv_wchanlock);
 }
+
+void
+cv_signal(struct cv *cv, struct lock *lock)
+{
+	cv_morph(cv, lock, false);
+}
+
+void
+cv_broadcast(struct cv *cv, struct lock *lock)
+{
+	cv_morph(cv, lock, true);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+        struct rwlock *rw;
+
+        rw = kmalloc(sizeof(struct rwlock));
+        if (rw == NULL) {
+                return NULL;
+        }
+
+        rw->rw_name = kstrdup(name);
+        if (rw->rw_name == NULL) {
+                kfree(rw);
+                return NULL;
+        }
+
+	rw->rw_rwchan = wchan_create(rw->rw_name);
+	if (rw->rw_rwchan == NULL) {
+		kfree(rw->rw_name);
+		kfree(rw);
+		return NULL;
+	}
+	rw->rw_wwchan = wchan_create(rw->rw_name);
+	if (rw->rw_wwchan == NULL) {
+		wchan_destroy(rw->rw_rwchan);
+		kfree(rw->rw_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	spinlock_init(&rw->rw_lock);
+	rw->rw_readers = 0;
+	rw->rw_readwait = 0;
+	rw->rw_writewait = 0;
+	rw->rw_readpass = 0;
+	rw->rw_writer = NULL;
+#if OPT_LOCKPROF
+	lockprof_init(&rw->rw_prof, rw->rw_name);
+#endif
+
+        return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(rw->rw_writer == NULL);
+#if OPT_LOCKPROF
+	lockprof_cleanup(&rw->rw_prof);
+#endif
+	spinlock_cleanup(&rw->rw_lock);
+	wchan_destroy(rw->rw_wwchan);
+	wchan_destroy(rw->rw_rwchan);
+
+        kfree(rw->rw_name);
+        kfree(rw);
+}
+
+/*
+ * A reader may go in if there's no writer and either no writer is
+ * waiting or it's one of the readers a departing writer let through
+ * (rw_readpass). Those passes hold off the next writer until they're
+ * used up.
+ */
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+#if OPT_LOCKPROF
+	uint64_t waitstart, holdstart;
+	bool contended;
+#endif
+
+	DEBUGASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+#if OPT_LOCKPROF
+	waitstart = lockprof_now();
+	contended = rw->rw_writer != NULL || rw->rw_writewait > 0;
+#endif
+	if (rw->rw_writer != NULL || rw->rw_writewait > 0) {
+		rw->rw_readwait++;
+		while (rw->rw_writer != NULL ||
+		       (rw->rw_writewait > 0 && rw->rw_readpass == 0)) {
+			wchan_sleep(rw->rw_rwchan, &rw->rw_lock);
+		}
+		rw->rw_readwait--;
+		if (rw->rw_readpass > 0) {
+			rw->rw_readpass--;
+		}
+	}
+	rw->rw_readers++;
+#if OPT_LOCKPROF
+	/* Joining other readers doesn't start a new hold. */
+	holdstart = rw->rw_prof.lp_holdstart;
+	lockprof_acquired(&rw->rw_prof, waitstart, contended);
+	if (rw->rw_readers > 1) {
+		rw->rw_prof.lp_holdstart = holdstart;
+	}
+#endif
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_readers > 0);
+	rw->rw_readers--;
+#if OPT_LOCKPROF
+	if (rw->rw_readers == 0) {
+		lockprof_releasing(&rw->rw_prof);
+	}
+#endif
+	if (rw->rw_readers == 0 && rw->rw_readpass == 0) {
+		wchan_wakeone(rw->rw_wwchan, &rw->rw_lock);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+#if OPT_LOCKPROF
+	uint64_t waitstart;
+	bool contended;
+#endif
+
+	DEBUGASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+#if OPT_LOCKPROF
+	waitstart = lockprof_now();
+	contended = rw->rw_writer != NULL || rw->rw_readers > 0 ||
+		rw->rw_readpass > 0;
+#endif
+	rw->rw_writewait++;
+	while (rw->rw_writer != NULL || rw->rw_readers > 0 ||
+	       rw->rw_readpass > 0) {
+		wchan_sleep(rw->rw_wwchan, &rw->rw_lock);
+	}
+	rw->rw_writewait--;
+	rw->rw_writer = curthread;
+#if OPT_LOCKPROF
+	lockprof_acquired(&rw->rw_prof, waitstart, contended);
+#endif
+	spinlock_release(&rw->rw_lock);
+}
+
+/*
+ * On release, readers that queued up behind us go first; otherwise
+ * hand over to the next writer.
+ */
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer == curthread);
+#if OPT_LOCKPROF
+	lockprof_releasing(&rw->rw_prof);
+#endif
+	rw->rw_writer = NULL;
+	if (rw->rw_readwait > 0) {
+		rw->rw_readpass = rw->rw_readwait;
+		wchan_wakeall(rw->rw_rwchan, &rw->rw_lock);
+	}
+	else {
+		wchan_wakeone(rw->rw_wwchan, &rw->rw_lock);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+	bool ret;
+
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	ret = (rw->rw_writer == curthread);
+	spinlock_release(&rw->rw_lock);
+
+        return ret;
+}
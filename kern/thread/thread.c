@@ -35,6 +35,8 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <kern/wait.h>
 #include <limits.h>
 #include <lib.h>
@@ -42,7 +44,9 @@
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <atomic.h>
 #include <wchan.h>
+#include <clock.h>
 #include <thread.h>
 #include <threadlist.h>
 #include <threadprivate.h>
@@ -58,6 +62,12 @@
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/* Default base scheduler quantum, in hardclocks. */
+#define SCHED_QUANTUM_DEFAULT 1
+
+/* Threads that ran within this many hardclocks are not stolen. */
+#define SCHED_CACHEHOT_HARDCLOCKS 2
+
 /* Wait channel. A wchan is protected by an associated, passed-in spinlock. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
@@ -79,6 +89,9 @@ static struct wchanarray allwchans;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* Base scheduler quantum; see thread_setquantum(). */
+static unsigned sched_quantum = SCHED_QUANTUM_DEFAULT;
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -118,6 +131,112 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+////////////////////////////////////////////////////////////
+
+/*
+ * Run queues.
+ *
+ * Each cpu has one run queue per scheduler level. A thread's level
+ * starts at the best level its niceness allows; it drops a level each
+ * time it uses up a whole time slice, and rises a level each time it
+ * blocks before doing so. Less favoured levels get longer slices.
+ * schedule() periodically lifts everyone back up so that CPU-bound
+ * threads at the bottom don't starve.
+ */
+
+/*
+ * Best level a thread may occupy, based on its niceness. Nice 0
+ * lands a bit above the middle, leaving room both ways.
+ */
+static
+unsigned
+sched_toplevel(const struct thread *t)
+{
+	KASSERT(t->t_nice >= PRIO_MIN && t->t_nice <= PRIO_MAX);
+	return (unsigned)(t->t_nice - PRIO_MIN) * SCHED_NLEVELS
+		/ (PRIO_MAX - PRIO_MIN + 1);
+}
+
+/*
+ * Length of a time slice at level LEVEL.
+ */
+static
+unsigned
+sched_slice(unsigned level)
+{
+	return sched_quantum * (level + 1);
+}
+
+/*
+ * The level a thread actually runs at. A thread holding a lock that
+ * better-placed threads are waiting for runs at the best of their
+ * levels (see synch.c), so that it can't be held off indefinitely by
+ * threads in between and keep them all waiting.
+ */
+unsigned
+thread_schedlevel(const struct thread *t)
+{
+	return t->t_inherit < t->t_priority ? t->t_inherit : t->t_priority;
+}
+
+/*
+ * Put a thread at the tail of the run queue for its level.
+ */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+	KASSERT(t->t_priority < SCHED_NLEVELS);
+
+	threadlist_addtail(&c->c_runqueue[thread_schedlevel(t)], t);
+	c->c_runqueue_count++;
+}
+
+/*
+ * Take the next thread to run: the head of the best nonempty level.
+ */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		t = threadlist_remhead(&c->c_runqueue[i]);
+		if (t != NULL) {
+			c->c_runqueue_count--;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Return the best level that has a runnable thread on it, or
+ * SCHED_NLEVELS if the run queues are empty.
+ */
+static
+unsigned
+runqueue_toplevel(struct cpu *c)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			break;
+		}
+	}
+	return i;
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -146,16 +265,35 @@ thread_create(const char *name)
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
+	thread->t_wchan = NULL;
 	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
 
+	/* Scheduler fields */
+	thread->t_nice = 0;
+	thread->t_priority = sched_toplevel(thread);
+	thread->t_quantum = sched_slice(thread->t_priority);
+	thread->t_lastran = 0;
+	thread->t_inherit = SCHED_NLEVELS;
+	schedstats_zero(&thread->t_stats);
+	thread->t_readysince = 0;
+	thread->t_readyidle = false;
+
+	/* Priority inheritance fields */
+	thread->t_heldlocks = NULL;
+	thread->t_blockedon = NULL;
+
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+	/* Public fields */
+	thread->t_utid = 0;
+	thread->t_ascopy = NULL;
+
 	/* If you add to struct thread, be sure to initialize here */
 
 	return thread;
@@ -174,6 +312,7 @@ cpu_create(unsigned hardware_number)
 {
 	struct cpu *c;
 	int result;
+	unsigned i;
 	char namebuf[16];
 
 	c = kmalloc(sizeof(*c));
@@ -186,17 +325,29 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
-	c->c_hardclocks = 0;
+	c->c_idleticks = 0;
 	c->c_spinlocks = 0;
+	c->c_irq_fromuser = false;
+	for (i=0; i<CPUSTAT_NUM; i++) {
+		atomic_set(&c->c_stats[i], 0);
+	}
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
-	spinlock_init(&c->c_runqueue_lock);
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	c->c_runqueue_count = 0;
+	/* taken by other cpus for wakeups and migration; keep it fair */
+	spinlock_init_ticket(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdown_seq = 0;
+	c->c_shootdown_done = 0;
 	spinlock_init(&c->c_ipi_lock);
 
+	callout_wheel_init(&c->c_callouts);
+
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
@@ -235,6 +386,96 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+/*
+ * Per-cpu statistics.
+ *
+ * The counters are updated with an atomic add. That's not there to
+ * keep other cpus out (they don't write our counters) but to make the
+ * update safe against interrupts and against the thread being moved
+ * to another cpu halfway through, without having to touch the spl;
+ * either way the count lands on some cpu and the sum comes out right.
+ * Counts from before the first cpu is set up go in cpustat_early.
+ */
+
+static volatile int cpustat_early[CPUSTAT_NUM];
+
+static const char *const cpustat_names[CPUSTAT_NUM] = {
+	"clocks", "skipped", "traps", "syscalls", "faults", "evicts",
+	"pages", "idle",
+};
+
+void
+cpustat_add(unsigned which, int n)
+{
+	KASSERT(which < CPUSTAT_NUM);
+
+	if (CURCPU_EXISTS()) {
+		atomic_add(&curcpu->c_stats[which], n);
+	}
+	else {
+		atomic_add(&cpustat_early[which], n);
+	}
+}
+
+void
+cpustat_inc(unsigned which)
+{
+	cpustat_add(which, 1);
+}
+
+unsigned
+cpustat_get(struct cpu *c, unsigned which)
+{
+	KASSERT(which < CPUSTAT_NUM);
+	return atomic_get(&c->c_stats[which]);
+}
+
+unsigned
+cpustat_sum(unsigned which)
+{
+	unsigned i, total;
+
+	KASSERT(which < CPUSTAT_NUM);
+
+	total = atomic_get(&cpustat_early[which]);
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		total += cpustat_get(cpuarray_get(&allcpus, i), which);
+	}
+	return total;
+}
+
+/*
+ * Print the per-cpu statistics, for the menu. The counters belong
+ * to their own cpus and aren't locked; this is only a snapshot.
+ */
+void
+cpu_printstats(void)
+{
+	struct cpu *c;
+	unsigned i, j;
+
+	kprintf("%-6s", "");
+	for (j=0; j<CPUSTAT_NUM; j++) {
+		kprintf(" %9s", cpustat_names[j]);
+	}
+	kprintf("\n");
+
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		kprintf("cpu%-3u", c->c_number);
+		for (j=0; j<CPUSTAT_NUM; j++) {
+			kprintf(" %9d", (int)cpustat_get(c, j));
+		}
+		kprintf("\n");
+	}
+
+	kprintf("%-6s", "total");
+	for (j=0; j<CPUSTAT_NUM; j++) {
+		kprintf(" %9u", cpustat_sum(j));
+	}
+	kprintf("\n");
+}
+
 /*
  * Destroy a thread.
  *
@@ -297,6 +538,8 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -311,9 +554,14 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
-	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		curcpu->c_runqueue[i].tl_count = 0;
+		curcpu->c_runqueue[i].tl_head.tln_next =
+			&curcpu->c_runqueue[i].tl_tail;
+		curcpu->c_runqueue[i].tl_tail.tln_prev =
+			&curcpu->c_runqueue[i].tl_head;
+	}
+	curcpu->c_runqueue_count = 0;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -465,9 +713,18 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
 	}
 
-	/* Target thread is now ready to run; put it on the run queue. */
+	/*
+	 * Target thread is now ready to run; put it on the run queue.
+	 * If its niceness went up since it last ran, this is where
+	 * that takes effect.
+	 */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	target->t_readysince = cpustat_get(targetcpu, CPUSTAT_HARDCLOCKS);
+	target->t_readyidle = targetcpu->c_isidle;
+	if (target->t_priority < sched_toplevel(target)) {
+		target->t_priority = sched_toplevel(target);
+	}
+	runqueue_add(targetcpu, target);
 
 	if (targetcpu->c_isidle) {
 		/*
@@ -521,6 +778,11 @@ thread_fork(const char *name,
 	/* Thread subsystem fields */
 	newthread->t_cpu = curthread->t_cpu;
 
+	/* Niceness is inherited; the level starts over at the top. */
+	newthread->t_nice = curthread->t_nice;
+	newthread->t_priority = sched_toplevel(newthread);
+	newthread->t_quantum = sched_slice(newthread->t_priority);
+
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
 		proc = curthread->t_proc;
@@ -548,6 +810,113 @@ thread_fork(const char *name,
 	return 0;
 }
 
+/*
+ * Work stealing.
+ *
+ * When a cpu runs out of work it takes a thread from whichever other
+ * cpu has the most threads waiting. The counts (and the victim's
+ * hardclock count) are read without locking, as hints; only the
+ * victim's run queue gets locked. We
+ * take the best-level thread that has not run very recently, since a
+ * thread that just ran still has warm cache state where it is.
+ *
+ * Migrating threads isn't free because of cache affinity, and the
+ * right tradeoff is probably workload-specific. Because System/161
+ * does not (yet) model such cache effects, we only hold back threads
+ * for a couple of hardclocks.
+ *
+ * Called from the idle loop in thread_switch, with interrupts off and
+ * no run queue locked. Returns a thread that now belongs to this cpu
+ * and is on no run queue, or NULL.
+ */
+static
+struct thread *
+thread_steal(void)
+{
+	struct cpu *c, *victim;
+	struct thread *t;
+	unsigned i, numcpus, most, level;
+
+	victim = NULL;
+	most = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self && c->c_runqueue_count > most) {
+			most = c->c_runqueue_count;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	for (level=0; level<SCHED_NLEVELS; level++) {
+		THREADLIST_FORALL(t, victim->c_runqueue[level]) {
+			/*
+			 * Ordinarily, the victim's curthread will not
+			 * appear on its run queue. However, it can under
+			 * the following circumstances:
+			 *   - it went to sleep;
+			 *   - the processor became idle, so it
+			 *     remained curthread;
+			 *   - it was reawakened, so it was put on the
+			 *     run queue;
+			 *   - and the processor hasn't fully unidled
+			 *     yet, so all these things are still true.
+			 *
+			 * The victim is still running on that thread's
+			 * stack, so it must not be taken.
+			 */
+			if (t == victim->c_curthread) {
+				continue;
+			}
+			if (cpustat_get(victim, CPUSTAT_HARDCLOCKS) -
+			    t->t_lastran < SCHED_CACHEHOT_HARDCLOCKS) {
+				continue;
+			}
+			threadlist_remove(&victim->c_runqueue[level], t);
+			victim->c_runqueue_count--;
+			t->t_cpu = curcpu->c_self;
+			spinlock_release(&victim->c_runqueue_lock);
+
+			DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+			      t->t_name, victim->c_number, curcpu->c_number);
+			return t;
+		}
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+	return NULL;
+}
+
+/*
+ * Charge a thread that's about to run for the time it spent on a run
+ * queue. If it was stolen from another cpu it was queued by that
+ * cpu's clock, which can be a little off from ours; don't let that
+ * make the wait negative.
+ *
+ * A thread queued on an idle cpu isn't charged anything. There was
+ * nothing for it to wait behind, and the hardclock count it was
+ * stamped with may be behind by a whole tickless stretch, which
+ * hardclock_unidle adds back on once the cpu wakes.
+ */
+static
+void
+thread_chargewait(struct thread *t)
+{
+	unsigned now, wait;
+
+	if (t->t_readyidle) {
+		return;
+	}
+	now = cpustat_get(curcpu->c_self, CPUSTAT_HARDCLOCKS);
+	wait = now - t->t_readysince;
+	if ((int)wait > 0) {
+		t->t_stats.ss_waitticks += wait;
+	}
+}
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -588,21 +957,36 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/*
+	 * Micro-optimization: if nothing to do, just return. Yielding
+	 * only gives way to threads at our own level or better.
+	 */
+	if (newstate == S_READY &&
+	    runqueue_toplevel(curcpu) > thread_schedlevel(cur)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
 	}
 
+	/* Note when we stopped running, for thread_steal. */
+	cur->t_lastran = cpustat_get(curcpu->c_self, CPUSTAT_HARDCLOCKS);
+
 	/* Put the thread in the right place. */
 	switch (newstate) {
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
+		/* From the timer interrupt means we were preempted. */
+		if (cur->t_in_interrupt) {
+			cur->t_stats.ss_nivcsw++;
+		}
+		else {
+			cur->t_stats.ss_nvcsw++;
+		}
 		thread_make_runnable(cur, true /*have lock*/);
 		break;
 	    case S_SLEEP:
+		cur->t_stats.ss_nvcsw++;
 		cur->t_wchan_name = wc->wc_name;
 		/*
 		 * Add the thread to the list in the wait channel, and
@@ -613,6 +997,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		 * on the list.
 		 */
 		threadlist_addtail(&wc->wc_threads, cur);
+		cur->t_wchan = wc;
 		spinlock_release(lk);
 		break;
 	    case S_ZOMBIE:
@@ -623,8 +1008,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	cur->t_state = newstate;
 
 	/*
-	 * Get the next thread. While there isn't one, call md_idle().
-	 * curcpu->c_isidle must be true when md_idle is
+	 * Get the next thread. While there isn't one, try to steal
+	 * one from another cpu, and failing that call cpu_idle().
+	 * curcpu->c_isidle must be true when cpu_idle is
 	 * called. Unlock the runqueue while idling too, to make sure
 	 * things can be added to it.
 	 *
@@ -634,6 +1020,11 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	 * interrupt from another cpu posting a wakeup) and idling
 	 * *is* atomic with respect to re-enabling interrupts.
 	 *
+	 * While idle the timer is allowed to skip ticks (see
+	 * hardclock_idle), so an idle cpu isn't woken up HZ times a
+	 * second for nothing. Busy cpus with threads waiting kick it
+	 * with IPI_UNIDLE from thread_timeslice to come steal them.
+	 *
 	 * Note that c_isidle becomes true briefly even if we don't go
 	 * idle. However, because one is supposed to hold the runqueue
 	 * lock to look at it, this should not be visible or matter.
@@ -642,15 +1033,22 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remhead(curcpu);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			next = thread_steal();
+			if (next == NULL) {
+				hardclock_idle();
+				cpu_idle();
+				hardclock_unidle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+	thread_chargewait(next);
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -795,6 +1193,9 @@ thread_exit(void)
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
+	/* Nobody could ever get a sleep lock we died holding. */
+	KASSERT(cur->t_heldlocks == NULL);
+
 	/* Interrupts off on this processor */
         splhigh();
 
@@ -817,141 +1218,232 @@ thread_yield(void)
 ////////////////////////////////////////////////////////////
 
 /*
- * Scheduler.
- *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * There are threads waiting on this cpu's run queue. If some other cpu
+ * is idle, wake it up to come steal one; idle cpus don't take timer
+ * interrupts to go looking by themselves. This only looks at the
+ * c_isidle flags as hints, so it may occasionally wake a cpu that was
+ * just unidling anyway.
  */
-
+static
 void
-schedule(void)
+thread_kick_idle(void)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	struct cpu *c;
+	unsigned i, numcpus;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self && c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
 }
 
 /*
- * Thread migration.
+ * Time slicing.
  *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
- *
- * Migrating threads isn't free because of cache affinity; a thread's
- * working cache set will end up having to be moved to the other CPU,
- * which is fairly slow. The tradeoff between this performance loss
- * and the performance loss due to underutilization of some CPUs is
- * something that needs to be tuned and probably is workload-specific.
- *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * This is called from hardclock() on every tick. A thread that uses
+ * up its whole slice drops a level and goes to the back of the line;
+ * otherwise it keeps the cpu unless a better-level thread is waiting.
  */
 void
-thread_consider_migration(void)
+thread_timeslice(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
-	struct cpu *c;
-	struct threadlist victims;
-	struct thread *t;
+	struct thread *cur;
+	bool expired, preempt;
 
-	my_count = total_count = 0;
-	numcpus = cpuarray_num(&allcpus);
-	for (i=0; i<numcpus; i++) {
-		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+	/* If we're idle there's nobody to charge. */
+	if (curcpu->c_isidle) {
+		return;
+	}
+
+	cur = curthread;
+	if (curcpu->c_irq_fromuser) {
+		cur->t_stats.ss_uticks++;
+	}
+	else {
+		cur->t_stats.ss_sticks++;
+	}
+
+	expired = false;
+	if (cur->t_quantum > 0) {
+		cur->t_quantum--;
+	}
+	if (cur->t_quantum == 0) {
+		if (cur->t_priority < SCHED_NLEVELS - 1) {
+			cur->t_priority++;
 		}
-		spinlock_release(&c->c_runqueue_lock);
+		cur->t_quantum = sched_slice(cur->t_priority);
+		expired = true;
 	}
 
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
+	/*
+	 * If nothing else is waiting there's no point in yielding, or
+	 * even in locking the run queue to look. (The unlocked count
+	 * may miss a thread being added right now; it'll be seen on
+	 * the next tick.)
+	 */
+	if (curcpu->c_runqueue_count == 0) {
 		return;
 	}
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
-	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+	thread_kick_idle();
+
+	if (expired) {
+		thread_yield();
+		return;
 	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	preempt = runqueue_toplevel(curcpu) < thread_schedlevel(cur);
 	spinlock_release(&curcpu->c_runqueue_lock);
 
-	for (i=0; i < numcpus && to_send > 0; i++) {
-		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
-		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
+	if (preempt) {
+		thread_yield();
+	}
+}
 
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
-			}
+/*
+ * Accounting helpers.
+ */
+void
+schedstats_zero(struct schedstats *ss)
+{
+	ss->ss_uticks = 0;
+	ss->ss_sticks = 0;
+	ss->ss_waitticks = 0;
+	ss->ss_nvcsw = 0;
+	ss->ss_nivcsw = 0;
+}
+
+void
+schedstats_add(struct schedstats *to, const struct schedstats *from)
+{
+	to->ss_uticks += from->ss_uticks;
+	to->ss_sticks += from->ss_sticks;
+	to->ss_waitticks += from->ss_waitticks;
+	to->ss_nvcsw += from->ss_nvcsw;
+	to->ss_nivcsw += from->ss_nivcsw;
+}
+
+/*
+ * A thread is being woken up after blocking before its slice ran
+ * out. Move it up a level and give it a fresh slice. The caller holds
+ * the lock for the wait channel the thread was sleeping on.
+ */
+static
+void
+thread_wakeup_boost(struct thread *t)
+{
+	if (t->t_priority > sched_toplevel(t)) {
+		t->t_priority--;
+	}
+	t->t_quantum = sched_slice(t->t_priority);
+}
+
+/*
+ * Scheduler.
+ *
+ * This is called periodically from hardclock(). It lifts every
+ * thread on the current CPU's run queues, and the current thread, back
+ * to the best level its niceness allows, so threads that have sunk to
+ * the bottom get to run at least once per period.
+ */
+void
+schedule(void)
+{
+	struct threadlist boosted;
+	struct thread *t;
+	unsigned i;
+
+	threadlist_init(&boosted);
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i=1; i<SCHED_NLEVELS; i++) {
+		while ((t = threadlist_remhead(&curcpu->c_runqueue[i]))
+		       != NULL) {
+			curcpu->c_runqueue_count--;
+			threadlist_addtail(&boosted, t);
 		}
+	}
+	while ((t = threadlist_remhead(&boosted)) != NULL) {
+		t->t_priority = sched_toplevel(t);
+		t->t_quantum = sched_slice(t->t_priority);
+		runqueue_add(curcpu, t);
+	}
+	if (!curcpu->c_isidle) {
+		t = curthread;
+		t->t_priority = sched_toplevel(t);
+		t->t_quantum = sched_slice(t->t_priority);
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	threadlist_cleanup(&boosted);
+}
+
+/*
+ * Get and set the base quantum.
+ */
+unsigned
+thread_getquantum(void)
+{
+	return sched_quantum;
+}
+
+void
+thread_setquantum(unsigned hardclocks)
+{
+	KASSERT(hardclocks > 0);
+	sched_quantum = hardclocks;
+}
+
+/*
+ * Change the level T inherits. Its run queue lock is what protects
+ * the level of a thread that's queued, so take that, chasing T if it
+ * gets stolen by another cpu in the meantime. A thread that's on the
+ * run queue is moved to the right level; one that's running or asleep
+ * picks up the change when it's next queued or preempted.
+ */
+void
+thread_setinherit(struct thread *t, unsigned level)
+{
+	struct cpu *c;
+	bool queued;
+
+	KASSERT(level <= SCHED_NLEVELS);
+
+	c = t->t_cpu;
+	spinlock_acquire(&c->c_runqueue_lock);
+	while (t->t_cpu != c) {
 		spinlock_release(&c->c_runqueue_lock);
+		c = t->t_cpu;
+		spinlock_acquire(&c->c_runqueue_lock);
 	}
 
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
-		}
-		spinlock_release(&curcpu->c_runqueue_lock);
+	/* Threads just taken off the queue to run are still S_READY. */
+	queued = t->t_state == S_READY && t->t_listnode.tln_prev != NULL;
+	if (queued) {
+		threadlist_remove(&c->c_runqueue[thread_schedlevel(t)], t);
+	}
+	t->t_inherit = level;
+	if (queued) {
+		threadlist_addtail(&c->c_runqueue[thread_schedlevel(t)], t);
 	}
 
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+	spinlock_release(&c->c_runqueue_lock);
+}
+
+/*
+ * Set a thread's niceness. The thread's level is adjusted when it is
+ * next queued (or boosted); see thread_make_runnable.
+ */
+void
+thread_setnice(struct thread *t, int nice)
+{
+	KASSERT(nice >= PRIO_MIN && nice <= PRIO_MAX);
+	t->t_nice = nice;
 }
 
 ////////////////////////////////////////////////////////////
@@ -1050,6 +1542,16 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
  */
 void
 wchan_wakeone(struct wchan *wc, struct spinlock *lk)
+{
+	(void)wchan_wakeone_thread(wc, lk);
+}
+
+/*
+ * Wake up one thread sleeping on a wait channel, and return it (or
+ * NULL if there wasn't one).
+ */
+struct thread *
+wchan_wakeone_thread(struct wchan *wc, struct spinlock *lk)
 {
 	struct thread *target;
 
@@ -1060,8 +1562,9 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 
 	if (target == NULL) {
 		/* Nobody was sleeping. */
-		return;
+		return NULL;
 	}
+	target->t_wchan = NULL;
 
 	/*
 	 * Note that thread_make_runnable acquires a runqueue lock
@@ -1071,7 +1574,9 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 	 * in thread_switch.
 	 */
 
+	thread_wakeup_boost(target);
 	thread_make_runnable(target, false);
+	return target;
 }
 
 /*
@@ -1092,6 +1597,7 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	 * private list.
 	 */
 	while ((target = threadlist_remhead(&wc->wc_threads)) != NULL) {
+		target->t_wchan = NULL;
 		threadlist_addtail(&list, target);
 	}
 
@@ -1101,12 +1607,104 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	 * make each thread runnable.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
+		thread_wakeup_boost(target);
 		thread_make_runnable(target, false);
 	}
 
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Move one or all threads sleeping on FROM over to TO, without waking
+ * them. Both channels' spinlocks must be held.
+ */
+void
+wchan_move(struct wchan *from, struct spinlock *fromlk,
+	   struct wchan *to, struct spinlock *tolk, bool all)
+{
+	struct thread *target;
+
+	KASSERT(spinlock_do_i_hold(fromlk));
+	KASSERT(spinlock_do_i_hold(tolk));
+
+	while ((target = threadlist_remhead(&from->wc_threads)) != NULL) {
+		target->t_wchan = to;
+		threadlist_addtail(&to->wc_threads, target);
+		if (!all) {
+			break;
+		}
+	}
+}
+
+unsigned
+wchan_bestlevel(struct wchan *wc, struct spinlock *lk)
+{
+	struct thread *t;
+	unsigned level, best;
+
+	KASSERT(spinlock_do_i_hold(lk));
+
+	best = SCHED_NLEVELS;
+	THREADLIST_FORALL(t, wc->wc_threads) {
+		level = thread_schedlevel(t);
+		if (level < best) {
+			best = level;
+		}
+	}
+	return best;
+}
+
+/*
+ * Timeout callout for wchan_timeout_start: if the thread is still
+ * asleep on the channel, wake it and note that it timed out.
+ */
+static
+void
+wchan_timeout(void *arg)
+{
+	struct wchan_timeout *wt = arg;
+	struct thread *target = wt->wt_thread;
+
+	spinlock_acquire(wt->wt_lock);
+	if (target->t_wchan == wt->wt_wchan) {
+		threadlist_remove(&wt->wt_wchan->wc_threads, target);
+		target->t_wchan = NULL;
+		wt->wt_timedout = true;
+		thread_wakeup_boost(target);
+		thread_make_runnable(target, false);
+	}
+	spinlock_release(wt->wt_lock);
+}
+
+/*
+ * Arrange for the current thread to be woken from WC, whose lock is
+ * LK, after TICKS hardclocks if nobody wakes it first.
+ */
+void
+wchan_timeout_start(struct wchan_timeout *wt, struct wchan *wc,
+		    struct spinlock *lk, unsigned ticks)
+{
+	KASSERT(spinlock_do_i_hold(lk));
+
+	wt->wt_thread = curthread;
+	wt->wt_wchan = wc;
+	wt->wt_lock = lk;
+	wt->wt_timedout = false;
+	callout_init(&wt->wt_callout, wchan_timeout, wt);
+	callout_schedule(&wt->wt_callout, ticks);
+}
+
+/*
+ * Cancel a timeout, waiting for it if it's firing right now. Must not
+ * hold the wchan's lock, since the timeout takes it.
+ */
+void
+wchan_timeout_stop(struct wchan_timeout *wt)
+{
+	KASSERT(!spinlock_do_i_hold(wt->wt_lock));
+	callout_stop(&wt->wt_callout);
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -1156,9 +1754,15 @@ ipi_broadcast(int code)
 	}
 }
 
-void
-ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+/*
+ * Queue a TLB shootdown on TARGET. Returns the number it'll have in
+ * c_shootdown_done once done.
+ */
+static
+unsigned
+ipi_tlbshootdown_send(struct cpu *target, const struct tlbshootdown *mapping)
 {
+	unsigned seq;
 	int n;
 
 	spinlock_acquire(&target->c_ipi_lock);
@@ -1172,10 +1776,61 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 		target->c_numshootdown = n+1;
 	}
 
+	seq = ++target->c_shootdown_seq;
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
 	mainbus_send_ipi(target);
 
 	spinlock_release(&target->c_ipi_lock);
+	return seq;
+}
+
+/*
+ * Wait for TARGET to get through shootdown number SEQ. Interrupts must
+ * be on: the target might be waiting on a shootdown we've been sent.
+ */
+static
+void
+ipi_tlbshootdown_wait(struct cpu *target, unsigned seq)
+{
+	KASSERT(curthread->t_iplhigh_count == 0);
+	KASSERT(curcpu->c_spinlocks == 0);
+
+	while ((int)(target->c_shootdown_done - seq) < 0) {
+		/* spin */
+	}
+}
+
+void
+ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+{
+	unsigned seq;
+
+	seq = ipi_tlbshootdown_send(target, mapping);
+	ipi_tlbshootdown_wait(target, seq);
+}
+
+void
+ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping)
+{
+	unsigned i;
+	struct cpu *c;
+
+	/*
+	 * Send them all first, then wait, so the cpus work in parallel.
+	 * Waiting for each cpu's latest shootdown covers ours too.
+	 */
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self) {
+			ipi_tlbshootdown_send(c, mapping);
+		}
+	}
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self) {
+			ipi_tlbshootdown_wait(c, c->c_shootdown_seq);
+		}
+	}
 }
 
 void
@@ -1220,6 +1875,7 @@ interprocessor_interrupt(void)
 			}
 		}
 		curcpu->c_numshootdown = 0;
+		curcpu->c_shootdown_done = curcpu->c_shootdown_seq;
 	}
 
 	curcpu->c_ipi_pending = 0;
@@ -38,6 +38,7 @@
 #include <lib.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <addrspace.h>
 
 
 /* Does most of the work for open(). */
@@ -136,7 +137,7 @@ vfs_close(struct vnode *vn)
 int
 vfs_remove(char *path)
 {
-	struct vnode *dir;
+	struct vnode *dir, *file;
 	char name[NAME_MAX+1];
 	int result;
 
@@ -145,9 +146,24 @@ vfs_remove(char *path)
 		return result;
 	}
 
+	if (VOP_LOOKUP(dir, name, &file)) {
+		file = NULL;
+	}
+
 	result = VOP_REMOVE(dir, name);
 	VOP_DECREF(dir);
 
+	/*
+	 * Don't let the exec cache keep the file alive. This has to come
+	 * after the remove, or an exec in between could cache it again.
+	 */
+	if (file != NULL) {
+		if (result == 0) {
+			elfcache_forget(file);
+		}
+		VOP_DECREF(file);
+	}
+
 	return result;
 }
 
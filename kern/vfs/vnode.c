@@ -48,8 +48,9 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 	KASSERT(ops != NULL);
 
 	vn->vn_ops = ops;
-	vn->vn_refcount = 1;
-	spinlock_init(&vn->vn_countlock);
+	atomic_set(&vn->vn_refcount, 1);
+	atomic_set(&vn->vn_wstart, 0);
+	atomic_set(&vn->vn_wdone, 0);
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
 	return 0;
@@ -61,12 +62,10 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 void
 vnode_cleanup(struct vnode *vn)
 {
-	KASSERT(vn->vn_refcount == 1);
-
-	spinlock_cleanup(&vn->vn_countlock);
+	KASSERT(atomic_get(&vn->vn_refcount) == 1);
 
 	vn->vn_ops = NULL;
-	vn->vn_refcount = 0;
+	atomic_set(&vn->vn_refcount, 0);
 	vn->vn_fs = NULL;
 	vn->vn_data = NULL;
 }
@@ -81,9 +80,7 @@ vnode_incref(struct vnode *vn)
 {
 	KASSERT(vn != NULL);
 
-	spinlock_acquire(&vn->vn_countlock);
-	vn->vn_refcount++;
-	spinlock_release(&vn->vn_countlock);
+	atomic_inc(&vn->vn_refcount);
 }
 
 /*
@@ -98,19 +95,13 @@ vnode_decref(struct vnode *vn)
 	int result;
 
 	KASSERT(vn != NULL);
+	KASSERT(atomic_get(&vn->vn_refcount) > 0);
 
-	spinlock_acquire(&vn->vn_countlock);
-
-	KASSERT(vn->vn_refcount > 0);
-	if (vn->vn_refcount > 1) {
-		vn->vn_refcount--;
-		destroy = false;
-	}
-	else {
-		/* Don't decrement; pass the reference to VOP_RECLAIM. */
-		destroy = true;
-	}
-	spinlock_release(&vn->vn_countlock);
+	/*
+	 * Drop the reference, unless it's the last one; in that case
+	 * don't decrement but pass the reference to VOP_RECLAIM.
+	 */
+	destroy = !atomic_add_unless(&vn->vn_refcount, -1, 1);
 
 	if (destroy) {
 		result = VOP_RECLAIM(vn);
@@ -122,6 +113,43 @@ vnode_decref(struct vnode *vn)
 	}
 }
 
+/*
+ * Write, counting the write as started before and finished after.
+ * Called by VOP_WRITE.
+ */
+int
+vnode_write(struct vnode *vn, struct uio *uio)
+{
+	int result;
+
+	if (vn->vn_fs == NULL) {
+		return __VOP(vn, write)(vn, uio);
+	}
+	/* Ordered, so the counts bracket the change on every cpu. */
+	(void)atomic_fetch_add(&vn->vn_wstart, 1);
+	result = __VOP(vn, write)(vn, uio);
+	(void)atomic_fetch_add(&vn->vn_wdone, 1);
+	return result;
+}
+
+/*
+ * Truncate, counting it as a write.
+ * Called by VOP_TRUNCATE.
+ */
+int
+vnode_truncate(struct vnode *vn, off_t pos)
+{
+	int result;
+
+	if (vn->vn_fs == NULL) {
+		return __VOP(vn, truncate)(vn, pos);
+	}
+	(void)atomic_fetch_add(&vn->vn_wstart, 1);
+	result = __VOP(vn, truncate)(vn, pos);
+	(void)atomic_fetch_add(&vn->vn_wdone, 1);
+	return result;
+}
+
 /*
  * Check for various things being valid.
  * Called before all VOP_* calls.
@@ -129,6 +157,8 @@ vnode_decref(struct vnode *vn)
 void
 vnode_check(struct vnode *v, const char *opstr)
 {
+	int refcount;
+
 	vfs_biglock_acquire();
 
 	if (v == NULL) {
@@ -158,20 +188,18 @@ vnode_check(struct vnode *v, const char *opstr)
 		panic("vnode_check: vop_%s: deadbeef fs pointer\n", opstr);
 	}
 
-	spinlock_acquire(&v->vn_countlock);
-
-	if (v->vn_refcount < 0) {
+	refcount = atomic_get(&v->vn_refcount);
+	if (refcount < 0) {
 		panic("vnode_check: vop_%s: negative refcount %d\n", opstr,
-		      v->vn_refcount);
+		      refcount);
 	}
-	else if (v->vn_refcount == 0) {
+	else if (refcount == 0) {
 		panic("vnode_check: vop_%s: zero refcount\n", opstr);
 	}
-	else if (v->vn_refcount > 0x100000) {
+	else if (refcount > 0x100000) {
 		kprintf("vnode_check: vop_%s: warning: large refcount %d\n",
-			opstr, v->vn_refcount);
+			opstr, refcount);
 	}
 
-	spinlock_release(&v->vn_countlock);
 	vfs_biglock_release();
 }
@@ -33,6 +33,8 @@
 #include <lib.h>
 #include <addrspace.h>
 #include <proc.h>
+#include <current.h>
+#include <thread.h>
 #include <vm.h>
 #include <spl.h>
 
@@ -59,7 +61,7 @@ as_create(void)
         return NULL;
     }
 
-    as->as_lock = lock_create("addr_space_lock");
+    as->as_lock = rwlock_create("addr_space_lock");
 
     if (!as->as_lock) {
         pagetable_destroy(as->pt);
@@ -74,6 +76,7 @@ as_create(void)
     as->heap_end = 0;
 
     as->stack_base = USERSTACK - STACK_SIZE;
+    as->stack_mainbase = as->stack_base;
 
     return as;
 }
@@ -140,27 +143,45 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 
     int err;
 
+    /*
+     * Other threads of the parent may be in sbrk, vm_fault or
+     * stack_extend; keep them out of the tables while we walk them.
+     * The page allocations below can evict, so tell evict_one not
+     * to pick pages of OLD (it would block on the lock we hold).
+     */
+    rwlock_acquire_read(old->as_lock);
+    KASSERT(curthread->t_ascopy == NULL);
+    curthread->t_ascopy = old;
+
     err = pagetable_copy(old->pt, &newas->pt);
 
 	if (err) {
-        as_destroy(newas);
-        return err;
+        goto fail;
     }
 
     err = region_copy(old->region_list, &newas->region_list);
 
 	if (err) {
-        as_destroy(newas);
-        return err;
+        goto fail;
     }
 
     newas->heap_start = old->heap_start;
     newas->heap_end = old->heap_end;
 
     newas->stack_base = old->stack_base;
+    newas->stack_mainbase = old->stack_mainbase;
+
+    curthread->t_ascopy = NULL;
+    rwlock_release_read(old->as_lock);
 
     *ret = newas;
 	return 0;
+
+fail:
+    curthread->t_ascopy = NULL;
+    rwlock_release_read(old->as_lock);
+    as_destroy(newas);
+    return err;
 }
 
 void
@@ -172,6 +193,7 @@ as_destroy(struct addrspace *as)
 
     region_destroy(as->region_list);
     pagetable_destroy(as->pt);
+    rwlock_destroy(as->as_lock);
 
     kfree(as);
 }
@@ -306,3 +328,119 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+/*
+ * Extend the stack down to cover BASE; if IS_MAIN, it's the main thread's
+ * stack, which is exempt from guard pages down that far.
+ */
+static int stack_extend(struct addrspace *as, vaddr_t base, bool is_main) {
+    base &= PAGE_FRAME;
+
+    rwlock_acquire_write(as->as_lock);
+
+    /* The stack is everything from stack_base up, so just extend it. */
+    if (base < as->stack_base) {
+        if (ROUNDUP(as->heap_end, PAGE_SIZE) > base) {
+            rwlock_release_write(as->as_lock);
+            return ENOMEM;
+        }
+        as->stack_base = base;
+    }
+    if (is_main && base < as->stack_mainbase) {
+        as->stack_mainbase = base;
+    }
+
+    rwlock_release_write(as->as_lock);
+    return 0;
+}
+
+unsigned
+as_first_threadstack(struct addrspace *as)
+{
+    vaddr_t mainbase;
+
+    rwlock_acquire_read(as->as_lock);
+    mainbase = as->stack_mainbase;
+    rwlock_release_read(as->as_lock);
+
+    /* Round the main stack up to whole slots; it always has slot 0. */
+    if (mainbase >= USERSTACK - UTHREAD_STACKSIZE) {
+        return 1;
+    }
+    return (USERSTACK - mainbase + UTHREAD_STACKSIZE - 1) / UTHREAD_STACKSIZE;
+}
+
+int
+as_define_threadstack(struct addrspace *as, unsigned utid, vaddr_t *stackptr)
+{
+    int result;
+
+    /* Don't hand out a slot the main thread's argv is sitting in. */
+    if (utid < as_first_threadstack(as)) {
+        return ENOMEM;
+    }
+
+    /* The guard page is included; vm_fault keeps it unmapped. */
+    result = stack_extend(as, USERSTACK - (utid + 1) * UTHREAD_STACKSIZE,
+                          false);
+    if (result) {
+        return result;
+    }
+
+    *stackptr = USERSTACK - utid * UTHREAD_STACKSIZE;
+    return 0;
+}
+
+int
+as_grow_stack(struct addrspace *as, vaddr_t base)
+{
+    return stack_extend(as, base, true);
+}
+
+bool
+as_stack_guard(struct addrspace *as, vaddr_t vaddr)
+{
+    vaddr &= PAGE_FRAME;
+
+    if (vaddr >= USERSTACK || vaddr < as->stack_base ||
+        vaddr >= as->stack_mainbase) {
+        return false;
+    }
+    /* The lowest page of a slot is a multiple of the slot size down. */
+    return ((USERSTACK - vaddr) & (UTHREAD_STACKSIZE - 1)) == 0;
+}
+
+int
+as_define_stackpages(struct addrspace *as, vaddr_t *kpages, unsigned npages)
+{
+    vaddr_t vaddr;
+    paddr_t paddr;
+    unsigned i;
+    int result;
+
+    result = as_grow_stack(as, USERSTACK - npages * PAGE_SIZE);
+    if (result) {
+        return result;
+    }
+
+    rwlock_acquire_write(as->as_lock);
+    for (i = 0; i < npages; i++) {
+        vaddr = USERSTACK - (npages - i) * PAGE_SIZE;
+        paddr = KVADDR_TO_PADDR(kpages[i]);
+
+        /* The stack has to be untouched so far. */
+        KASSERT(pagetable_lookup(as->pt, vaddr) == NULL ||
+                !pagetable_lookup(as->pt, vaddr)->valid);
+
+        result = pagetable_insert(as->pt, vaddr, paddr, false);
+        if (result) {
+            rwlock_release_write(as->as_lock);
+            return result;
+        }
+        cm_set_user_page(PADDR_TO_PPAGE(paddr), as, vaddr);
+        kpages[i] = 0;
+    }
+    rwlock_release_write(as->as_lock);
+
+    return 0;
+}
+
@@ -29,6 +29,7 @@
 
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <err.h>
 
 /*
@@ -36,12 +37,14 @@
  * Usage: cat [files]
  */
 
+/* How much to ask sendfile for at a time. */
+#define CHUNKSIZE (64*1024)
 
 
-/* Print a file that's already been opened. */
+/* Print a file that's already been opened, reading it ourselves. */
 static
 void
-docat(const char *name, int fd)
+docat_rw(const char *name, int fd)
 {
 	char buf[1024];
 	int len, wr, wrtot;
@@ -74,6 +77,30 @@ docat(const char *name, int fd)
 	}
 }
 
+/* Print a file that's already been opened. */
+static
+void
+docat(const char *name, int fd)
+{
+	ssize_t len;
+
+	/*
+	 * Have the kernel copy it to stdout directly. If the kernel
+	 * doesn't have sendfile, or won't do it because stdout is
+	 * the same open file as the input, read and write it
+	 * ourselves instead.
+	 */
+	while ((len = sendfile(STDOUT_FILENO, fd, CHUNKSIZE))>0) {
+		/* keep going */
+	}
+	if (len<0) {
+		if (errno != ENOSYS && errno != EINVAL) {
+			err(1, "%s", name);
+		}
+		docat_rw(name, fd);
+	}
+}
+
 /* Print a file by name. */
 static
 void
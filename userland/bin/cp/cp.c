@@ -28,6 +28,7 @@
  */
 
 #include <unistd.h>
+#include <errno.h>
 #include <err.h>
 
 /*
@@ -35,29 +36,20 @@
  * Usage: cp oldfile newfile
  */
 
+/* How much to ask sendfile for at a time. */
+#define CHUNKSIZE (64*1024)
 
-/* Copy one file to another. */
+/*
+ * Copy the rest of one open file to another by reading it into our
+ * own buffer and writing it out again.
+ */
 static
 void
-copy(const char *from, const char *to)
+copy_rw(int fromfd, const char *from, int tofd, const char *to)
 {
-	int fromfd;
-	int tofd;
 	char buf[1024];
 	int len, wr, wrtot;
 
-	/*
-	 * Open the files, and give up if they won't open
-	 */
-	fromfd = open(from, O_RDONLY);
-	if (fromfd<0) {
-		err(1, "%s", from);
-	}
-	tofd = open(to, O_WRONLY|O_CREAT|O_TRUNC);
-	if (tofd<0) {
-		err(1, "%s", to);
-	}
-
 	/*
 	 * As long as we get more than zero bytes, we haven't hit EOF.
 	 * Zero means EOF. Less than zero means an error occurred.
@@ -84,6 +76,44 @@ copy(const char *from, const char *to)
 	if (len<0) {
 		err(1, "%s", from);
 	}
+}
+
+
+/* Copy one file to another. */
+static
+void
+copy(const char *from, const char *to)
+{
+	int fromfd;
+	int tofd;
+	ssize_t len;
+
+	/*
+	 * Open the files, and give up if they won't open
+	 */
+	fromfd = open(from, O_RDONLY);
+	if (fromfd<0) {
+		err(1, "%s", from);
+	}
+	tofd = open(to, O_WRONLY|O_CREAT|O_TRUNC);
+	if (tofd<0) {
+		err(1, "%s", to);
+	}
+
+	/*
+	 * Have the kernel move the data, without it coming through
+	 * our address space, until we reach EOF (zero) or an error.
+	 * If the kernel doesn't have sendfile, do it ourselves.
+	 */
+	while ((len = sendfile(tofd, fromfd, CHUNKSIZE))>0) {
+		/* keep going */
+	}
+	if (len<0) {
+		if (errno != ENOSYS) {
+			err(1, "%s to %s", from, to);
+		}
+		copy_rw(fromfd, from, tofd, to);
+	}
 
 	if (close(fromfd) < 0) {
 		err(1, "%s: close", from);
@@ -111,6 +111,39 @@ remember_bg(pid_t pid)
 	assert(0);
 }
 
+/*
+ * have_bg
+ * returns true if there are any background jobs.
+ */
+static
+int
+have_bg(void)
+{
+	int i;
+	for (i=0; i < MAXBG; i++) {
+		if (bgpids[i] != 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * forget_bg
+ * take a pid off the list of background jobs.
+ */
+static
+void
+forget_bg(pid_t pid)
+{
+	int i;
+	for (i=0; i < MAXBG; i++) {
+		if (bgpids[i] == pid) {
+			bgpids[i] = 0;
+		}
+	}
+}
+
 /*
  * constructor for exitinfo
  */
@@ -189,67 +222,64 @@ printstatus(const struct exitinfo *ei, int printexitzero)
 }
 
 /*
- * dowait
- * just does a waitpid.
+ * showstatus
+ * report how a background job exited.
  */
 static
 void
-dowait(pid_t pid)
+showstatus(pid_t pid, int status)
 {
 	struct exitinfo ei;
-	int status;
 
-	if (waitpid(pid, &status, 0) < 0) {
-		warn("pid %d", pid);
-	}
-	else {
-		printf("pid %d: ", pid);
-		readstatus(status, &ei);
-		printstatus(&ei, 1);
-	}
+	printf("pid %d: ", pid);
+	readstatus(status, &ei);
+	printstatus(&ei, 1);
 }
 
-#ifdef WNOHANG
 /*
- * dowaitpoll
- * like dowait, but uses WNOHANG. returns true if we got something.
+ * dowait
+ * just does a waitpid.
  */
 static
-int
-dowaitpoll(pid_t pid)
+void
+dowait(pid_t pid)
 {
-	struct exitinfo ei;
-	pid_t foundpid;
 	int status;
 
-	foundpid = waitpid(pid, &status, WNOHANG);
-	if (foundpid < 0) {
+	if (waitpid(pid, &status, 0) < 0) {
 		warn("pid %d", pid);
 	}
-	else if (foundpid != 0) {
-		printf("pid %d: ", pid);
-		readstatus(status, &ei);
-		printstatus(&ei, 1);
-		return 1;
+	else {
+		showstatus(pid, status);
 	}
-	return 0;
 }
 
+#ifdef WNOHANG
 /*
  * waitpoll
- * poll all background jobs for having exited.
+ * collect all background jobs that have exited, in whatever order
+ * they finished.
  */
 static
 void
 waitpoll(void)
 {
-	int i;
-	for (i=0; i < MAXBG; i++) {
-		if (bgpids[i] != 0) {
-			if (dowaitpoll(bgpids[i])) {
-				bgpids[i] = 0;
+	pid_t pid;
+	int status;
+
+	while (1) {
+		pid = waitpid(WAIT_ANY, &status, WNOHANG);
+		if (pid < 0) {
+			if (errno != ECHILD) {
+				warn("waitpid");
 			}
+			break;
+		}
+		if (pid == 0) {
+			break;
 		}
+		showstatus(pid, status);
+		forget_bg(pid);
 	}
 }
 #endif /* WNOHANG */
@@ -264,26 +294,26 @@ static
 void
 cmd_wait(int ac, char *av[], struct exitinfo *ei)
 {
-	int i;
+	int status;
 	pid_t pid;
 
 	if (ac == 2) {
 		pid = atoi(av[1]);
 		dowait(pid);
-		for (i = 0; i < MAXBG; i++) {
-			if (bgpids[i]==pid) {
-				bgpids[i] = 0;
-			}
-		}
+		forget_bg(pid);
 		exitinfo_exit(ei, 0);
 		return;
 	}
 	else if (ac == 1) {
-		for (i=0; i < MAXBG; i++) {
-			if (bgpids[i] != 0) {
-				dowait(bgpids[i]);
-				bgpids[i] = 0;
+		/* take them in the order they finish */
+		while (have_bg()) {
+			pid = waitpid(WAIT_ANY, &status, 0);
+			if (pid < 0) {
+				warn("waitpid");
+				break;
 			}
+			showstatus(pid, status);
+			forget_bg(pid);
 		}
 		exitinfo_exit(ei, 0);
 		return;
@@ -421,30 +451,14 @@ docommand(char *buf, struct exitinfo *ei)
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
-	switch (pid) {
-		case -1:
-			/* error */
-			warn("fork");
-			exitinfo_exit(ei, 255);
-			return;
-		case 0:
-			/* child */
-			execvp(args[0], args);
-			warn("%s", args[0]);
-			/*
-			 * Use _exit() instead of exit() in the child
-			 * process to avoid calling atexit() functions,
-			 * which would cause hostcompat (if present) to
-			 * reset the tty state and mess up our input
-			 * handling.
-			 */
-			_exit(1);
-		default:
-			break;
+	/* Start it in a new process; no need to copy ourselves first. */
+	pid = spawnvp(args[0], args, NULL, 0);
+	if (pid < 0) {
+		warn("%s", args[0]);
+		exitinfo_exit(ei, 1);
+		return;
 	}
 
-	/* parent */
 	if (bg) {
 		/* background this command */
 		remember_bg(pid);
@@ -0,0 +1,19 @@
+#ifndef _SYS_UIO_H_
+#define _SYS_UIO_H_
+
+/*
+ * Scatter/gather I/O.
+ */
+
+#include <sys/types.h>
+#include <kern/iovec.h>
+
+/*
+ * readv and writev are like read and write, but on IOVCNT buffers at
+ * once, filled (or drained) in order, as one operation on the file.
+ * IOVCNT may be at most IOV_MAX (see limits.h).
+ */
+ssize_t readv(int filehandle, const struct iovec *iov, int iovcnt);
+ssize_t writev(int filehandle, const struct iovec *iov, int iovcnt);
+
+#endif /* _SYS_UIO_H_ */
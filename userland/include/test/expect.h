@@ -0,0 +1,20 @@
+/*
+ * Error-case checking shared by the system call tests.
+ *
+ * test_failures counts checks that went wrong; a test adds its own
+ * failures to it too, and reports the total at the end.
+ *
+ * expect_err checks that a call returning RESULT failed with errno
+ * EXPERR, complaining (naming the call as WHAT) if not.
+ */
+
+#ifndef _TEST_EXPECT_H_
+#define _TEST_EXPECT_H_
+
+#include <sys/types.h>
+
+extern int test_failures;
+
+void expect_err(ssize_t result, int experr, const char *what);
+
+#endif /* _TEST_EXPECT_H_ */
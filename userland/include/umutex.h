@@ -0,0 +1,39 @@
+#ifndef _UMUTEX_H_
+#define _UMUTEX_H_
+
+/*
+ * User-level mutexes and condition variables, built on futex().
+ *
+ * Taking a free mutex or releasing one nobody is waiting for happens
+ * entirely in user space with atomic instructions; the kernel is only
+ * entered to sleep or to wake a sleeper. Neither kind of object needs
+ * any cleanup, and a zero-filled one is ready to use.
+ *
+ * umutex_trylock returns 0 on success and -1 if the mutex is held.
+ * ucond_wait must be called with the mutex held, and returns with it
+ * held again; as usual, callers should recheck their condition in a
+ * loop, since wakeups may be spurious.
+ */
+
+struct umutex {
+	volatile int um_state;	/* 0 free, 1 held, 2 held with waiters */
+};
+
+struct ucond {
+	volatile int uc_seq;	/* bumped by every signal/broadcast */
+};
+
+#define UMUTEX_INITIALIZER	{ 0 }
+#define UCOND_INITIALIZER	{ 0 }
+
+void umutex_init(struct umutex *m);
+void umutex_lock(struct umutex *m);
+int umutex_trylock(struct umutex *m);
+void umutex_unlock(struct umutex *m);
+
+void ucond_init(struct ucond *c);
+void ucond_wait(struct ucond *c, struct umutex *m);
+void ucond_signal(struct ucond *c);
+void ucond_broadcast(struct ucond *c);
+
+#endif /* _UMUTEX_H_ */
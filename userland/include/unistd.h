@@ -43,8 +43,11 @@
 #include <kern/reboot.h>
 #include <kern/seek.h>
 #include <kern/time.h>
+#include <kern/resource.h>	/* needs kern/time.h */
 #include <kern/unistd.h>
 #include <kern/wait.h>
+#include <kern/futex.h>
+#include <kern/spawn.h>
 
 
 /*
@@ -141,13 +144,28 @@ int chdir(const char *path);
 
 /* Optional. */
 void *sbrk(__intptr_t change);
+pid_t vfork(void);
+ssize_t pread(int filehandle, void *buf, size_t size, off_t pos);
+ssize_t pwrite(int filehandle, const void *buf, size_t size, off_t pos);
+ssize_t sendfile(int outhandle, int inhandle, size_t size);
 ssize_t getdirentry(int filehandle, char *buf, size_t buflen);
 int symlink(const char *target, const char *linkname);
 ssize_t readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
 ssize_t __getcwd(char *buf, size_t buflen);
+int getpriority(int which, int who);
+int setpriority(int which, int who, int prio);
+int getrusage(int who, struct rusage *usage);
+int futex(volatile int *uaddr, int op, int val);
+int __thread_create(void (*entry)(void *(*)(void *), void *),
+		    void *(*func)(void *), void *arg);
+__DEAD void thread_exit(void *value);
+int thread_join(int tid, void **value);
+pid_t spawn(const char *prog, char *const *args,
+	    const struct spawn_action *actions, int nactions);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -156,7 +174,11 @@ ssize_t __getcwd(char *buf, size_t buflen);
  */
 
 int execvp(const char *prog, char *const *args); /* calls execv */
+pid_t spawnvp(const char *prog, char *const *args,	/* calls spawn */
+	      const struct spawn_action *actions, int nactions);
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
+unsigned sleep(unsigned seconds);		/* calls nanosleep */
+int thread_create(void *(*func)(void *), void *arg); /* calls __thread_create */
 
 #endif /* _UNISTD_H_ */
@@ -0,0 +1,171 @@
+#include <unistd.h>
+#include <umutex.h>
+
+/*
+ * Mutexes and condition variables on top of futex().
+ *
+ * The mutex is the three-state one from Drepper's "Futexes Are
+ * Tricky": 0 is free, 1 is held, and 2 is held with (possibly)
+ * somebody asleep, in which case unlock has to call into the kernel.
+ * A thread that has slept always sets 2 when it gets the lock, since
+ * it can't tell whether others are still waiting.
+ */
+
+/*
+ * Atomic operations, using MIPS LL/SC.
+ */
+
+/* If *P is OLD, set it to NEW. Returns what *P was. */
+static
+int
+atomic_cas(volatile int *p, int old, int new)
+{
+	int prev, tmp;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set noreorder;"	/* we fill the delay slots */
+		"1: ll %0, 0(%2);"	/* prev = *p */
+		"bne %0, %3, 2f;"	/* stop if it isn't OLD */
+		" move %1, %4;"		/* (delay slot) tmp = new */
+		"sc %1, 0(%2);"		/* *p = tmp; tmp = success? */
+		"beqz %1, 1b;"		/* retry if the store failed */
+		" nop;"			/* (delay slot) */
+		"2:;"
+		".set pop"		/* restore assembler mode */
+		: "=&r" (prev), "=&r" (tmp)
+		: "r" (p), "r" (old), "r" (new)
+		: "memory");
+	return prev;
+}
+
+/* Set *P to VAL. Returns what *P was. */
+static
+int
+atomic_swap(volatile int *p, int val)
+{
+	int prev, tmp;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set noreorder;"	/* we fill the delay slots */
+		"1: ll %0, 0(%2);"	/* prev = *p */
+		"move %1, %3;"		/* tmp = val */
+		"sc %1, 0(%2);"		/* *p = tmp; tmp = success? */
+		"beqz %1, 1b;"		/* retry if the store failed */
+		" nop;"			/* (delay slot) */
+		".set pop"		/* restore assembler mode */
+		: "=&r" (prev), "=&r" (tmp)
+		: "r" (p), "r" (val)
+		: "memory");
+	return prev;
+}
+
+/* Add 1 to *P. */
+static
+void
+atomic_inc(volatile int *p)
+{
+	int prev;
+
+	do {
+		prev = *p;
+	} while (atomic_cas(p, prev, prev + 1) != prev);
+}
+
+////////////////////////////////////////////////////////////
+// mutex
+
+void
+umutex_init(struct umutex *m)
+{
+	m->um_state = 0;
+}
+
+void
+umutex_lock(struct umutex *m)
+{
+	int c;
+
+	c = atomic_cas(&m->um_state, 0, 1);
+	if (c == 0) {
+		/* uncontended */
+		return;
+	}
+
+	if (c != 2) {
+		c = atomic_swap(&m->um_state, 2);
+	}
+	while (c != 0) {
+		/* Fails with EAGAIN if it changed already; just retry. */
+		futex(&m->um_state, FUTEX_WAIT, 2);
+		c = atomic_swap(&m->um_state, 2);
+	}
+}
+
+int
+umutex_trylock(struct umutex *m)
+{
+	return atomic_cas(&m->um_state, 0, 1) == 0 ? 0 : -1;
+}
+
+void
+umutex_unlock(struct umutex *m)
+{
+	if (atomic_swap(&m->um_state, 0) == 2) {
+		futex(&m->um_state, FUTEX_WAKE, 1);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// condition variable
+
+/* Wake count meaning "everybody" (there's no INT_MAX here). */
+#define UCOND_WAKEALL	0x7fffffff
+
+/*
+ * A waiter notes the sequence number before letting go of the mutex
+ * and sleeps only if it hasn't changed since, so a signal sent in
+ * between isn't lost.
+ */
+
+void
+ucond_init(struct ucond *c)
+{
+	c->uc_seq = 0;
+}
+
+void
+ucond_wait(struct ucond *c, struct umutex *m)
+{
+	int seq;
+
+	seq = c->uc_seq;
+	umutex_unlock(m);
+	futex(&c->uc_seq, FUTEX_WAIT, seq);
+
+	/*
+	 * Others woken with us may now be competing for the mutex, so
+	 * take it in the contended state to make sure unlock wakes
+	 * them.
+	 */
+	while (atomic_swap(&m->um_state, 2) != 0) {
+		futex(&m->um_state, FUTEX_WAIT, 2);
+	}
+}
+
+void
+ucond_signal(struct ucond *c)
+{
+	atomic_inc(&c->uc_seq);
+	futex(&c->uc_seq, FUTEX_WAKE, 1);
+}
+
+void
+ucond_broadcast(struct ucond *c)
+{
+	atomic_inc(&c->uc_seq);
+	futex(&c->uc_seq, FUTEX_WAKE, UCOND_WAKEALL);
+}
@@ -0,0 +1,21 @@
+#include <unistd.h>
+
+/*
+ * User-level threads are created by the kernel, which starts the new
+ * thread here with FUNC and ARG in the argument registers and an
+ * empty stack of its own. Returning from FUNC means exiting the
+ * thread with whatever it returned; there's nowhere to return to
+ * otherwise.
+ */
+static
+void
+thread_start(void *(*func)(void *), void *arg)
+{
+	thread_exit(func(arg));
+}
+
+int
+thread_create(void *(*func)(void *), void *arg)
+{
+	return __thread_create(thread_start, func, arg);
+}
@@ -0,0 +1,20 @@
+#include <unistd.h>
+
+/*
+ * POSIX C function: sleep for a number of seconds. Uses the system
+ * call nanosleep. Since nothing can interrupt the sleep, it always
+ * returns 0 (the number of seconds left) unless nanosleep fails.
+ */
+
+unsigned
+sleep(unsigned seconds)
+{
+	struct timespec ts;
+
+	ts.tv_sec = seconds;
+	ts.tv_nsec = 0;
+	if (nanosleep(&ts, NULL) < 0) {
+		return seconds;
+	}
+	return 0;
+}
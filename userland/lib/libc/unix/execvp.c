@@ -35,19 +35,33 @@
 #include <limits.h>
 
 /*
- * POSIX C function: exec a program on the search path. Tries
- * execv() repeatedly until one of the choices works.
+ * Arguments passed through to the function being tried.
+ */
+struct pathargs {
+	char *const *args;
+	const struct spawn_action *actions;
+	int nactions;
+};
+
+/*
+ * Look for PROG on the search path, calling TRY with each candidate
+ * and PA until one works. TRY returns -1 and sets errno on failure;
+ * errors that just mean "not here" move on to the next directory,
+ * anything else is fatal. Returns what TRY returned.
  */
+static
 int
-execvp(const char *prog, char *const *args)
+pathsearch(const char *prog,
+	   int (*try)(const char *path, const struct pathargs *pa),
+	   const struct pathargs *pa)
 {
 	const char *searchpath, *s, *t;
 	char progpath[PATH_MAX];
 	size_t len;
+	int result;
 
 	if (strchr(prog, '/') != NULL) {
-		execv(prog, args);
-		return -1;
+		return try(prog, pa);
 	}
 
 	searchpath = getenv("PATH");
@@ -74,7 +88,10 @@ execvp(const char *prog, char *const *args)
 		}
 		memcpy(progpath, s, len);
 		snprintf(progpath + len, sizeof(progpath) - len, "/%s", prog);
-		execv(progpath, args);
+		result = try(progpath, pa);
+		if (result >= 0) {
+			return result;
+		}
 		switch (errno) {
 		    case ENOENT:
 		    case ENOTDIR:
@@ -89,3 +106,50 @@ execvp(const char *prog, char *const *args)
 	errno = ENOENT;
 	return -1;
 }
+
+/*
+ * POSIX C function: exec a program on the search path. Tries
+ * execv() repeatedly until one of the choices works.
+ */
+
+static
+int
+try_execv(const char *path, const struct pathargs *pa)
+{
+	return execv(path, pa->args);
+}
+
+int
+execvp(const char *prog, char *const *args)
+{
+	struct pathargs pa;
+
+	pa.args = args;
+	pa.actions = NULL;
+	pa.nactions = 0;
+	return pathsearch(prog, try_execv, &pa);
+}
+
+/*
+ * Like execvp, but with spawn() instead of execv(): start a program
+ * from the search path in a new process and return its pid.
+ */
+
+static
+int
+try_spawn(const char *path, const struct pathargs *pa)
+{
+	return spawn(path, pa->args, pa->actions, pa->nactions);
+}
+
+pid_t
+spawnvp(const char *prog, char *const *args,
+	const struct spawn_action *actions, int nactions)
+{
+	struct pathargs pa;
+
+	pa.args = args;
+	pa.actions = actions;
+	pa.nactions = nactions;
+	return pathsearch(prog, try_spawn, &pa);
+}
@@ -0,0 +1,26 @@
+/*
+ * expect.c
+ *
+ * 	Checking for expected errors. See <test/expect.h>.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <test/expect.h>
+
+int test_failures;
+
+void
+expect_err(ssize_t result, int experr, const char *what)
+{
+	if (result >= 0) {
+		warnx("%s: succeeded, expected %s", what, strerror(experr));
+		test_failures++;
+	}
+	else if (errno != experr) {
+		warnx("%s: got %s, expected %s", what, strerror(errno),
+		      strerror(experr));
+		test_failures++;
+	}
+}
@@ -0,0 +1,81 @@
+/*
+ * futextest - check the single-threaded behavior of futex() and of
+ * the umutex/ucond library built on it.
+ *
+ * Nothing here should ever block; if it hangs, FUTEX_WAIT isn't
+ * checking the value, or the library is calling into the kernel on
+ * the uncontended path when it shouldn't.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+#include <umutex.h>
+
+static int failures;
+
+static
+void
+expect(const char *what, int result, int expected, int experrno)
+{
+	if (result != expected) {
+		warnx("%s: returned %d, expected %d", what, result, expected);
+		failures++;
+	}
+	else if (result < 0 && errno != experrno) {
+		warnx("%s: errno %d, expected %d", what, errno, experrno);
+		failures++;
+	}
+}
+
+int
+main(void)
+{
+	static struct umutex m = UMUTEX_INITIALIZER;
+	static struct ucond c = UCOND_INITIALIZER;
+	volatile int word = 5;
+	int unaligned[2];
+
+	expect("wait on changed value",
+	       futex(&word, FUTEX_WAIT, 6), -1, EAGAIN);
+	expect("wake with no waiters",
+	       futex(&word, FUTEX_WAKE, 1), 0, 0);
+	expect("wake zero",
+	       futex(&word, FUTEX_WAKE, 0), 0, 0);
+	expect("wake negative",
+	       futex(&word, FUTEX_WAKE, -1), -1, EINVAL);
+	expect("bad op",
+	       futex(&word, 12345, 0), -1, EINVAL);
+	expect("unaligned address",
+	       futex((volatile int *)((char *)unaligned + 1), FUTEX_WAIT, 0),
+	       -1, EINVAL);
+	expect("null address",
+	       futex(NULL, FUTEX_WAIT, 0), -1, EFAULT);
+	expect("kernel address",
+	       futex((volatile int *)0x80000000, FUTEX_WAIT, 0), -1, EFAULT);
+
+	umutex_lock(&m);
+	expect("trylock while held", umutex_trylock(&m), -1, 0);
+	umutex_unlock(&m);
+	expect("trylock when free", umutex_trylock(&m), 0, 0);
+	umutex_unlock(&m);
+	if (m.um_state != 0) {
+		warnx("mutex state %d after unlock", m.um_state);
+		failures++;
+	}
+
+	/* Signalling with nobody waiting must not block or lose track. */
+	ucond_signal(&c);
+	ucond_broadcast(&c);
+	if (c.uc_seq != 2) {
+		warnx("cond sequence %d, expected 2", c.uc_seq);
+		failures++;
+	}
+
+	if (failures) {
+		errx(1, "%d failures", failures);
+	}
+	printf("futextest: passed\n");
+	return 0;
+}
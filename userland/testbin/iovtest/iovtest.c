@@ -0,0 +1,125 @@
+/*
+ * iovtest - check readv() and writev().
+ *
+ * Writes a header and a payload with one writev, reads them back with
+ * readv split at a different place, and checks the error cases.
+ */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <test/expect.h>
+
+#define TESTFILE	"iovtest.tmp"
+#define HEADER		"HDR:"
+#define PAYLOAD		"the payload follows the header in one write\n"
+
+static
+void
+test_roundtrip(void)
+{
+	struct iovec iov[3];
+	char a[7], b[16], c[64];
+	size_t total;
+	ssize_t len;
+	int fd;
+
+	total = strlen(HEADER) + strlen(PAYLOAD);
+
+	fd = open(TESTFILE, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", TESTFILE);
+	}
+
+	iov[0].iov_base = (void *)HEADER;
+	iov[0].iov_len = strlen(HEADER);
+	iov[1].iov_base = NULL;
+	iov[1].iov_len = 0;
+	iov[2].iov_base = (void *)PAYLOAD;
+	iov[2].iov_len = strlen(PAYLOAD);
+	len = writev(fd, iov, 3);
+	if (len < 0) {
+		err(1, "writev");
+	}
+	if ((size_t)len != total) {
+		warnx("writev wrote %d bytes, expected %d",
+		      (int)len, (int)total);
+		test_failures++;
+	}
+
+	if (lseek(fd, 0, SEEK_SET) != 0) {
+		err(1, "lseek");
+	}
+
+	/* Read it back in different-sized pieces, with room to spare. */
+	iov[0].iov_base = a;
+	iov[0].iov_len = sizeof(a);
+	iov[1].iov_base = b;
+	iov[1].iov_len = sizeof(b);
+	iov[2].iov_base = c;
+	iov[2].iov_len = sizeof(c);
+	len = readv(fd, iov, 3);
+	if (len < 0) {
+		err(1, "readv");
+	}
+	if ((size_t)len != total) {
+		warnx("readv read %d bytes, expected %d",
+		      (int)len, (int)total);
+		test_failures++;
+	}
+	else if (memcmp(a, HEADER PAYLOAD, sizeof(a)) != 0 ||
+		 memcmp(b, HEADER PAYLOAD + sizeof(a), sizeof(b)) != 0 ||
+		 memcmp(c, HEADER PAYLOAD + sizeof(a) + sizeof(b),
+			total - sizeof(a) - sizeof(b)) != 0) {
+		warnx("readv got the wrong data");
+		test_failures++;
+	}
+
+	/* The offset should have moved past everything. */
+	if (lseek(fd, 0, SEEK_CUR) != (off_t)total) {
+		warnx("file offset is wrong after readv");
+		test_failures++;
+	}
+
+	close(fd);
+	remove(TESTFILE);
+}
+
+static
+void
+test_errors(void)
+{
+	struct iovec iov;
+	char buf[4];
+
+	iov.iov_base = buf;
+	iov.iov_len = sizeof(buf);
+
+	expect_err(writev(STDOUT_FILENO, &iov, 0), EINVAL,
+	           "writev of 0 iovecs");
+	expect_err(writev(STDOUT_FILENO, &iov, IOV_MAX + 1), EINVAL,
+	           "writev of too many iovecs");
+	expect_err(writev(STDOUT_FILENO, (struct iovec *)0x40000000, 1),
+	           EFAULT, "writev with a bad iovec pointer");
+	expect_err(readv(-1, &iov, 1), EBADF, "readv on a bad fd");
+}
+
+int
+main(void)
+{
+	test_roundtrip();
+	test_errors();
+
+	if (test_failures) {
+		printf("iovtest: %d failures\n", test_failures);
+		return 1;
+	}
+	printf("iovtest: passed\n");
+	return 0;
+}
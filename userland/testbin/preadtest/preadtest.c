@@ -0,0 +1,185 @@
+/*
+ * preadtest - check pread() and pwrite().
+ *
+ * Fills a file one block at a time, out of order, with pwrite, and
+ * reads it back with pread, checking that neither moves the seek
+ * position. Then several children sharing the open file read
+ * different blocks of it at once. Finally checks the error cases.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <test/expect.h>
+
+#define TESTFILE	"preadtest.tmp"
+#define BLOCKSIZE	512
+#define NBLOCKS		16
+#define NCHILDREN	4
+#define NROUNDS		20
+
+/*
+ * Fill BUF with the contents block BLOCK should have.
+ */
+static
+void
+fillblock(char *buf, unsigned block)
+{
+	unsigned i;
+
+	for (i=0; i<BLOCKSIZE; i++) {
+		buf[i] = (char)(block * 31 + i);
+	}
+}
+
+/*
+ * Read block BLOCK with pread and check it. Returns 0 if it's right.
+ */
+static
+int
+checkblock(int fd, unsigned block)
+{
+	char expected[BLOCKSIZE], buf[BLOCKSIZE];
+	ssize_t len;
+
+	fillblock(expected, block);
+	len = pread(fd, buf, BLOCKSIZE, (off_t)block * BLOCKSIZE);
+	if (len != BLOCKSIZE) {
+		if (len < 0) {
+			warn("pread of block %u", block);
+		}
+		else {
+			warnx("pread of block %u: short read", block);
+		}
+		return 1;
+	}
+	if (memcmp(buf, expected, BLOCKSIZE) != 0) {
+		warnx("block %u has the wrong contents", block);
+		return 1;
+	}
+	return 0;
+}
+
+static
+void
+checkpos(int fd, const char *after)
+{
+	if (lseek(fd, 0, SEEK_CUR) != 0) {
+		warnx("seek position moved after %s", after);
+		test_failures++;
+	}
+}
+
+static
+void
+test_sequential(int fd)
+{
+	char buf[BLOCKSIZE];
+	unsigned i, block;
+
+	/* Write the blocks in a scrambled order. */
+	for (i=0; i<NBLOCKS; i++) {
+		block = (i * 7) % NBLOCKS;
+		fillblock(buf, block);
+		if (pwrite(fd, buf, BLOCKSIZE,
+			   (off_t)block * BLOCKSIZE) != BLOCKSIZE) {
+			err(1, "pwrite of block %u", block);
+		}
+	}
+	checkpos(fd, "pwrite");
+
+	for (block=0; block<NBLOCKS; block++) {
+		test_failures += checkblock(fd, block);
+	}
+	checkpos(fd, "pread");
+}
+
+static
+void
+test_parallel(int fd)
+{
+	pid_t pids[NCHILDREN];
+	unsigned i, j, block;
+	int status, bad;
+
+	for (i=0; i<NCHILDREN; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			/* Each child reads its own share of the blocks. */
+			bad = 0;
+			for (j=0; j<NROUNDS; j++) {
+				for (block=i; block<NBLOCKS;
+				     block+=NCHILDREN) {
+					bad += checkblock(fd, block);
+				}
+			}
+			_exit(bad ? 1 : 0);
+		}
+	}
+
+	for (i=0; i<NCHILDREN; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			warnx("child %u failed", i);
+			test_failures++;
+		}
+	}
+	checkpos(fd, "parallel preads");
+}
+
+static
+void
+test_errors(void)
+{
+	char buf[4];
+	int fd;
+
+	expect_err(pread(-1, buf, sizeof(buf), -1), EBADF,
+	           "pread on a bad fd");
+	expect_err(pread(STDIN_FILENO, buf, sizeof(buf), 0), ESPIPE,
+	           "pread on the console");
+
+	fd = open(TESTFILE, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", TESTFILE);
+	}
+	expect_err(pread(fd, buf, sizeof(buf), -1), EINVAL,
+	           "pread at a negative position");
+	expect_err(pwrite(fd, buf, sizeof(buf), 0), EBADF,
+	           "pwrite on a read-only file");
+	close(fd);
+}
+
+int
+main(void)
+{
+	int fd;
+
+	fd = open(TESTFILE, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", TESTFILE);
+	}
+	test_sequential(fd);
+	test_parallel(fd);
+	close(fd);
+
+	test_errors();
+	remove(TESTFILE);
+
+	if (test_failures) {
+		printf("preadtest: %d failures\n", test_failures);
+		return 1;
+	}
+	printf("preadtest: passed\n");
+	return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * rusagetest - check that getrusage reports cpu time and context
+ * switches for ourselves and for children we've waited for.
+ *
+ * Spins for a couple of seconds of real time, so the clock has had
+ * plenty of chances to charge us.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <err.h>
+
+#define SPINSECS	2
+
+static int failures;
+
+static
+void
+spin(void)
+{
+	time_t start;
+
+	start = time(NULL);
+	while (time(NULL) < start + SPINSECS) {
+		/* burn */
+	}
+}
+
+static
+void
+getusage(int who, struct rusage *ru)
+{
+	if (getrusage(who, ru) < 0) {
+		err(1, "getrusage");
+	}
+}
+
+static
+void
+show(const char *what, const struct rusage *ru)
+{
+	printf("%s: user %ld.%06ld sys %ld.%06ld, %ld voluntary and "
+	       "%ld involuntary switches\n", what,
+	       (long)ru->ru_utime.tv_sec, (long)ru->ru_utime.tv_usec,
+	       (long)ru->ru_stime.tv_sec, (long)ru->ru_stime.tv_usec,
+	       (long)ru->ru_nvcsw, (long)ru->ru_nivcsw);
+}
+
+int
+main(void)
+{
+	struct rusage before, after, kids;
+	pid_t pid;
+	int status;
+
+	getusage(RUSAGE_SELF, &before);
+	spin();
+	sleep(1);
+	getusage(RUSAGE_SELF, &after);
+	show("self", &after);
+
+	if (after.ru_utime.tv_sec == before.ru_utime.tv_sec &&
+	    after.ru_utime.tv_usec == before.ru_utime.tv_usec) {
+		warnx("no user time charged while spinning");
+		failures++;
+	}
+	if (after.ru_nvcsw <= before.ru_nvcsw) {
+		warnx("sleeping didn't count as a voluntary switch");
+		failures++;
+	}
+
+	getusage(RUSAGE_CHILDREN, &kids);
+	if (kids.ru_utime.tv_sec != 0 || kids.ru_utime.tv_usec != 0) {
+		warnx("children charged before there were any");
+		failures++;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		spin();
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	getusage(RUSAGE_CHILDREN, &kids);
+	show("children", &kids);
+	if (kids.ru_utime.tv_sec == 0 && kids.ru_utime.tv_usec == 0) {
+		warnx("no user time charged for the child");
+		failures++;
+	}
+
+	if (getrusage(12345, &kids) != -1 || errno != EINVAL) {
+		warnx("bad who code wasn't rejected with EINVAL");
+		failures++;
+	}
+	if (getrusage(RUSAGE_SELF, NULL) != -1 || errno != EFAULT) {
+		warnx("null buffer wasn't rejected with EFAULT");
+		failures++;
+	}
+
+	if (failures) {
+		errx(1, "%d failures", failures);
+	}
+	printf("rusagetest: passed\n");
+	return 0;
+}
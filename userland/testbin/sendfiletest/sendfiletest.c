@@ -0,0 +1,149 @@
+/*
+ * sendfiletest - check sendfile().
+ *
+ * Copies a file of a few pages with sendfile, partly in odd-sized
+ * pieces, and checks the copy and both seek positions, then checks
+ * the error cases.
+ */
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <test/expect.h>
+
+#define SRCFILE		"sendfile.src"
+#define DSTFILE		"sendfile.dst"
+#define FILESIZE	20000
+#define SMALLPIECE	1000
+
+static char buf[FILESIZE];
+
+static
+void
+fillbuf(void)
+{
+	unsigned i;
+
+	for (i=0; i<FILESIZE; i++) {
+		buf[i] = (char)(i * 13 + i / 256);
+	}
+}
+
+static
+void
+checkpos(int fd, off_t expected, const char *what)
+{
+	off_t pos;
+
+	pos = lseek(fd, 0, SEEK_CUR);
+	if (pos != expected) {
+		warnx("%s: seek position is %ld, expected %ld", what,
+		      (long)pos, (long)expected);
+		test_failures++;
+	}
+}
+
+static
+void
+test_copy(void)
+{
+	char check[FILESIZE];
+	ssize_t len;
+	int in, out;
+
+	in = open(SRCFILE, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (in < 0) {
+		err(1, "%s", SRCFILE);
+	}
+	if (write(in, buf, FILESIZE) != FILESIZE) {
+		err(1, "%s: write", SRCFILE);
+	}
+	close(in);
+
+	in = open(SRCFILE, O_RDONLY);
+	if (in < 0) {
+		err(1, "%s", SRCFILE);
+	}
+	out = open(DSTFILE, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (out < 0) {
+		err(1, "%s", DSTFILE);
+	}
+
+	/* A small piece first, then ask for more than is left. */
+	len = sendfile(out, in, SMALLPIECE);
+	if (len != SMALLPIECE) {
+		warnx("first sendfile returned %ld", (long)len);
+		test_failures++;
+	}
+	checkpos(in, SMALLPIECE, "input after first piece");
+	checkpos(out, SMALLPIECE, "output after first piece");
+
+	len = sendfile(out, in, FILESIZE);
+	if (len != FILESIZE - SMALLPIECE) {
+		warnx("second sendfile returned %ld", (long)len);
+		test_failures++;
+	}
+	checkpos(in, FILESIZE, "input after copying");
+	checkpos(out, FILESIZE, "output after copying");
+
+	/* At EOF there's nothing more. */
+	len = sendfile(out, in, FILESIZE);
+	if (len != 0) {
+		warnx("sendfile at EOF returned %ld", (long)len);
+		test_failures++;
+	}
+	close(in);
+	close(out);
+
+	in = open(DSTFILE, O_RDONLY);
+	if (in < 0) {
+		err(1, "%s", DSTFILE);
+	}
+	len = read(in, check, FILESIZE);
+	if (len != FILESIZE || memcmp(check, buf, FILESIZE) != 0) {
+		warnx("the copy is wrong");
+		test_failures++;
+	}
+	close(in);
+}
+
+static
+void
+test_errors(void)
+{
+	int rd, wr;
+
+	rd = open(SRCFILE, O_RDONLY);
+	wr = open(DSTFILE, O_WRONLY);
+	if (rd < 0 || wr < 0) {
+		err(1, "open");
+	}
+
+	expect_err(sendfile(rd, rd, 1), EINVAL, "sendfile to the same file");
+	expect_err(sendfile(rd, wr, 1), EBADF, "sendfile the wrong way");
+	expect_err(sendfile(wr, -1, 1), EBADF, "sendfile from a bad fd");
+
+	close(rd);
+	close(wr);
+}
+
+int
+main(void)
+{
+	fillbuf();
+	test_copy();
+	test_errors();
+	remove(SRCFILE);
+	remove(DSTFILE);
+
+	if (test_failures) {
+		printf("sendfiletest: %d failures\n", test_failures);
+		return 1;
+	}
+	printf("sendfiletest: passed\n");
+	return 0;
+}
@@ -0,0 +1,185 @@
+/*
+ * spawntest - check spawn() and its file actions.
+ *
+ * Runs copies of itself with an argument saying what the child
+ * should check, and looks at their exit status (and, for the
+ * redirection test, their output).
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+
+#define SELF		"/testbin/spawntest"
+#define OUTFILE		"spawntest.out"
+#define MESSAGE		"spawned child was here\n"
+#define CLOSEFD		7
+
+static int failures;
+
+/*
+ * Child side: write the message to stdout.
+ */
+static
+int
+child_write(void)
+{
+	size_t len = strlen(MESSAGE);
+
+	if (write(STDOUT_FILENO, MESSAGE, len) != (ssize_t)len) {
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Child side: CLOSEFD should have been closed for us.
+ */
+static
+int
+child_closed(void)
+{
+	if (write(CLOSEFD, "x", 1) >= 0 || errno != EBADF) {
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Spawn ourselves with argument WHAT and wait for the result.
+ */
+static
+void
+run(const char *what, const struct spawn_action *actions, int nactions)
+{
+	char *args[3];
+	pid_t pid;
+	int status;
+
+	args[0] = (char *)SELF;
+	args[1] = (char *)what;
+	args[2] = NULL;
+
+	pid = spawn(SELF, args, actions, nactions);
+	if (pid < 0) {
+		warn("spawn (%s)", what);
+		failures++;
+		return;
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		warn("waitpid (%s)", what);
+		failures++;
+		return;
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		warnx("%s: child failed (status %d)", what, status);
+		failures++;
+	}
+}
+
+static
+void
+test_errors(void)
+{
+	char *args[2];
+	struct spawn_action bad;
+
+	args[0] = (char *)"/nonexistent";
+	args[1] = NULL;
+	if (spawn(args[0], args, NULL, 0) >= 0 || errno != ENOENT) {
+		warnx("spawn of a missing program: expected ENOENT");
+		failures++;
+	}
+
+	args[0] = (char *)SELF;
+	bad.sa_op = SPAWN_CLOSE;
+	bad.sa_fd = CLOSEFD;
+	bad.sa_newfd = 0;
+	close(CLOSEFD);
+	if (spawn(SELF, args, &bad, 1) >= 0 || errno != EBADF) {
+		warnx("spawn closing an unopened fd: expected EBADF");
+		failures++;
+	}
+}
+
+static
+void
+test_redirect(void)
+{
+	struct spawn_action act[2];
+	char buf[64];
+	ssize_t len;
+	int fd;
+
+	fd = open(OUTFILE, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", OUTFILE);
+	}
+	act[0].sa_op = SPAWN_DUP2;
+	act[0].sa_fd = fd;
+	act[0].sa_newfd = STDOUT_FILENO;
+	act[1].sa_op = SPAWN_CLOSE;
+	act[1].sa_fd = fd;
+	act[1].sa_newfd = 0;
+	run("write", act, 2);
+	close(fd);
+
+	fd = open(OUTFILE, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", OUTFILE);
+	}
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	remove(OUTFILE);
+	if (len < 0) {
+		err(1, "%s: read", OUTFILE);
+	}
+	buf[len] = 0;
+	if (strcmp(buf, MESSAGE) != 0) {
+		warnx("redirected output was wrong: got %d bytes", (int)len);
+		failures++;
+	}
+}
+
+static
+void
+test_close(void)
+{
+	struct spawn_action act;
+
+	if (dup2(STDOUT_FILENO, CLOSEFD) < 0) {
+		err(1, "dup2");
+	}
+	act.sa_op = SPAWN_CLOSE;
+	act.sa_fd = CLOSEFD;
+	act.sa_newfd = 0;
+	run("closed", &act, 1);
+	close(CLOSEFD);
+}
+
+int
+main(int argc, char *argv[])
+{
+	if (argc == 2 && !strcmp(argv[1], "write")) {
+		return child_write();
+	}
+	if (argc == 2 && !strcmp(argv[1], "closed")) {
+		return child_closed();
+	}
+
+	test_errors();
+	test_redirect();
+	test_close();
+
+	if (failures) {
+		printf("spawntest: %d failures\n", failures);
+		return 1;
+	}
+	printf("spawntest: passed\n");
+	return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * uthreadtest - check thread_create/thread_join, and the umutex and
+ * ucond library under real contention.
+ *
+ * NTHREADS threads each add to a shared counter under a mutex; if the
+ * total comes out wrong, either the mutex or the kernel's handling of
+ * threads sharing an address space is broken. Then a barrier built
+ * from a mutex and a condition variable makes sure sleeping and
+ * waking across threads works, and finally the join error cases are
+ * checked.
+ *
+ * Last, the program execs itself with an argument list close to
+ * ARG_MAX, which pushes the main thread's stack down past its own
+ * slot, and starts a thread that scribbles over a good part of its
+ * stack. The arguments have to come through that intact.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <err.h>
+#include <umutex.h>
+
+#define NTHREADS	8
+#define NLOOPS		2000
+
+/*
+ * Enough argument strings to fill every page exec allows for them, so
+ * that the argv pointers and main's stack frames land in thread slot 1.
+ */
+#define BIGARGLEN	1000			/* bytes per argument */
+#define NBIGARGS	(ARG_MAX / BIGARGLEN - 1)
+#define SCRIBBLE	(32 * 1024)		/* well inside a thread stack */
+
+static struct umutex lock = UMUTEX_INITIALIZER;
+static struct ucond barriercv = UCOND_INITIALIZER;
+static int counter;
+static int arrived;
+static int ids[NTHREADS];
+
+static
+void *
+adder(void *arg)
+{
+	int i;
+
+	for (i=0; i<NLOOPS; i++) {
+		umutex_lock(&lock);
+		counter++;
+		umutex_unlock(&lock);
+	}
+
+	/* Wait for everyone, so all the threads are alive at once. */
+	umutex_lock(&lock);
+	arrived++;
+	if (arrived == NTHREADS) {
+		ucond_broadcast(&barriercv);
+	}
+	while (arrived < NTHREADS) {
+		ucond_wait(&barriercv, &lock);
+	}
+	umutex_unlock(&lock);
+
+	return arg;
+}
+
+static
+void *
+scribbler(void *arg)
+{
+	char buf[SCRIBBLE];
+
+	memset(buf, 'x', sizeof(buf));
+	/* Keep the compiler from dropping the memset. */
+	return buf[SCRIBBLE / 2] == 'x' ? arg : NULL;
+}
+
+/*
+ * The second half: we've been exec'd with NBIGARGS arguments of
+ * BIGARGLEN-1 copies of a letter each.
+ */
+static
+int
+bigargs(int argc, char **argv)
+{
+	static char check[BIGARGLEN];
+	void *value;
+	int tid, i;
+
+	if (argc != NBIGARGS + 2) {
+		errx(1, "bigargs: argc is %d, expected %d", argc,
+		     NBIGARGS + 2);
+	}
+	check[BIGARGLEN - 1] = 0;
+
+	tid = thread_create(scribbler, &ids[0]);
+	if (tid < 0) {
+		err(1, "bigargs: thread_create");
+	}
+	if (thread_join(tid, &value) < 0) {
+		err(1, "bigargs: thread_join");
+	}
+	if (value != &ids[0]) {
+		errx(1, "bigargs: thread returned %p", value);
+	}
+
+	if (argv[argc] != NULL) {
+		errx(1, "bigargs: argv was overwritten");
+	}
+	for (i=0; i<NBIGARGS; i++) {
+		memset(check, 'a' + i % 26, BIGARGLEN - 1);
+		if (strcmp(argv[i + 2], check) != 0) {
+			errx(1, "bigargs: argument %d was overwritten", i);
+		}
+	}
+
+	printf("uthreadtest: passed\n");
+	return 0;
+}
+
+/*
+ * Exec ourselves with an argv big enough that the main thread's stack
+ * runs into the next thread slot or two.
+ */
+static
+void
+execbig(const char *prog)
+{
+	static char args[NBIGARGS][BIGARGLEN];
+	static char *bigargv[NBIGARGS + 3];
+	int i;
+
+	bigargv[0] = (char *)prog;
+	bigargv[1] = (char *)"bigargs";
+	for (i=0; i<NBIGARGS; i++) {
+		memset(args[i], 'a' + i % 26, BIGARGLEN - 1);
+		bigargv[i + 2] = args[i];
+	}
+	bigargv[NBIGARGS + 2] = NULL;
+
+	execv(prog, bigargv);
+	err(1, "execv %s", prog);
+}
+
+int
+main(int argc, char **argv)
+{
+	int tids[NTHREADS];
+	void *value;
+	int i, failures = 0;
+
+	if (argc > 1 && !strcmp(argv[1], "bigargs")) {
+		return bigargs(argc, argv);
+	}
+
+	for (i=0; i<NTHREADS; i++) {
+		tids[i] = thread_create(adder, &ids[i]);
+		if (tids[i] < 0) {
+			err(1, "thread_create");
+		}
+	}
+
+	for (i=0; i<NTHREADS; i++) {
+		if (thread_join(tids[i], &value) < 0) {
+			err(1, "thread_join %d", tids[i]);
+		}
+		if (value != &ids[i]) {
+			warnx("thread %d returned %p", tids[i], value);
+			failures++;
+		}
+	}
+
+	if (counter != NTHREADS * NLOOPS) {
+		warnx("counter is %d, expected %d", counter,
+		      NTHREADS * NLOOPS);
+		failures++;
+	}
+
+	if (thread_join(tids[0], NULL) != -1 || errno != ESRCH) {
+		warnx("joining a thread twice didn't fail with ESRCH");
+		failures++;
+	}
+	if (thread_join(-1, NULL) != -1 || errno != ESRCH) {
+		warnx("joining thread -1 didn't fail with ESRCH");
+		failures++;
+	}
+
+	if (failures) {
+		errx(1, "%d failures", failures);
+	}
+	execbig("/testbin/uthreadtest");
+	return 1;
+}
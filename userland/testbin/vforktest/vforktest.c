@@ -0,0 +1,112 @@
+/*
+ * vforktest - check that a vfork child runs in our address space
+ * while we wait, and that exec and exit both let us go again.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+static volatile int shared;
+static int failures;
+
+static
+void
+reap(pid_t pid, int expected, const char *what)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		warn("%s: waitpid", what);
+		failures++;
+	}
+	else if (!WIFEXITED(status) || WEXITSTATUS(status) != expected) {
+		warnx("%s: unexpected status %d", what, status);
+		failures++;
+	}
+}
+
+/*
+ * The child's store must be visible to us, and we must not run until
+ * it has exited.
+ */
+static
+void
+test_exit(void)
+{
+	pid_t pid;
+
+	shared = 0;
+	pid = vfork();
+	if (pid < 0) {
+		err(1, "vfork");
+	}
+	if (pid == 0) {
+		shared = 1;
+		_exit(3);
+	}
+	if (shared != 1) {
+		warnx("exit: parent did not see the child's store");
+		failures++;
+	}
+	reap(pid, 3, "exit");
+}
+
+/*
+ * Exec from the child. A failed exec leaves the child still in our
+ * address space, so it can pass errno back the same way.
+ */
+static
+void
+test_exec(void)
+{
+	char *args[2];
+	pid_t pid;
+
+	args[0] = (char *)"/nonexistent";
+	args[1] = NULL;
+	shared = 0;
+	pid = vfork();
+	if (pid < 0) {
+		err(1, "vfork");
+	}
+	if (pid == 0) {
+		execv(args[0], args);
+		shared = errno;
+		_exit(0);
+	}
+	if (shared != ENOENT) {
+		warnx("exec: child's failed execv gave %d, not ENOENT",
+		      shared);
+		failures++;
+	}
+	reap(pid, 0, "failed exec");
+
+	args[0] = (char *)"/bin/true";
+	pid = vfork();
+	if (pid < 0) {
+		err(1, "vfork");
+	}
+	if (pid == 0) {
+		execv(args[0], args);
+		_exit(1);
+	}
+	reap(pid, 0, "exec");
+}
+
+int
+main(void)
+{
+	test_exit();
+	test_exec();
+
+	if (failures) {
+		printf("vforktest: %d failures\n", failures);
+		return 1;
+	}
+	printf("vforktest: passed\n");
+	return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * waitanytest - check waitpid(WAIT_ANY) and WNOHANG.
+ *
+ * Forks children that exit in the reverse of the order they were
+ * created, and checks that waiting for any child picks each of them
+ * up exactly once, then fails with ECHILD.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include <err.h>
+
+#define NKIDS	8
+
+static pid_t kids[NKIDS];
+static int failures;
+
+static
+void
+napms(unsigned ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000;
+	nanosleep(&ts, NULL);
+}
+
+int
+main(void)
+{
+	int i, j, status;
+	pid_t pid;
+
+	for (i=0; i<NKIDS; i++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			/* later children finish first */
+			napms((NKIDS - i) * 100);
+			_exit(i);
+		}
+		kids[i] = pid;
+	}
+
+	/* Nobody should be done yet. */
+	pid = waitpid(WAIT_ANY, &status, WNOHANG);
+	if (pid != 0) {
+		warnx("WNOHANG with no exited children returned %d", pid);
+		failures++;
+	}
+
+	for (i=0; i<NKIDS; i++) {
+		pid = waitpid(WAIT_ANY, &status, 0);
+		if (pid < 0) {
+			err(1, "waitpid");
+		}
+		for (j=0; j<NKIDS; j++) {
+			if (kids[j] == pid) {
+				break;
+			}
+		}
+		if (j == NKIDS) {
+			warnx("waitpid returned unknown pid %d", pid);
+			failures++;
+			continue;
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != j) {
+			warnx("pid %d: wrong status %d", pid, status);
+			failures++;
+		}
+		kids[j] = 0;
+	}
+
+	pid = waitpid(WAIT_ANY, &status, 0);
+	if (pid >= 0 || errno != ECHILD) {
+		warnx("waitpid with no children: expected ECHILD");
+		failures++;
+	}
+
+	if (failures) {
+		printf("waitanytest: %d failures\n", failures);
+		return 1;
+	}
+	printf("waitanytest: passed\n");
+	return 0;
+}